@@ -0,0 +1,135 @@
+#!/bin/bash
+
+operation=$1
+chroot_path=$2
+sources_root=$3
+build_dir=$4
+workspace_dir=$5
+workspace_chroot_dir=$6
+sudo_user=$7
+
+# Check if parameters were passed
+if [ -z "$operation" ] || [ -z "$chroot_path" ] || [ -z "$sources_root" ] || [ -z "$build_dir" ] || [ -z "$workspace_dir" ] || [ -z "$workspace_chroot_dir" ] || [ -z "$sudo_user" ]; then
+    echo "From buildLayer.sh: Usage: $0 <create|discard> <chroot_path> <sources_root> <build_dir> <workspace_dir> <workspace_chroot_dir> <sudo_user>"
+    exit 1
+fi
+
+# Command outputs and echoes are read by the daemon, which writes them to the main log (tagged with the architecture and the stage
+# for create, directly by the main process for discard)
+
+if [ "$sudo_user" = "1" ]; then
+    sudo_cmd="sudo"
+else
+    sudo_cmd=""
+fi
+
+# Layers of the overlay of a build, from the top:
+#   <build_dir>/root  throwaway, written by the build
+#   <sources_root>    persistent tree of the synced sources (only written by the sources sync of the daemon, between builds)
+#   <chroot_path>     base chroot (only written by the chroot setup and provision stages)
+# Layout of <build_dir> (one throwaway copy-on-write layer over the read-only lower layers):
+#   root/    upper layer of the overlay: everything a build writes ends up here. The host-side scripts (worker directories, test setup...)
+#            write here directly, and the files appear at the same path in the merged view
+#   work/    work directory of overlayfs (must be on the same filesystem as root/)
+#   merged/  mount point of the overlay, mounted only inside the mount namespace of root/_enter
+# The overlay is never mounted in the host namespace: it disappears with the last process of the build
+# <workspace_dir> (persistent build trees and compiler cache of the architecture) is not a layer: it is bind-mounted read-write
+# at <workspace_chroot_dir> in the merged view, so what the builds write there survives the discard of the layer
+
+# Remove the layer of the previous build. The rename is instant, so a new layer can be created even if the removal fails
+discard_layer() {
+    [ -e "$build_dir" ] || return 0
+    local trash="$build_dir.discarded.$$"
+    $sudo_cmd mv "$build_dir" "$trash" || return 1
+    $sudo_cmd rm -rf "$trash"
+    if [ $? -ne 0 ]; then
+        echo "Warning: From buildLayer.sh: Failed to remove the discarded build layer $trash."
+    fi
+    return 0
+}
+
+case "$operation" in
+    create)
+        if [ ! -x "$chroot_path/_enter" ]; then
+            echo "Error: From buildLayer.sh: $chroot_path is not a complete chroot (_enter missing)."
+            exit 1
+        fi
+
+        # Leftovers of builds interrupted before their discard
+        for stale in "$build_dir".discarded.*; do
+            [ -e "$stale" ] && $sudo_cmd rm -rf "$stale"
+        done
+
+        if ! discard_layer; then
+            echo "Error: From buildLayer.sh: Failed to discard the previous build layer $build_dir."
+            exit 1
+        fi
+
+        mkdir -p "$sources_root" "$workspace_dir" "$build_dir/root/home" "$build_dir/work" "$build_dir/merged"
+        if [ $? -ne 0 ]; then
+            echo "Error: From buildLayer.sh: Failed to create the build layer directories in $build_dir."
+            exit 1
+        fi
+
+        # _enter of the layer: same interface as the _enter of the base chroot, but it enters the overlay (lower layers + this layer).
+        # First the variables (expanded now), then the body (single-quoted heredoc, no premature expansions)
+        cat > "$build_dir/root/_enter" <<EOF
+#!/bin/bash
+set -e
+USE_SUDO="$sudo_user"
+LOWER_DIR="$sources_root:$chroot_path"
+WORKSPACE_DIR="$workspace_dir"
+WORKSPACE_CHROOT_DIR="$workspace_chroot_dir"
+EOF
+        cat >> "$build_dir/root/_enter" <<'EOF'
+export PATH=/usr/sbin:$PATH
+
+# Host path of the layer, derived from the position of this script (<build_dir>/root/_enter)
+BUILD_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+
+# Runs inside the new mount namespace: mounts the overlay (LOWER_DIR lists the lower layers, topmost first), the workspace and /proc,
+# then enters it like the _enter of the base chroot.
+# The fakeroot database is the one of the base chroot: its updates are copied up into the layer, the base stays untouched
+ENTER_LAYER='
+set -e
+lower=$1; build=$2; extra_opts=$3; workspace=$4; workspace_target=$5; shift 5
+mount -t overlay overlay -o "lowerdir=$lower,upperdir=$build/root,workdir=$build/work$extra_opts" "$build/merged"
+mkdir -p "$build/merged$workspace_target"
+mount --bind "$workspace" "$build/merged$workspace_target"
+mount -t proc proc "$build/merged/proc"
+export FAKEROOTDONTTRYCHOWN=1
+exec chroot "$build/merged" fakeroot -i .fakeroot.env -s .fakeroot.env "$@"
+'
+
+# - with sudo: no user namespace, the overlay is mounted by the real root
+# - without sudo: unprivileged overlayfs inside a user namespace (Linux >= 5.11), which needs the userxattr option
+if [ "$USE_SUDO" = "1" ]; then
+  sudo unshare -fp -m /bin/bash -c "$ENTER_LAYER" _enter "$LOWER_DIR" "$BUILD_DIR" "" "$WORKSPACE_DIR" "$WORKSPACE_CHROOT_DIR" "$@"
+else
+  unshare -fpr -m /bin/bash -c "$ENTER_LAYER" _enter "$LOWER_DIR" "$BUILD_DIR" ",userxattr" "$WORKSPACE_DIR" "$WORKSPACE_CHROOT_DIR" "$@"
+fi
+EOF
+        chmod +x "$build_dir/root/_enter"
+        if [ $? -ne 0 ]; then
+            echo "Error: From buildLayer.sh: Failed to create the _enter script of the build layer."
+            exit 1
+        fi
+
+        echo "From buildLayer.sh: Build layer created at $build_dir over $sources_root and $chroot_path (workspace $workspace_dir)."
+        ;;
+
+    discard)
+        if ! discard_layer; then
+            echo "Error: From buildLayer.sh: Failed to discard the build layer $build_dir."
+            exit 1
+        fi
+        echo "From buildLayer.sh: Build layer $build_dir discarded."
+        ;;
+
+    *)
+        echo "Error: From buildLayer.sh: Unknown operation $operation (use create or discard)."
+        exit 1
+        ;;
+esac
+
+exit 0
@@ -2,31 +2,42 @@
 
 arch=$1
 chroot_path=$2
-logfile=$3
-wrapper_script=$4
-sudo_user=$5
+wrapper_script=$3
+sudo_user=$4
+stage=$5
+rootfs_cache_dir=$6
+deb_cache_dir=$7
+mirror=$8
 
 # Controlla che i parametri siano stati passati
-if [ -z "$arch" ] || [ -z "$chroot_path" ] || [ -z "$logfile" ] || [ -z "$wrapper_script" ] || [ -z "$sudo_user" ]; then
-    echo "From chrootSetup.sh: Usage: $0 <architecture> <chroot_path> <logfile> <wrapper_script> <sudo_user>" >&2
+if [ -z "$arch" ] || [ -z "$chroot_path" ] || [ -z "$wrapper_script" ] || [ -z "$sudo_user" ] || [ -z "$stage" ] || [ -z "$rootfs_cache_dir" ] || [ -z "$deb_cache_dir" ] || [ -z "$mirror" ]; then
+    echo "From chrootSetup.sh: Usage: $0 <architecture> <chroot_path> <wrapper_script> <sudo_user> <first|second> <rootfs_cache_dir> <deb_cache_dir> <mirror>" >&2
     exit 1
 fi
 
-# Controllo log file
-if [ ! -f "$logfile" ]; then
-    echo "Error: From chrootSetup.sh: Logfile does not exist: $logfile" >&2
+if [ "$stage" != "first" ] && [ "$stage" != "second" ]; then
+    echo "Error: From chrootSetup.sh: Invalid stage $stage (use first or second)" >&2
     exit 1
 fi
 
-exec >>"$logfile" 2>&1
-echo "From chrootSetup.sh: (rootless) starting setup for $arch at $chroot_path"
+# Nota: gli output dei comandi e gli echo vengono letti dal demone, che li scrive nel log principale (con l'architettura e la fase)
+echo "From chrootSetup.sh: (rootless) starting $stage stage setup for $arch at $chroot_path"
 
-# Se il rootfs sembra già pronto (esiste _enter e una home) esco
-if [ -d "$chroot_path/home" ] && [ -x "$chroot_path/_enter" ]; then
+# Marker lasciato dal wrapper alla fine del first stage e rimosso alla fine del second stage
+stage1_marker="$chroot_path/_stage1.done"
+
+# Se il rootfs sembra già pronto (esiste _enter e una home, e il second stage non è in sospeso) esco
+if [ -d "$chroot_path/home" ] && [ -x "$chroot_path/_enter" ] && [ ! -f "$stage1_marker" ]; then
     echo "From chrootSetup.sh: Rootfs already present for $arch. Skipping debootstrap."
     exit 0
 fi
 
+if [ "$sudo_user" = "1" ]; then
+    sudo_cmd="sudo"
+else
+    sudo_cmd=""
+fi
+
 # Controllo wrapper
 if [ ! -x "$wrapper_script" ]; then
     echo "From chrootSetup.sh: Making wrapper executable: $wrapper_script"
@@ -44,13 +55,140 @@ else
     suite="trixie"
 fi
 
-mirror="http://deb.debian.org/debian"
+# Nota: il mirror (DEBIAN_MIRROR in ci.conf) può anche essere un mirror locale file://
+# Pacchetti aggiuntivi per debootstrap (il wrapper aggiunge sempre fakeroot)
+include_pkgs=""
+
+# Cache dei rootfs base: un tarball compresso per ogni (suite, arch, lista di pacchetti), indirizzato dall'hash della chiave.
+# Il tarball viene creato (e letto) dentro fakeroot, così conserva anche i proprietari fittizi registrati in .fakeroot.env
+cache_key=$(printf 'rootfs-cache-v1\nsuite=%s\narch=%s\ninclude=%s\n' "$suite" "$arch" "${include_pkgs:+$include_pkgs,}fakeroot" | sha256sum | cut -c1-16)
+cache_base="$rootfs_cache_dir/rootfs-$arch-$suite-$cache_key"
+
+# Scelta del compressore: pzstd comprime e decomprime in parallelo, zstd -T0 solo in compressione, pigz/gzip come ripiego
+if command -v pzstd >/dev/null 2>&1; then
+    cache_ext="tar.zst"; compress_cmd="pzstd -q -c"
+elif command -v zstd >/dev/null 2>&1; then
+    cache_ext="tar.zst"; compress_cmd="zstd -q -T0 -c"
+elif command -v pigz >/dev/null 2>&1; then
+    cache_ext="tar.gz"; compress_cmd="pigz -c"
+else
+    cache_ext="tar.gz"; compress_cmd="gzip -c"
+fi
+
+decompress_cmd_for() {
+    case "$1" in
+        *.tar.zst)
+            if command -v pzstd >/dev/null 2>&1; then echo "pzstd -q -d -c"; else echo "zstd -q -d -c"; fi ;;
+        *.tar.gz)
+            if command -v pigz >/dev/null 2>&1; then echo "pigz -d -c"; else echo "gzip -d -c"; fi ;;
+    esac
+}
+
+# Estrae il rootfs dalla cache (se presente). Ritorna 0 solo se il rootfs completo è stato ripristinato
+restore_from_cache() {
+    local tarball=""
+    for candidate in "$cache_base.tar.zst" "$cache_base.tar.gz"; do
+        if [ -f "$candidate" ]; then
+            tarball="$candidate"
+            break
+        fi
+    done
+    [ -n "$tarball" ] || return 1
+
+    local decompress_cmd
+    decompress_cmd=$(decompress_cmd_for "$tarball")
+    if ! command -v ${decompress_cmd%% *} >/dev/null 2>&1; then
+        echo "Warning: From chrootSetup.sh: ${decompress_cmd%% *} not available, cannot use cached rootfs $tarball."
+        return 1
+    fi
+
+    echo "From chrootSetup.sh: Restoring cached base rootfs $tarball into $chroot_path..."
+    $sudo_cmd mkdir -p "$chroot_path" || return 1
+    $decompress_cmd "$tarball" | $sudo_cmd fakeroot -s "$chroot_path/.fakeroot.env" -- tar -C "$chroot_path" --numeric-owner -xpf -
+    local pipe_status=("${PIPESTATUS[@]}")
+    if [ "${pipe_status[0]}" -ne 0 ] || [ "${pipe_status[1]}" -ne 0 ]; then
+        echo "Warning: From chrootSetup.sh: Failed to restore cached rootfs $tarball, removing it and falling back to debootstrap."
+        $sudo_cmd rm -rf "$chroot_path"
+        rm -f "$tarball"
+        return 1
+    fi
+
+    # _enter registra se usare sudo: lo riallineo a come è stato lanciato il daemon questa volta
+    $sudo_cmd sed -i "s/^USE_SUDO=.*/USE_SUDO=\"$sudo_user\"/" "$chroot_path/_enter"
+    echo "From chrootSetup.sh: Cached base rootfs restored for $arch."
+    return 0
+}
+
+# Salva il rootfs appena completato nella cache (best effort: un errore non compromette il setup)
+save_to_cache() {
+    mkdir -p "$rootfs_cache_dir" || return 1
+    local tarball="$cache_base.$cache_ext"
+    local tmp_tarball="$rootfs_cache_dir/.tmp.$$.$(basename "$tarball")"
 
-echo "From chrootSetup.sh: Running rootless debootstrap (suite=$suite arch=$arch mirror=$mirror)..."
-"$wrapper_script" --target-dir "$chroot_path" --suite "$suite" --mirror "$mirror" --arch "$arch" --sudo-user "$sudo_user"
+    echo "From chrootSetup.sh: Saving base rootfs of $arch into cache $tarball..."
+    $sudo_cmd fakeroot -i "$chroot_path/.fakeroot.env" -- tar -C "$chroot_path" --numeric-owner \
+        --exclude=./.fakeroot.env --exclude=./_stage1.done -cpf - . | $compress_cmd > "$tmp_tarball"
+    local pipe_status=("${PIPESTATUS[@]}")
+    if [ "${pipe_status[0]}" -ne 0 ] || [ "${pipe_status[1]}" -ne 0 ]; then
+        echo "Warning: From chrootSetup.sh: Failed to save base rootfs of $arch into cache."
+        rm -f "$tmp_tarball"
+        return 1
+    fi
+
+    # Il rename rende visibile il tarball solo quando è completo
+    mv -f "$tmp_tarball" "$tarball" || { rm -f "$tmp_tarball"; return 1; }
+    echo "From chrootSetup.sh: Base rootfs of $arch saved into cache."
+    return 0
+}
+
+if [ "$stage" = "first" ]; then
+    # First stage (download e unpack): limitato da rete e I/O, può girare per tutte le architetture contemporaneamente
+    if [ -f "$stage1_marker" ]; then
+        echo "From chrootSetup.sh: First stage already completed for $arch. Skipping it."
+        exit 0
+    fi
+
+    # Un target senza marker e senza un rootfs completo è ciò che resta di un first stage interrotto: riparto da zero
+    if [ -e "$chroot_path" ]; then
+        echo "Warning: From chrootSetup.sh: Found an incomplete rootfs for $arch at $chroot_path. Removing it..."
+        $sudo_cmd rm -rf "$chroot_path"
+        if [ $? -ne 0 ]; then
+            echo "Error: From chrootSetup.sh: Failed to remove the incomplete rootfs $chroot_path."
+            exit 1
+        fi
+    fi
+
+    # Con un rootfs in cache non serve alcun debootstrap: il second stage troverà il rootfs già completo e non farà nulla
+    if restore_from_cache; then
+        echo "From chrootSetup.sh: Chroot (rootless) setup completed from cache for $arch at $chroot_path."
+        exit 0
+    fi
+
+    echo "From chrootSetup.sh: Running rootless debootstrap first stage (suite=$suite arch=$arch mirror=$mirror)..."
+    echo "::step debootstrap-first"
+    "$wrapper_script" --target-dir "$chroot_path" --suite "$suite" --mirror "$mirror" --arch "$arch" --sudo-user "$sudo_user" --stage first --deb-cache "$deb_cache_dir" ${include_pkgs:+--include "$include_pkgs"}
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "Error: From chrootSetup.sh: rootless debootstrap first stage failed (exit $status)."
+        exit 1
+    fi
+
+    echo "From chrootSetup.sh: First stage completed successfully for $arch at $chroot_path."
+    exit 0
+fi
+
+# Second stage (emulato con qemu per le architetture foreign): limitato dalla CPU, viene regolato dallo scheduler di ammissione del daemon
+if [ ! -f "$stage1_marker" ]; then
+    echo "Error: From chrootSetup.sh: First stage not completed for $arch, cannot run the second stage." >&2
+    exit 1
+fi
+
+echo "From chrootSetup.sh: Running rootless debootstrap second stage (arch=$arch)..."
+echo "::step debootstrap-second"
+"$wrapper_script" --target-dir "$chroot_path" --sudo-user "$sudo_user" --stage second --deb-cache "$deb_cache_dir" --arch "$arch"
 status=$?
 if [ $status -ne 0 ]; then
-    echo "Error: From chrootSetup.sh: rootless debootstrap failed (exit $status)."
+    echo "Error: From chrootSetup.sh: rootless debootstrap second stage failed (exit $status)."
     exit 1
 fi
 
@@ -63,5 +201,7 @@ fi
 echo "From chrootSetup.sh: Ensuring basic directories exist..."
 mkdir -p "$chroot_path/home" || true
 
+save_to_cache
+
 echo "From chrootSetup.sh: Chroot (rootless) setup completed successfully for $arch at $chroot_path."
 exit 0
@@ -5,25 +5,27 @@ sshlirp_chroot_src_dir=$2
 libslirp_chroot_src_dir=$3
 target_chroot_dir=$4
 arch=$5
-chroot_logfile=$6
+workspace_chroot_dir=$6
+libslirp_commit=$7
 
 # Check if parameters were passed
-if [ -z "$chroot_path" ] || [ -z "$sshlirp_chroot_src_dir" ] || [ -z "$libslirp_chroot_src_dir" ] || [ -z "$target_chroot_dir" ] || [ -z "$arch" ] || [ -z "$chroot_logfile" ]; then
-    echo "From compile.sh: Usage: $0 <chroot_path> <sshlirp_chroot_src_dir> <libslirp_chroot_src_dir> <target_chroot_dir> <arch> <chroot_logfile>"
+if [ -z "$chroot_path" ] || [ -z "$sshlirp_chroot_src_dir" ] || [ -z "$libslirp_chroot_src_dir" ] || [ -z "$target_chroot_dir" ] || [ -z "$arch" ] || [ -z "$workspace_chroot_dir" ] || [ -z "$libslirp_commit" ]; then
+    echo "From compile.sh: Usage: $0 <chroot_path> <sshlirp_chroot_src_dir> <libslirp_chroot_src_dir> <target_chroot_dir> <arch> <workspace_chroot_dir> <libslirp_commit>"
     exit 1
 fi
 
-# Get the absolute path of the chroot log file (needed only for the first potential log)
-abs_chroot_log_file_path="$chroot_path$chroot_logfile"
+# Persistent build trees and compiler cache of the architecture: the workspace is bind-mounted by the _enter of the build layer,
+# so unlike the rest of the layer it survives between rounds and a new commit only rebuilds what it changed
+libslirp_build_dir="$workspace_chroot_dir/libslirp-build"
+sshlirp_build_dir="$workspace_chroot_dir/sshlirp-build"
+ccache_dir="$workspace_chroot_dir/ccache"
+build_jobs_file="$workspace_chroot_dir/build-jobs"
 
-# Check that the log file exists
-if [ ! -f "$abs_chroot_log_file_path" ]; then
-    echo "Error: From compile.sh: Logfile does not exist: $abs_chroot_log_file_path"
-    exit 1
-fi
+# Install cache of libslirp: one prefix per key (libslirp commit + toolchain + build flags), see below
+libslirp_install_cache_dir="$workspace_chroot_dir/libslirp-install"
+libslirp_meson_options="--default-library=static -Dlibdir=lib"
 
-# Redirect command outputs and echoes to the log file (this time it's the log file inside the chroot)
-exec >> "$abs_chroot_log_file_path" 2>&1
+# Note: stdout and stderr are pipes read by the daemon, which appends the output to the main log as it is produced
 
 # Check that the chroot exists
 if [ ! -d "$chroot_path" ]; then
@@ -37,6 +39,8 @@ if [ ! -x "$enter_bin" ]; then
     exit 1
 fi
 
+# Note: chroot_path is the upper directory of the build layer (see buildLayer.sh): its _enter mounts the overlay over the base chroot,
+# while the build trees and the libslirp install cache are in the persistent workspace
 # Avvio ambiente rootless tramite _enter (fakeroot+unshare) e passo script via here-doc
 "$enter_bin" /bin/bash <<EOF
 
@@ -57,111 +61,142 @@ if [ ! -d "$target_chroot_dir" ]; then
     echo "From compile.sh (inside chroot): Target chroot directory $target_chroot_dir created."
 fi
 
-# Install the dependencies necessary for compilation
-echo "From compile.sh (inside chroot): Installing build dependencies..."
-apt-get update
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to update package list."
+# Note: the toolchain and the build dependencies are installed once by provision.sh (provision stage of the worker),
+# which repeats the installation only when the dependency list or the suite of the chroot change
+
+# Parallel jobs of make/ninja: the daemon splits the CPUs not used by the other stages among the compilations in flight and keeps the jobs
+# file up to date, so the value is read again before each run (a stage of another architecture may have started or ended in the meantime)
+build_jobs() {
+    local jobs=\$(cat "$build_jobs_file" 2>/dev/null)
+    case "\$jobs" in
+        ''|*[!0-9]*|0) jobs=1 ;;
+    esac
+    echo "\$jobs"
+}
+
+# Compiler cache (if installed by the provision stage): it survives even the build trees, e.g. when a toolchain update forces a reconfigure
+if command -v ccache >/dev/null 2>&1; then
+    export CCACHE_DIR="$ccache_dir"
+    export CCACHE_MAXSIZE=2G
+    compiler_launcher="ccache"
+    echo "From compile.sh (inside chroot): Using ccache in \$CCACHE_DIR."
+else
+    compiler_launcher=""
+    echo "Warning: From compile.sh (inside chroot): ccache not found, building without compiler cache."
+fi
+
+# Key of the libslirp install: commit, versions of the toolchain and of the libraries libslirp is built against, and build flags.
+# A static libslirp only has to be rebuilt when one of them changes, not for every new sshlirp commit
+toolchain_versions=\$(dpkg-query -W -f '\${Package}=\${Version}\n' gcc libc6-dev libglib2.0-dev meson ninja-build 2>/dev/null)
+if [ -z "\$toolchain_versions" ]; then
+    echo "Error: From compile.sh (inside chroot): Could not read the toolchain versions of the chroot."
     exit 1
 fi
-apt-get install -y build-essential git devscripts debhelper dh-exec \\
-            libglib2.0-dev pkg-config adduser \\
-            gcc g++ libcap-ng-dev libseccomp-dev \\
-	        cmake git-buildpackage meson ninja-build \\
-	        libvdeplug-dev libvdeslirp-dev
+libslirp_key=\$(printf '%s\n%s\n%s\n' "$libslirp_commit" "\$toolchain_versions" "$libslirp_meson_options" | sha256sum | cut -c1-16)
+libslirp_prefix="$libslirp_install_cache_dir/\$libslirp_key"
 
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to install build dependencies (probably due to bookworm). Retrying..."
-    apt-get update
-    apt-get install -y build-essential git devscripts debhelper dh-exec \\
-            libglib2.0-dev pkg-config adduser \\
-            gcc g++ libcap-ng-dev libseccomp-dev \\
-	        cmake git-buildpackage meson ninja-build \\
-	        libvdeplug-dev libvdeslirp-dev
+if [ -f "\$libslirp_prefix/.complete" ]; then
+    echo "From compile.sh (inside chroot): libslirp install cache hit (key \$libslirp_key, commit $libslirp_commit): skipping the libslirp build."
+else
+    echo "From compile.sh (inside chroot): libslirp install cache miss (key \$libslirp_key, commit $libslirp_commit)."
+
+    # Move to the libslirp source directory inside the chroot
+    cd "$libslirp_chroot_src_dir"
     if [ \$? -ne 0 ]; then
-        echo "Error: From compile.sh (inside chroot): Failed to install build dependencies after retry."
+        echo "Error: From compile.sh (inside chroot): Failed to change directory to $libslirp_chroot_src_dir."
         exit 1
     fi
-fi
 
-# Move to the libslirp source directory inside the chroot
-cd "$libslirp_chroot_src_dir"
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to change directory to $libslirp_chroot_src_dir."
-    exit 1
-fi
+    # Compile libslirp (the build tree is configured only once: ninja regenerates it by itself when meson.build changes,
+    # only the prefix changes with the key)
+    echo "From compile.sh (inside chroot): Compiling libslirp..."
+    echo "::step meson"
+    if [ ! -f "$libslirp_build_dir/build.ninja" ]; then
+        rm -rf "$libslirp_build_dir"
+        CC="\${compiler_launcher:+\$compiler_launcher }gcc" meson setup "$libslirp_build_dir" $libslirp_meson_options --prefix="\$libslirp_prefix"
+    else
+        echo "From compile.sh (inside chroot): Reusing the libslirp build tree $libslirp_build_dir."
+        meson configure "$libslirp_build_dir" --prefix="\$libslirp_prefix"
+    fi
+    if [ \$? -ne 0 ]; then
+        echo "Error: From compile.sh (inside chroot): Failed to set up meson build for libslirp."
+        rm -rf "$libslirp_build_dir"
+        exit 1
+    fi
+    libslirp_jobs=\$(build_jobs)
+    echo "From compile.sh (inside chroot): Building libslirp with \$libslirp_jobs jobs."
+    echo "::step ninja"
+    ninja -j "\$libslirp_jobs" -C "$libslirp_build_dir"
+    if [ \$? -ne 0 ]; then
+        # A broken build tree must not break the next rounds as well: the next build will start from a clean one
+        echo "Error: From compile.sh (inside chroot): Failed to build libslirp. Removing its build tree."
+        rm -rf "$libslirp_build_dir"
+        exit 1
+    fi
 
-# Compile libslirp
-echo "From compile.sh (inside chroot): Compiling libslirp..."
-meson setup build --default-library=static
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to set up meson build for libslirp."
-    exit 1
-fi
-ninja -C build
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to build libslirp."
-    exit 1
-fi
-ninja -C build install
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to install libslirp."
-    exit 1
-fi
-rm -rf build
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to remove build directory for libslirp."
-    exit 1
-fi
-echo "From compile.sh (inside chroot): libslirp compiled and installed successfully."
+    # The install is published by the .complete marker, written last: a prefix without it (interrupted install) is never used
+    rm -rf "\$libslirp_prefix"
+    echo "::step ninja-install"
+    ninja -C "$libslirp_build_dir" install
+    if [ \$? -ne 0 ]; then
+        echo "Error: From compile.sh (inside chroot): Failed to install libslirp."
+        rm -rf "\$libslirp_prefix"
+        exit 1
+    fi
+    touch "\$libslirp_prefix/.complete"
 
-# Move to the sshlirp source directory inside the chroot
-cd "$sshlirp_chroot_src_dir"
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to change directory to $sshlirp_chroot_src_dir."
-    exit 1
+    # Only the current install is kept (the keys of older commits or toolchains will not come back)
+    for old_prefix in "$libslirp_install_cache_dir"/*; do
+        [ "\$old_prefix" != "\$libslirp_prefix" ] && rm -rf "\$old_prefix"
+    done
+    echo "::step end"
+    echo "From compile.sh (inside chroot): libslirp compiled and installed successfully in \$libslirp_prefix."
 fi
 
-# Compile sshlirp
-echo "From compile.sh (inside chroot): Compiling sshlirp..."
+# sshlirp finds the cached libslirp through pkg-config
+export PKG_CONFIG_PATH="\$libslirp_prefix/lib/pkgconfig\${PKG_CONFIG_PATH:+:\$PKG_CONFIG_PATH}"
 
-# Create the build directory and move into it
-mkdir -p build
-cd build
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to create and change directory to build."
-    exit 1
+# The sshlirp build tree caches the libslirp paths found at configure time and does not track the static library:
+# when the libslirp install changes the tree is recreated (the compiler cache keeps it cheap)
+if [ -d "$sshlirp_build_dir" ] && [ "\$(cat "$sshlirp_build_dir/.libslirp-key" 2>/dev/null)" != "\$libslirp_key" ]; then
+    echo "From compile.sh (inside chroot): libslirp changed since the last sshlirp build: recreating the sshlirp build tree."
+    rm -rf "$sshlirp_build_dir"
 fi
 
-# Configure the project with CMake
-cmake .. -DCMAKE_BUILD_TYPE=Release -DCMAKE_INSTALL_PREFIX="$target_chroot_dir"
+# Compile sshlirp (same as libslirp: the CMake build tree is kept in the workspace, CMake reconfigures it when needed)
+echo "From compile.sh (inside chroot): Compiling sshlirp..."
+if [ ! -f "$sshlirp_build_dir/CMakeCache.txt" ]; then
+    rm -rf "$sshlirp_build_dir"
+    mkdir -p "$sshlirp_build_dir"
+    echo "\$libslirp_key" > "$sshlirp_build_dir/.libslirp-key"
+fi
+echo "::step cmake"
+cmake -S "$sshlirp_chroot_src_dir" -B "$sshlirp_build_dir" -DCMAKE_BUILD_TYPE=Release -DCMAKE_INSTALL_PREFIX="$target_chroot_dir" \${compiler_launcher:+-DCMAKE_C_COMPILER_LAUNCHER=\$compiler_launcher}
 if [ \$? -ne 0 ]; then
     echo "Error: From compile.sh (inside chroot): Failed to configure CMake for sshlirp."
+    rm -rf "$sshlirp_build_dir"
     exit 1
 fi
 
 # Compile the project
-make
+sshlirp_jobs=\$(build_jobs)
+echo "From compile.sh (inside chroot): Building sshlirp with \$sshlirp_jobs jobs."
+echo "::step make"
+make -j "\$sshlirp_jobs" -C "$sshlirp_build_dir"
 if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to build sshlirp."
+    echo "Error: From compile.sh (inside chroot): Failed to build sshlirp. Removing its build tree."
+    rm -rf "$sshlirp_build_dir"
     exit 1
 fi
 
 # Install the project
-make install
+echo "::step make-install"
+make -C "$sshlirp_build_dir" install
 if [ \$? -ne 0 ]; then
     echo "Error: From compile.sh (inside chroot): Failed to install sshlirp."
     exit 1
 fi
 
-# Remove the build directory
-cd ..
-rm -rf build
-if [ \$? -ne 0 ]; then
-    echo "Error: From compile.sh (inside chroot): Failed to remove build directory for sshlirp."
-    exit 1
-fi
-
 # Get the system architecture to know what the binary will be called
 binary_arch=\$(uname -m)
 if [ -z "\$binary_arch" ]; then
@@ -188,6 +223,7 @@ if [ "\$binary_arch" != "$arch" ]; then
     fi
 fi
 
+echo "::step end"
 echo "From compile.sh (inside chroot): sshlirp compiled and installed successfully as sshlirp-$arch in $target_chroot_dir/bin."
 exit 0
 EOF
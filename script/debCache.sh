@@ -0,0 +1,99 @@
+#!/bin/bash
+
+# Shared host-side cache of .deb packages, used by every architecture chroot during debootstrap and apt runs.
+# Layout of <cache_dir>:
+#   pool/<sha256>.deb   one file for each distinct package content (content-addressed)
+#   by-name/<file>.deb  hardlink to the pool entry of each package file name (name_version_arch.deb)
+#   .lock               serializes the exports of concurrent threads (imports only read by-name, whose entries are replaced atomically)
+# Note: this script is called by other scripts, whose outputs (this script's too) are read by the daemon, which writes them to the main log
+
+operation=$1
+cache_dir=$2
+archives_dir=$3
+arch=$4
+
+# Check if parameters were passed
+if [ -z "$operation" ] || [ -z "$cache_dir" ] || [ -z "$archives_dir" ] || [ -z "$arch" ]; then
+    echo "From debCache.sh: Usage: $0 <import|export|clean> <cache_dir> <archives_dir> <arch>"
+    exit 1
+fi
+
+# Hardlink (or copy, if cache and archives are on different filesystems) src to dst through a temporary name, so that dst appears atomically
+link_atomically() {
+    local src=$1
+    local dst=$2
+    local tmp
+    [ "$src" -ef "$dst" ] && return 0
+    tmp="$(dirname "$dst")/.tmp.$$.$(basename "$dst")"
+    ln -f "$src" "$tmp" 2>/dev/null || cp -f "$src" "$tmp" || return 1
+    mv -f "$tmp" "$dst" || { rm -f "$tmp"; return 1; }
+}
+
+case "$operation" in
+    import)
+        # Seed the archives directory with the cached packages of the arch (and the Architecture: all ones):
+        # debootstrap and apt validate their checksums and do not download them again
+        mkdir -p "$archives_dir" || exit 1
+        imported=0
+        for deb in "$cache_dir/by-name/"*_"$arch".deb "$cache_dir/by-name/"*_all.deb; do
+            [ -f "$deb" ] || continue
+            dest="$archives_dir/$(basename "$deb")"
+            [ -e "$dest" ] && continue
+            if ln "$deb" "$dest" 2>/dev/null || cp "$deb" "$dest"; then
+                imported=$((imported + 1))
+            fi
+        done
+        echo "From debCache.sh: Imported $imported cached packages into $archives_dir."
+        ;;
+
+    export)
+        # Move the packages downloaded into the archives directory into the shared pool, replacing them with hardlinks to the pool entries
+        mkdir -p "$cache_dir/pool" "$cache_dir/by-name" || exit 1
+        exec 9>"$cache_dir/.lock"
+        flock 9 || exit 1
+
+        added=0
+        for deb in "$archives_dir"/*.deb; do
+            [ -f "$deb" ] || continue
+            name=$(basename "$deb")
+
+            # Same inode as the by-name entry: the package comes from the cache (or was already exported)
+            if [ "$deb" -ef "$cache_dir/by-name/$name" ]; then
+                continue
+            fi
+
+            sha=$(sha256sum "$deb" | cut -d' ' -f1)
+            if [ -z "$sha" ]; then
+                echo "Warning: From debCache.sh: Failed to hash $deb, not cached."
+                continue
+            fi
+            pool_entry="$cache_dir/pool/$sha.deb"
+            if [ ! -f "$pool_entry" ]; then
+                link_atomically "$deb" "$pool_entry" || continue
+                added=$((added + 1))
+            fi
+            link_atomically "$pool_entry" "$cache_dir/by-name/$name" || continue
+
+            # Deduplicate the copy in the archives directory
+            if ! [ "$deb" -ef "$pool_entry" ]; then
+                link_atomically "$pool_entry" "$deb"
+            fi
+        done
+
+        flock -u 9
+        echo "From debCache.sh: Exported $added new packages from $archives_dir into $cache_dir."
+        ;;
+
+    clean)
+        # The packages are in the shared pool: the copies (hardlinks) in the archives directory are no longer needed
+        rm -f "$archives_dir"/*.deb
+        echo "From debCache.sh: Cleaned $archives_dir."
+        ;;
+
+    *)
+        echo "Error: From debCache.sh: Unknown operation $operation (use import, export or clean)."
+        exit 1
+        ;;
+esac
+
+exit 0
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+repo_dir=$1
+commit=$2
+snapshots_dir=$3
+patch_script=$4
+
+# Check if parameters were passed (patch_script is optional)
+if [ -z "$repo_dir" ] || [ -z "$commit" ] || [ -z "$snapshots_dir" ]; then
+    echo "From exportSnapshot.sh: Usage: $0 <repo_dir> <commit> <snapshots_dir> [<patch_script>]"
+    exit 1
+fi
+
+# Command outputs and echoes (of the patch script too) are read by the daemon, which writes them to the main log file
+
+# Immutable snapshot of the tree of the commit (no history, no local edits): <snapshots_dir>/<repo name>-<commit>
+repo_name=$(basename "$repo_dir")
+snapshot_dir="$snapshots_dir/$repo_name-$commit"
+
+if [ -d "$snapshot_dir" ]; then
+    echo "From exportSnapshot.sh: Snapshot $snapshot_dir already exported."
+    exit 0
+fi
+
+if ! git -C "$repo_dir" cat-file -e "$commit^{commit}" 2>/dev/null; then
+    echo "Error: From exportSnapshot.sh: Commit $commit not found in $repo_dir."
+    exit 1
+fi
+
+mkdir -p "$snapshots_dir"
+tmp_dir="$snapshots_dir/.tmp.$$.$repo_name-$commit"
+rm -rf "$tmp_dir"
+mkdir "$tmp_dir" || exit 1
+
+# Stream the tree of the commit straight into the snapshot.
+# tar -m: git archive stamps every file with the commit date, which can be older than the objects of the persistent build trees
+# (commit made before the last build, pushed after it). Extraction time stamps keep the changed files newer than their outputs,
+# while the unchanged ones keep their old inode (and time stamp) in the synced sources tree
+echo "From exportSnapshot.sh: Exporting $repo_name at $commit into $snapshot_dir..."
+git -C "$repo_dir" archive --format=tar "$commit" | tar -x -m -C "$tmp_dir"
+pipe_status=("${PIPESTATUS[@]}")
+if [ "${pipe_status[0]}" -ne 0 ] || [ "${pipe_status[1]}" -ne 0 ]; then
+    echo "Error: From exportSnapshot.sh: Failed to export $repo_name at $commit."
+    rm -rf "$tmp_dir"
+    exit 1
+fi
+
+# The patches needed by the CI (e.g. modifyVdens.sh) are applied to the snapshot before it is published, never to the working tree
+if [ -n "$patch_script" ]; then
+    "$patch_script" "$tmp_dir"
+    if [ $? -ne 0 ]; then
+        echo "Error: From exportSnapshot.sh: Patch script $patch_script failed on $repo_name at $commit."
+        rm -rf "$tmp_dir"
+        exit 1
+    fi
+fi
+
+# The rename publishes the snapshot only when it is complete
+mv "$tmp_dir" "$snapshot_dir"
+if [ $? -ne 0 ]; then
+    echo "Error: From exportSnapshot.sh: Failed to publish snapshot $snapshot_dir."
+    rm -rf "$tmp_dir"
+    exit 1
+fi
+
+# The snapshots of the older commits are not removed here: an architecture may still be building one of them.
+# The daemon removes them when no build uses them anymore (see prune_source_snapshots)
+echo "From exportSnapshot.sh: Snapshot $snapshot_dir exported successfully."
+exit 2
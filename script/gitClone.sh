@@ -2,14 +2,13 @@
 
 what2clone=$1
 where2clone=$2
-logfile=$3
-versioning_file=$4
+versioning_file=$3
 
 sshlirp_git_clone=1
 
 # Controlla che i parametri siano stati passati
-if [ -z "$what2clone" ] || [ -z "$where2clone" ] || [ -z "$logfile" ]; then
-    echo "From gitClone.sh: Usage: $0 <repository_url> <destination_directory> <logfile>"
+if [ -z "$what2clone" ] || [ -z "$where2clone" ]; then
+    echo "From gitClone.sh: Usage: $0 <repository_url> <destination_directory> [<versioning_file>]"
     exit 1
 fi
 
@@ -18,14 +17,7 @@ if [ -z "$versioning_file" ]; then
     sshlirp_git_clone=0
 fi
 
-# Controlla che il file di log esista
-if [ ! -f $logfile ]; then
-    echo "Error: From gitClone.sh: Logfile does not exist."
-    exit 1
-fi
-
-# Reindirizza gli output dei comandi e gli echo nel file di log
-exec >> $logfile 2>&1
+# Nota: gli output dei comandi e gli echo vengono letti dal demone, che li scrive nel suo file di log
 
 # Controlla che il path di clonaggio sia valido
 if [ ! -d $where2clone ]; then
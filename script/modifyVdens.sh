@@ -1,22 +1,17 @@
 #!/bin/bash
 
-vdens_c_path=$1
-log_file=$2
+vdens_dir=$1
 
 # Controllo se i parametri sono stati passati
-if [ -z "$vdens_c_path" ] || [ -z "$log_file" ]; then
-    echo "Usage: $0 <path_to_vdens_c> <log_file>"
+if [ -z "$vdens_dir" ]; then
+    echo "Usage: $0 <vdens_source_dir>"
     exit 1
 fi
 
-# Controlla che il file di log esista
-if [ ! -f $log_file ]; then
-    echo "Error: From gitClone.sh: Logfile does not exist."
-    exit 1
-fi
+# Nota: viene applicato allo snapshot di vdens esportato da exportSnapshot.sh, prima che sia pubblicato (mai al working tree)
+vdens_c_path="$vdens_dir/vdens.c"
 
-# Reindirizza gli output dei comandi e gli echo nel file di log
-exec >> $log_file 2>&1
+# Nota: gli output dei comandi e gli echo arrivano al demone attraverso exportSnapshot.sh
 
 # Controlla che il file sorgente di vdens esista
 if [ ! -f "$vdens_c_path" ]; then
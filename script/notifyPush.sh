@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Push notification for the sshlirpCI daemon: asks the webhook listener (WEBHOOK_PORT in ci.conf) to poll the repositories now.
+# It can be installed as the post-receive hook of a local (bare) repository the daemon clones from, e.g. hooks/post-receive containing:
+#   exec /path/to/sshlirpCI/script/notifyPush.sh 8765
+# Only bash is needed (no curl): the request is sent through /dev/tcp
+
+port=${1:-$SSHLIRPCI_WEBHOOK_PORT}
+
+# Check if parameters were passed
+if [ -z "$port" ]; then
+    echo "From notifyPush.sh: Usage: $0 <webhook_port> (or set SSHLIRPCI_WEBHOOK_PORT)"
+    exit 1
+fi
+
+# A post-receive hook gets the updated refs on stdin: they are not needed (the daemon finds out what moved), but the stdin is consumed anyway
+if [ ! -t 0 ]; then
+    cat > /dev/null
+fi
+
+if ! { exec 3<>"/dev/tcp/127.0.0.1/$port"; } 2>/dev/null; then
+    echo "Warning: From notifyPush.sh: sshlirpCI daemon not reachable on port $port, the push will be built at the next poll."
+    exit 0
+fi
+
+printf 'POST /push HTTP/1.1\r\nHost: 127.0.0.1:%s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n' "$port" >&3
+status_line=$(head -n 1 <&3)
+exec 3<&-
+
+case "$status_line" in
+    *" 202 "*)
+        echo "From notifyPush.sh: sshlirpCI build triggered."
+        ;;
+    *)
+        echo "Warning: From notifyPush.sh: sshlirpCI daemon replied: ${status_line%$'\r'}"
+        ;;
+esac
+exit 0
@@ -0,0 +1,104 @@
+#!/bin/bash
+
+chroot_path=$1
+arch=$2
+with_tests=$3
+deb_cache_dir=$4
+
+# Check if parameters were passed
+if [ -z "$chroot_path" ] || [ -z "$arch" ] || [ -z "$with_tests" ] || [ -z "$deb_cache_dir" ]; then
+    echo "From provision.sh: Usage: $0 <chroot_path> <arch> <with_tests 0|1> <deb_cache_dir>"
+    exit 1
+fi
+
+# Command outputs and echoes are read by the daemon, which writes them to the main log (tagged with the architecture and the stage)
+echo "From provision.sh: Checking provisioning of chroot $chroot_path for $arch..."
+
+enter_bin="$chroot_path/_enter"
+if [ ! -x "$enter_bin" ]; then
+    echo "Error: From provision.sh: _enter script not found or not executable in $chroot_path (expected $enter_bin)."
+    exit 1
+fi
+
+# Toolchain and build dependencies of libslirp/sshlirp (compile.sh) and, if testing is enabled, of vdens (test.sh)
+build_deps="build-essential git devscripts debhelper dh-exec libglib2.0-dev pkg-config adduser gcc g++ libcap-ng-dev libseccomp-dev cmake git-buildpackage meson ninja-build ccache libvdeplug-dev libvdeslirp-dev"
+test_deps="libcap-dev libexecs-dev"
+deps="$build_deps"
+if [ "$with_tests" = "1" ]; then
+    deps="$deps $test_deps"
+fi
+
+# Suite of the chroot (read from the host, without entering the chroot)
+suite=$(. "$chroot_path/etc/os-release" 2>/dev/null && echo "$VERSION_CODENAME")
+if [ -z "$suite" ]; then
+    suite=$(cat "$chroot_path/etc/debian_version" 2>/dev/null)
+fi
+
+# The provisioning is repeated only when the dependency list or the suite change
+manifest_rel="/var/lib/sshlirpci/provision.manifest"
+provision_key=$(printf 'provision-v1\nsuite=%s\narch=%s\ndeps=%s\n' "$suite" "$arch" "$deps" | sha256sum | cut -c1-16)
+if [ -f "$chroot_path$manifest_rel" ] && [ "$(head -n 1 "$chroot_path$manifest_rel")" = "key=$provision_key" ]; then
+    echo "From provision.sh: Chroot already provisioned for $arch (suite $suite, key $provision_key). Skipping apt."
+    exit 0
+fi
+
+echo "From provision.sh: Provisioning chroot for $arch (suite $suite, key $provision_key)..."
+
+# Seed the apt archives of the chroot with the shared package cache: apt only downloads what is missing
+deb_cache_script="$(cd "$(dirname "$0")" && pwd)/debCache.sh"
+archives_dir="$chroot_path/var/cache/apt/archives"
+"$deb_cache_script" import "$deb_cache_dir" "$archives_dir" "$arch"
+
+# Start the rootless environment via _enter (fakeroot+unshare) and pass the script via here-doc
+"$enter_bin" /bin/bash <<EOF
+
+echo "From provision.sh (inside chroot): Installing toolchain and build dependencies..."
+echo "::step apt-update"
+apt-get update
+if [ \$? -ne 0 ]; then
+    echo "Error: From provision.sh (inside chroot): Failed to update package list."
+    exit 1
+fi
+echo "::step apt-install"
+apt-get install -y $deps
+if [ \$? -ne 0 ]; then
+    echo "Error: From provision.sh (inside chroot): Failed to install dependencies (probably due to bookworm). Retrying..."
+    apt-get update
+    apt-get install -y $deps
+    if [ \$? -ne 0 ]; then
+        echo "Error: From provision.sh (inside chroot): Failed to install dependencies after retry."
+        exit 1
+    fi
+fi
+
+echo "::step end"
+# Record what is installed: the first line is the key checked by the next rounds
+mkdir -p "\$(dirname "$manifest_rel")"
+{
+    echo "key=$provision_key"
+    echo "suite=$suite"
+    echo "deps=$deps"
+    dpkg-query -W -f='\${Package} \${Version} \${Architecture}\n'
+} > "$manifest_rel.tmp"
+if [ \$? -ne 0 ]; then
+    echo "Error: From provision.sh (inside chroot): Failed to write the provisioning manifest."
+    exit 1
+fi
+mv -f "$manifest_rel.tmp" "$manifest_rel"
+
+exit 0
+EOF
+
+if [ $? -ne 0 ]; then
+    echo "Error: From provision.sh: Script inside chroot failed."
+    "$deb_cache_script" export "$deb_cache_dir" "$archives_dir" "$arch"
+    "$deb_cache_script" clean "$deb_cache_dir" "$archives_dir" "$arch"
+    exit 1
+fi
+
+# Share the newly downloaded packages with the other architectures, then drop the copies from the chroot
+"$deb_cache_script" export "$deb_cache_dir" "$archives_dir" "$arch"
+"$deb_cache_script" clean "$deb_cache_dir" "$archives_dir" "$arch"
+
+echo "From provision.sh: Chroot provisioned successfully for $arch."
+exit 0
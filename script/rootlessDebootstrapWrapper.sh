@@ -11,6 +11,11 @@ ARGSTR=""
 ARCH=""
 SUDO_USER_FLAG="0"
 SUDO_CMD=""
+STAGE="all"
+DEB_CACHE=""
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+# Marker left in the target by the first stage and removed by the second one
+STAGE1_MARKER="_stage1.done"
 
 error() {
   printf "!!!!!!!!!! Error: %s !!!!!!!!!!\n" "$*" >&2
@@ -31,7 +36,7 @@ error_if_whitespace() {
 }
 
 usage() {
-  echo "Usage: rootless-debootstrap-wrapper --target-dir TGT --suite SUITE [--mirror MIRROR] [--include INCLUDE] [--arch ARCH] [--sudo-user 0|1] [...passthrough_opts]"
+  echo "Usage: rootless-debootstrap-wrapper --target-dir TGT --suite SUITE [--mirror MIRROR] [--include INCLUDE] [--arch ARCH] [--sudo-user 0|1] [--stage first|second|all] [--deb-cache DIR] [...passthrough_opts]"
 }
 
 if [ $# -eq 0 ]; then
@@ -117,6 +122,31 @@ while [ $# -gt 0 ]; do
         *) usage_error "Invalid value for --sudo-user (use 0 or 1)";;
       esac
       ;;
+    --stage|--stage=*)
+      if [ "$1" = "--stage" ] && [ "$2" ]; then
+        STAGE="$2"
+        shift
+      elif [ "${1#--stage=}" != "$1" ]; then
+        STAGE="${1#--stage=}"
+      else
+        usage_error "Option --stage requires an argument (first|second|all)"
+      fi
+      case "$STAGE" in
+        first|second|all) ;;
+        *) usage_error "Invalid value for --stage (use first, second or all)";;
+      esac
+      ;;
+    --deb-cache|--deb-cache=*)
+      if [ "$1" = "--deb-cache" ] && [ "$2" ]; then
+        error_if_whitespace "$2"
+        DEB_CACHE="$2"
+        shift
+      elif [ "${1#--deb-cache=}" != "$1" ]; then
+        DEB_CACHE="${1#--deb-cache=}"
+      else
+        usage_error "Option --deb-cache requires an argument"
+      fi
+      ;;
     *)
       ARGSTR="$ARGSTR $1"
       ;;
@@ -124,23 +154,55 @@ while [ $# -gt 0 ]; do
   shift
 done
 
-[ -n "$SUITE" ] || usage_error "Must set --suite"
 [ -n "$TARGET_DIR" ] || usage_error "Must set --target-dir"
+
+if [ "$SUDO_USER_FLAG" = "1" ]; then
+  SUDO_CMD="sudo"
+else
+  SUDO_CMD=""
+fi
+
+# Second stage (qemu-emulated when the arch is foreign, CPU bound): it only needs the target prepared by the first stage
+second_stage() {
+  [ -f "$TARGET_DIR/$STAGE1_MARKER" ] || error "First stage marker missing in $TARGET_DIR, run --stage first before --stage second"
+  echo "@@@@@@@@@@ Starting second stage debootstrap @@@@@@@@@@"
+  $SUDO_CMD "$TARGET_DIR/_enter" debootstrap/debootstrap --second-stage --keep-debootstrap-dir || error "Stage 2 debootstrap failed"
+  $SUDO_CMD mv "$TARGET_DIR/debootstrap/debootstrap.log" "$TARGET_DIR/_debootstrap.log"
+  $SUDO_CMD rm -rf "$TARGET_DIR/debootstrap"
+  $SUDO_CMD rm -f "$TARGET_DIR/$STAGE1_MARKER"
+  # The packages were exported to the shared cache at the end of the first stage
+  if [ -n "$DEB_CACHE" ]; then
+    $SUDO_CMD "$SCRIPT_DIR/debCache.sh" clean "$DEB_CACHE" "$TARGET_DIR/var/cache/apt/archives" "${ARCH:-any}"
+  fi
+  echo "@@@@@@@@@@ Debootstrap complete! @@@@@@@@@@"
+}
+
+if [ "$STAGE" = "second" ]; then
+  [ -d "$TARGET_DIR" ] || error "Directory in --target-dir does not exist, run --stage first before --stage second"
+  second_stage
+  exit 0
+fi
+
+[ -n "$SUITE" ] || usage_error "Must set --suite"
 [ ! -e "$TARGET_DIR" ] || error "Directory in --target-dir already exists, refusing to run"
 [ -z "$INCLUDE" ] && ARGSTR="$ARGSTR --include=fakeroot"
 
 [ -n "$ARCH" ] && ARCH_OPT="--arch=$ARCH"
 
 if [ "$SUDO_USER_FLAG" = "1" ]; then
-  SUDO_CMD="sudo"
   echo "@@@@@@@@@@ sudo-user=1: user requested sudo elevation for debootstrap stages @@@@@@@@@@"
-else
-  SUDO_CMD=""
 fi
 
 ARGSTR="--foreign $ARCH_OPT $ARGSTR $SUITE $TARGET_DIR"
 [ -n "$MIRROR" ] && ARGSTR="$ARGSTR $MIRROR"
 
+# Seed the target with the packages of the shared cache: debootstrap validates their checksums and does not download them again
+if [ -n "$DEB_CACHE" ]; then
+  echo "@@@@@@@@@@ Importing packages from the shared cache $DEB_CACHE @@@@@@@@@@"
+  mkdir -p "$TARGET_DIR/var/cache/apt/archives" || error "Failed to create the archives directory in the target"
+  "$SCRIPT_DIR/debCache.sh" import "$DEB_CACHE" "$TARGET_DIR/var/cache/apt/archives" "${ARCH:-$(dpkg --print-architecture)}" || error "Failed to import packages from the shared cache"
+fi
+
 echo "@@@@@@@@@@ Starting first stage debootstrap (arch: ${ARCH:-host default}) @@@@@@@@@@"
 TMP_FAKEROOT_ENV=$(mktemp)
 fakeroot -s "$TMP_FAKEROOT_ENV" debootstrap $ARGSTR || error "Stage 1 debootstrap failed"
@@ -222,8 +284,15 @@ EOF
 
 $SUDO_CMD chmod +x "$TARGET_DIR/_enter"
 
-echo "@@@@@@@@@@ Starting second stage debootstrap @@@@@@@@@@"
-$SUDO_CMD "$TARGET_DIR/_enter" debootstrap/debootstrap --second-stage --keep-debootstrap-dir || error "Stage 2 debootstrap failed"
-$SUDO_CMD mv "$TARGET_DIR/debootstrap/debootstrap.log" "$TARGET_DIR/_debootstrap.log"
-$SUDO_CMD rm -rf "$TARGET_DIR/debootstrap"
-echo "@@@@@@@@@@ Debootstrap complete! @@@@@@@@@@"
\ No newline at end of file
+# Share the newly downloaded packages with the other architectures
+if [ -n "$DEB_CACHE" ]; then
+  "$SCRIPT_DIR/debCache.sh" export "$DEB_CACHE" "$TARGET_DIR/var/cache/apt/archives" "${ARCH:-$(dpkg --print-architecture)}" || echo "@@@@@@@@@@ Warning: failed to export packages to the shared cache @@@@@@@@@@"
+fi
+
+# The first stage (download and unpack, network and I/O bound) is over
+touch "$TARGET_DIR/$STAGE1_MARKER"
+echo "@@@@@@@@@@ First stage debootstrap complete @@@@@@@@@@"
+
+if [ "$STAGE" = "all" ]; then
+  second_stage
+fi
\ No newline at end of file
@@ -3,25 +3,16 @@
 sshlirp_bin_path=$1     # nota: sshlirp_bin_path è un percorso relativo al chroot
 chroot_path=$2
 thread_chroot_vdens_dir=$3
-host_log_file=$4
-chroot_log_file=$5
 
 absolute_chroot_vdens_dir="${chroot_path}/${thread_chroot_vdens_dir}"
 
 # Controllo se i parametri sono stati passati
-if [ -z "$sshlirp_bin_path" ] || [ -z "$chroot_path" ] || [ -z "$thread_chroot_vdens_dir" ] || [ -z "$host_log_file" ] || [ -z "$chroot_log_file" ]; then
-    echo "Usage: $0 <sshlirp_bin_path> <chroot_path> <thread_chroot_vdens_dir> <host_log_file> <chroot_log_file>"
+if [ -z "$sshlirp_bin_path" ] || [ -z "$chroot_path" ] || [ -z "$thread_chroot_vdens_dir" ]; then
+    echo "Usage: $0 <sshlirp_bin_path> <chroot_path> <thread_chroot_vdens_dir>"
     exit 1
 fi
 
-# Controllo che il file di log sull'host esista
-if [ ! -f $host_log_file ]; then
-    echo "Error: From test.sh: Host logfile does not exist."
-    exit 1
-fi
-
-# Reindirizzo gli output dei comandi e gli echo nel file di log
-exec >> $host_log_file 2>&1
+# Nota: stdout e stderr sono letti dal daemon, che li scrive nel log principale man mano che vengono prodotti (anche quelli dei test nel chroot)
 
 # Controlla che il path di chroot esista
 if [ ! -d "$chroot_path" ]; then
@@ -90,14 +81,6 @@ echo "nameserver 9.9.9.9" | tee "${chroot_path}/etc/resolv.conf" > /dev/null
 # Entro nel chroot
 echo "Starting test script inside chroot..."
 
-# Rendendizzo gli output dei comandi e gli echo nel file di log del chroot
-absolute_chroot_log_file_path="${chroot_path}${chroot_log_file}"
-if [ ! -f "$absolute_chroot_log_file_path" ]; then
-    echo "Warning: From test.sh: Chroot logfile does not exist at ${absolute_chroot_log_file_path}; test inside chroot logs will be saved in the host log file."
-else
-    exec >> "$absolute_chroot_log_file_path" 2>&1
-fi
-
 enter_bin="$chroot_path/_enter"
 if [ ! -x "$enter_bin" ]; then
     echo "Error: From compile.sh: _enter script not found or not executable in $chroot_path (expected $enter_bin)."
@@ -115,13 +98,7 @@ fi
         exit 1
     fi
 
-    echo "From test.sh (inside chroot): Installing dependencies..."
-    apt-get update
-    apt-get install -y libcap-dev libexecs-dev
-    if [ \$? -ne 0 ]; then
-        echo "Error: From test.sh (inside chroot): Failed to install dependencies."
-        exit 1
-    fi
+    # Nota: le dipendenze di vdens (libcap-dev libexecs-dev) sono installate una volta sola da provision.sh
 
     # Controlla l'esistenza della repo vdens all'interno del chroot
     if [ ! -d "$thread_chroot_vdens_dir" ]; then
@@ -190,8 +167,5 @@ if [ $? -ne 0 ]; then
     exit 1
 fi
 
-# Ripristino del log file dell'host
-exec >> $host_log_file 2>&1
-
 echo "...From test.sh (inside chroot): test script executed successfully."
 exit 0
\ No newline at end of file
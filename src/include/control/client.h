@@ -0,0 +1,8 @@
+#ifndef CONTROL_CLIENT_H
+#define CONTROL_CLIENT_H
+
+#include <stddef.h>
+
+int control_send_request(const char *request, int timeout_ms, char *reply, size_t reply_len);
+
+#endif // CONTROL_CLIENT_H
@@ -0,0 +1,15 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int control_init(control_t *control, int webhook_port, event_loop_t *loop, FILE *log_fp);
+
+int control_accept(control_t *control, const loop_event_t *event, control_request_t *request, FILE *log_fp);
+
+void control_reply(control_request_t *request, int ok, const char *message);
+
+void control_destroy(control_t *control);
+
+#endif // CONTROL_H
@@ -3,6 +3,8 @@
 
 #define PID_FILE "/tmp/sshlirp_ci.pid"
 #define STATE_FILE "/tmp/sshlirp_ci.state"
+#define CONTROL_SOCKET_PATH "/tmp/sshlirp_ci.sock"
+#define CONTROL_CLIENT_TIMEOUT_MS 5000                // Time the tools wait for a reply of the daemon (its loop never blocks on a poll or a build)
 
 #define DAEMON_STATE_WORKING "WORKING"
 #define DAEMON_STATE_SLEEPING "SLEEPING"
@@ -0,0 +1,19 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int fingerprint_tree(const char *root_dir, char hex[SHA256_HEX_LEN], FILE *log_fp);
+
+int fingerprint_file(const char *path, char hex[SHA256_HEX_LEN], FILE *log_fp);
+
+int compute_build_fingerprint(const thread_args_t *args, const char *tree_fingerprint, char hex[SHA256_HEX_LEN], FILE *log_fp);
+
+int read_build_record(const char *fingerprints_dir, const char *arch, char fingerprint[SHA256_HEX_LEN], char *artifact, size_t artifact_len, FILE *log_fp);
+
+int save_build_record(const char *fingerprints_dir, const char *arch, const char *fingerprint, const char *artifact, FILE *log_fp);
+
+int reuse_build_artifact(const char *artifact, const char *target_path, FILE *log_fp);
+
+#endif // FINGERPRINT_H
@@ -0,0 +1,16 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types/types.h"
+
+void sha256_init(sha256_ctx_t *ctx);
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_LEN], char hex[SHA256_HEX_LEN]);
+
+#endif // SHA256_H
@@ -1,30 +1,32 @@
 #ifndef INIT_H
 #define INIT_H
 
+#include <stdio.h>
 #include "types/types.h"
 
 // Dichiarazioni delle funzioni da init.c
 int conf_vars_loader(
-    char** archs_list, 
-    int* num_archs, 
+    char*** archs_list,
+    int* num_archs,
     char* sshlirp_repo_url, 
     char* libslirp_repo_url, 
     char* vdens_repo_url,
     char* main_dir,
     char* target_dir,
     char* log_file,
-    int* poll_interval);
+    char* debian_mirror,
+    int* poll_interval,
+    int* max_parallel_builds,
+    int* webhook_port);
 
 commit_status_t check_host_dirs(
     char* target_dir, 
     char* sshlirp_source_dir, 
     char* libslirp_source_dir, 
     char* vdens_source_dir,
-    char* log_file, 
     char* sshlirp_repo_url, 
     char* libslirp_repo_url, 
     char* vdens_repo_url,
-    char* thread_log_dir, 
     FILE* log_fp, 
     char* versioning_file
 );
@@ -34,9 +36,32 @@ commit_status_t check_new_commit(
     char* sshlirp_repo_url, 
     char* libslirp_source_dir, 
     char* libslirp_repo_url, 
-    char* log_file,
+    char* vdens_source_dir,
+    FILE* log_fp,
+    char* versioning_file
+);
+
+commit_status_t read_checked_out_commits(
+    char* sshlirp_source_dir,
+    char* libslirp_source_dir,
+    char* vdens_source_dir,
     FILE* log_fp,
     char* versioning_file
 );
 
+int export_source_snapshots(
+    const commit_status_t* commits,
+    char* sshlirp_source_dir,
+    char* libslirp_source_dir,
+    char* vdens_source_dir,
+    char* snapshots_dir,
+    FILE* log_fp,
+    char* sshlirp_snapshot_dir,
+    char* libslirp_snapshot_dir,
+    char* vdens_snapshot_dir,
+    size_t snapshot_dir_len
+);
+
+int prune_source_snapshots(const char* snapshots_dir, const char* const* keep_dirs, int num_keep_dirs, FILE* log_fp);
+
 #endif // INIT_H
\ No newline at end of file
@@ -3,10 +3,13 @@
 
 #include "types/types.h"
 
-int setup_chroot(thread_args_t* args, FILE* thread_log_fp);
-int check_worker_dirs(thread_args_t* args, FILE* thread_log_fp);
-int copy_sources_to_chroot(thread_args_t* args, FILE* thread_log_fp);
-int compile_and_verify_in_chroot(thread_args_t* args, FILE* thread_log_fp);
-int remove_sources_copy_from_chroot(thread_args_t* args, FILE* thread_log_fp);
+int setup_chroot_first_stage(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int setup_chroot_second_stage(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int check_worker_dirs(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int provision_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int copy_sources_to_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int compile_and_verify_in_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int create_build_layer(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp);
+int discard_build_layer(thread_args_t* args, FILE* log_fp);
 
 #endif // WORKER_INIT_H
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef LOGMUX_H
+#define LOGMUX_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int log_mux_init(log_mux_t *mux, const char *log_file, FILE *log_fp);
+
+FILE *log_mux_open(log_mux_t *mux, const char *arch, const char *stage, stage_result_t *accounting);
+
+void log_mux_flush(log_mux_t *mux);
+
+void log_mux_destroy(log_mux_t *mux);
+
+#endif // LOGMUX_H
@@ -0,0 +1,15 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int event_loop_init(event_loop_t *loop, int poll_interval, FILE *log_fp);
+
+int event_loop_add(event_loop_t *loop, int fd, event_source_t source, FILE *log_fp);
+
+int event_loop_wait(event_loop_t *loop, loop_event_t *events, int max_events, int timeout_ms, FILE *log_fp);
+
+void event_loop_destroy(event_loop_t *loop);
+
+#endif // LOOP_H
@@ -0,0 +1,28 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <time.h>
+#include "types/types.h"
+
+int metrics_init(metrics_t *metrics, const char *path, char **arch_names, int num_archs, FILE *log_fp);
+
+double metrics_seconds_since(const struct timespec *start);
+
+void metrics_record_poll(metrics_t *metrics, double seconds, int poll_status);
+
+void metrics_record_queued(metrics_t *metrics, int arch, int fingerprinted);
+
+void metrics_record_reuse(metrics_t *metrics, int arch, double commit_to_artifact_seconds);
+
+void metrics_record_build(metrics_t *metrics, int arch, const thread_result_t *result, double build_seconds);
+
+void metrics_record_artifact(metrics_t *metrics, int arch, double commit_to_artifact_seconds);
+
+void metrics_set_pool_depth(metrics_t *metrics, int builds_queued, int builds_active);
+
+int metrics_write(metrics_t *metrics, FILE *log_fp);
+
+void metrics_destroy(metrics_t *metrics);
+
+#endif // METRICS_H
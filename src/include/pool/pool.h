@@ -0,0 +1,21 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int worker_pool_init(worker_pool_t *pool, int num_workers, FILE *log_fp);
+
+void worker_pool_submit(worker_pool_t *pool, build_job_t *job);
+
+build_job_t *worker_pool_next_completion(worker_pool_t *pool);
+
+void worker_pool_depth(worker_pool_t *pool, int *queued, int *active);
+
+int worker_pool_cancel(worker_pool_t *pool, build_job_t *job);
+
+int worker_pool_job_stages(worker_pool_t *pool, const build_job_t *job, stage_state_t states[BUILD_MAX_STAGES], const char *tags[BUILD_MAX_STAGES]);
+
+void worker_pool_destroy(worker_pool_t *pool);
+
+#endif // POOL_H
@@ -0,0 +1,9 @@
+#ifndef RELEASE_H
+#define RELEASE_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int update_release_manifest(const char *release_dir, const char *arch, const char *binary_path, const commit_status_t *commits, FILE *log_fp);
+
+#endif // RELEASE_H
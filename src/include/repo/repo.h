@@ -0,0 +1,11 @@
+#ifndef REPO_H
+#define REPO_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int repo_poll_run(loop_task_t *task, FILE *log_fp);
+
+int snapshot_prune_run(loop_task_t *task, FILE *log_fp);
+
+#endif // REPO_H
@@ -0,0 +1,31 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <time.h>
+#include "types/types.h"
+
+int scheduler_init(resource_scheduler_t *sched, FILE *log_fp);
+
+int scheduler_try_acquire(resource_scheduler_t *sched, const resource_request_t *request, resource_request_t *granted);
+
+void scheduler_log_admission(
+    resource_scheduler_t *sched,
+    const resource_request_t *granted,
+    const char *arch,
+    const char *stage,
+    time_t wait_start,
+    FILE *log_fp
+);
+
+void scheduler_release(resource_scheduler_t *sched, const resource_request_t *granted, FILE *log_fp);
+
+void scheduler_publish_jobs(resource_scheduler_t *sched, FILE *log_fp);
+
+int scheduler_compile_begin(resource_scheduler_t *sched, compile_slot_t *slot, int admitted_cpu, FILE *log_fp);
+
+void scheduler_compile_end(resource_scheduler_t *sched, compile_slot_t *slot, FILE *log_fp);
+
+void scheduler_destroy(resource_scheduler_t *sched);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,23 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int spawn_process(const char *const argv[], spawned_process_t *child, FILE *log_fp);
+
+int spawn_wait(spawned_process_t *child, FILE *output_fp, spawn_status_t *status, FILE *log_fp);
+
+int spawn_run(const char *const argv[], FILE *output_fp, spawn_status_t *status, spawn_cancel_t *cancel, FILE *log_fp);
+
+void spawn_cancel_init(spawn_cancel_t *cancel);
+
+int spawn_cancel(spawn_cancel_t *cancel);
+
+int spawn_cancelled(spawn_cancel_t *cancel);
+
+void spawn_cancel_reset(spawn_cancel_t *cancel);
+
+void spawn_cancel_destroy(spawn_cancel_t *cancel);
+
+#endif // SPAWN_H
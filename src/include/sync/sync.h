@@ -0,0 +1,11 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int sync_tree(const char *src_dir, const char *dst_dir, sync_stats_t *stats, FILE *log_fp);
+
+int remove_tree(const char *path, FILE *log_fp);
+
+#endif // SYNC_H
@@ -0,0 +1,15 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdio.h>
+#include "types/types.h"
+
+int task_runner_init(task_runner_t *runner, int num_threads, log_mux_t *log_mux, FILE *log_fp);
+
+void task_runner_submit(task_runner_t *runner, loop_task_t *task);
+
+loop_task_t *task_runner_next_completion(task_runner_t *runner);
+
+void task_runner_destroy(task_runner_t *runner);
+
+#endif // TASK_H
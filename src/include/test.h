@@ -1,4 +1,4 @@
 #include <stdio.h>
 #include "types/types.h"
 
-int test_sshlirp_bin(thread_args_t *args, char *sshlirp_bin_path, FILE *host_log_fp);
+int test_sshlirp_bin(thread_args_t *args, char *sshlirp_bin_path, stage_result_t *accounting, FILE *host_log_fp);
@@ -0,0 +1,14 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "types/types.h"
+
+int trace_open_round(build_generation_t *generation, const char *traces_dir, char **arch_names, int num_archs, FILE *log_fp);
+
+void trace_record_reuse(const build_generation_t *generation, int arch, FILE *log_fp);
+
+void trace_record_build(const build_generation_t *generation, int arch, const struct timespec *queued_at, const thread_result_t *result, FILE *log_fp);
+
+#endif // TRACE_H
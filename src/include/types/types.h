@@ -5,17 +5,28 @@
 #define TEST_ENABLED 1                                  // Set to 1 to enable testing, 0 to disable
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #define DEFAULT_CONFIG_PATH SSHLIRPCI_SOURCE_DIR "/ci.conf"
 #define ROOTLESS_DEBOOTSTRAP_PATH SSHLIRPCI_SOURCE_DIR "/script/rootlessDebootstrapWrapper.sh"
 #define CHECK_COMMIT_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/checkCommit.sh"
 #define CHROOT_SETUP_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/chrootSetup.sh"
 #define COMPILE_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/compile.sh"
-#define COPY_SOURCE_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/copySource.sh"
 #define GIT_CLONE_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/gitClone.sh"
 #define MODIFY_VDENS_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/modifyVdens.sh"
-#define REMOVE_SOURCE_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/removeSourceCopy.sh"
 #define TEST_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/test.sh"
+#define PROVISION_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/provision.sh"
+#define BUILD_LAYER_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/buildLayer.sh"
+#define EXPORT_SNAPSHOT_SCRIPT_PATH SSHLIRPCI_SOURCE_DIR "/script/exportSnapshot.sh"
+
+#define PROVISION_MANIFEST_PATH "/var/lib/sshlirpci/provision.manifest"   // Inside the chroot, written by provision.sh
+#define RELEASE_MANIFEST_NAME "MANIFEST"                // In each release directory, one line per published binary (see release/release.h)
 
 #define CONFIG_SSHLIRP_KEY "SSHLIRP_REPO_URL="
 #define CONFIG_LIBSLIRP_KEY "LIBSLIRP_REPO_URL="
@@ -32,42 +43,483 @@
 #define CONFIG_THREAD_CHROOT_LOG_FILE_KEY "THREAD_CHROOT_LOG_FILE="
 #define CONFIG_INTERVAL_KEY "POLL_INTERVAL="
 #define CONFIG_ARCH_KEY "ARCHITECTURES="
+#define CONFIG_DEBIAN_MIRROR_KEY "DEBIAN_MIRROR="
+#define CONFIG_MAX_PARALLEL_BUILDS_KEY "MAX_PARALLEL_BUILDS="
+#define CONFIG_WEBHOOK_PORT_KEY "WEBHOOK_PORT="
+
+#define DEFAULT_DEBIAN_MIRROR "http://deb.debian.org/debian"
 
-#define MAX_ARCHITECTURES 9
+#define DEFAULT_MAX_PARALLEL_BUILDS 4                   // Builds run at the same time by the worker pool when MAX_PARALLEL_BUILDS is not configured
 #define MIN_CONFIG_ATTR_LEN 128
 #define CONFIG_ATTR_LEN 256
 #define MAX_CONFIG_ATTR_LEN 512
 #define MAX_CONFIG_LINE_LEN 1024
-#define MAX_COMMAND_LEN 2048
 #define MAX_VERSIONING_LINE_LEN 128
+#define GIT_COMMIT_ID_LEN 65                            // Hex commit id (up to the 64 digits of SHA-256 repositories) plus terminator
+
+// Admission control (see sched/scheduler.h): budget shared by the stages of all the build threads
+#define SCHED_IO_TOKENS 4                               // Number of disk-I/O heavy stages (debootstrap, sources copy...) admitted at the same time
+#define SCHED_NET_TOKENS 2                              // Number of tests (vdens networks on /dev/net/tun) admitted at the same time
+#define SCHED_MEM_RESERVE_MB 512                        // Memory (MiB) always left free for the host and the daemon itself
+#define SCHED_RECHECK_SECONDS 5                         // How often the waiting stages re-read the free memory of the host
+#define BUILD_JOBS_FILE "build-jobs"                    // In the workspace of the architecture: make/ninja jobs of the running compilation
+
+// Resources requested by a stage to the admission scheduler
+typedef struct {
+    int cpu;                                            // CPU tokens (cores the stage is expected to keep busy)
+    long mem_mb;                                        // Memory tokens (MiB the stage is expected to use at its peak)
+    int io;                                             // Disk-I/O tokens
+    int net;                                            // Network tokens (tests)
+} resource_request_t;
+
+// Compilation in flight: it holds one CPU token for each of its make/ninja jobs, its admission tokens plus the free ones it was given
+// (see sched/scheduler.h)
+typedef struct compile_slot {
+    char jobs_file[MAX_CONFIG_ATTR_LEN + 16];           // Host path of the file read by compile.sh before each make/ninja run
+    int admitted_cpu;                                   // CPU tokens of the admission of the compilation stage (released by the pool)
+    int jobs;                                           // Jobs of the compilation, i.e. CPU tokens it holds
+    int written_jobs;                                   // Jobs last written to jobs_file
+    struct compile_slot *next;
+} compile_slot_t;
+
+// Resource-aware admission scheduler: hands out CPU, memory and disk-I/O tokens to the stages of the build threads
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    int cpu_total;
+    long mem_total_mb;
+    int io_total;
+    int net_total;
+    int cpu_used;
+    long mem_used_mb;
+    int io_used;
+    int net_used;
+    int running;                                        // Stages currently admitted
+    compile_slot_t *compiles;                           // Compilations in flight, sharing the CPU tokens not held by the other stages
+    int compiles_in_flight;
+} resource_scheduler_t;
+
+// Build fingerprints (see fingerprint/fingerprint.h)
+#define SHA256_DIGEST_LEN 32
+#define SHA256_HEX_LEN 65                               // Hex digest plus terminator
+#define FINGERPRINT_MAX_THREADS 8                       // Upper bound of the threads hashing a source tree (the online CPUs are used up to this)
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t total_len;
+    uint8_t buffer[64];
+    size_t buffer_len;
+} sha256_ctx_t;
+
+// Counters of a source tree synchronization (see sync/sync.h)
+typedef struct {
+    long files_unchanged;                               // Files already up to date in the destination (same inode or same content)
+    long files_linked;                                  // Files hardlinked to the source (no data written)
+    long files_cloned;                                  // Files reflinked to the source (no data written, copy-on-write extents)
+    long files_copied;                                  // Files copied with copy_file_range (or read/write as a last resort)
+    long long bytes_copied;
+    long entries_removed;                               // Files, links and directories of the destination no longer in the source
+} sync_stats_t;
+
+// Child processes of the scripts (see spawn/spawn.h)
+#define SPAWN_LINE_LEN 4096                             // Output of a child is written to the log a line at a time (longer lines are split)
+
+typedef struct {
+    pid_t pid;
+    int pidfd;                                          // -1 if pidfd_open is not available (Linux < 5.3): the child is reaped with waitpid
+    int stdout_fd;                                      // Read ends of the pipes of the child
+    int stderr_fd;
+    struct spawn_cancel *cancel;                        // Cancellation the child is registered with (NULL: none, see spawn_run)
+    int cancel_slot;                                    // Its process group in cancel->process_groups (-1: none), cleared when the child is reaped
+} spawned_process_t;
+
+// How a child process ended
+typedef struct {
+    int exited;                                         // 1: exit_code is valid, 0: the child was killed by term_signal
+    int exit_code;
+    int term_signal;
+    int core_dumped;
+    struct rusage usage;                                // Resources used by the child and by the descendants it waited for
+} spawn_status_t;
+
+#define BUILD_STAGE_WIDTH 2                             // Stages of one build that can run at the same time (the sources copy runs alongside the chroot stages)
+#define SPAWN_KILL_GRACE_MS 2000                        // After a cancellation, time the scripts have to exit on SIGTERM before their process group is killed
+
+// Cancellation of the scripts of a build (see spawn_cancel): every child runs in its own process group, and the scripts of the build
+// are registered here while they run, so that a cancellation reaches them and every process they started
+typedef struct spawn_cancel {
+    pthread_mutex_t lock;
+    int cancelled;                                      // No more scripts are started, the running ones are terminated
+    pid_t process_groups[BUILD_STAGE_WIDTH];            // Process groups of the scripts running (0: free slot)
+} spawn_cancel_t;
+
+// Log multiplexer of the builds (see logmux/logmux.h)
+#define LOG_MUX_BUFFER_LEN (256 * 1024)                 // Records waiting to be appended to the main log
+#define LOG_MUX_FLUSH_LEN (64 * 1024)                   // The flusher wakes up as soon as this many bytes are waiting...
+#define LOG_MUX_FLUSH_MS 200                            // ...or when the oldest waiting record is this old
+#define LOG_MUX_TAG_LEN 64
+
+// Records of the builds (worker messages and output of the scripts), tagged with architecture and stage and appended to the main log in batches
+typedef struct {
+    int fd;                                             // Main log, opened with O_APPEND (the main writes to it through its own FILE*)
+    pthread_mutex_t lock;
+    pthread_cond_t records_waiting;                     // The batch reached LOG_MUX_FLUSH_LEN, or the multiplexer is being destroyed
+    pthread_cond_t batch_written;                       // The flusher has taken the batch: there is room again
+    char *batch;                                        // Records being filled
+    char *spare;                                        // Batch being written by the flusher
+    size_t used;
+    struct timespec oldest_record;                      // When the first record of the batch was added (CLOCK_REALTIME)
+    unsigned long batches_written;                      // Incremented by the flusher after each write (see log_mux_flush)
+    int writing;                                        // The flusher is writing the spare batch
+    int flush_requested;                                // Write the batch now, whatever its size
+    int stopping;
+    pthread_t flusher;
+} log_mux_t;
 
 typedef struct {
     int pull_round;
     int sudo_user;
     char arch[16];
-    char sshlirp_host_source_dir[MAX_CONFIG_ATTR_LEN];
-    char libslirp_host_source_dir[MAX_CONFIG_ATTR_LEN];
-    char vdens_host_source_dir[MAX_CONFIG_ATTR_LEN];
+    char sshlirp_snapshot_dir[MAX_CONFIG_ATTR_LEN];      // Immutable exports of the commits to build (see script/exportSnapshot.sh)
+    char libslirp_snapshot_dir[MAX_CONFIG_ATTR_LEN];
+    char vdens_snapshot_dir[MAX_CONFIG_ATTR_LEN];
+    char libslirp_commit[GIT_COMMIT_ID_LEN];            // Commit of the libslirp snapshot, part of the key of the libslirp install cache (see script/compile.sh)
     char chroot_path[MAX_CONFIG_ATTR_LEN];
+    char sources_root_path[MAX_CONFIG_ATTR_LEN];        // Persistent tree of the synced sources, lower layer of the builds above the chroot (see sync/sync.h)
+    char build_dir[MAX_CONFIG_ATTR_LEN];                // Throwaway copy-on-write layer of the build over the base chroot (see script/buildLayer.sh)
+    char build_root_path[MAX_CONFIG_ATTR_LEN];          // Upper directory of the layer (build_dir/root): the build scripts use it in place of chroot_path
+    char workspace_dir[MAX_CONFIG_ATTR_LEN];            // Persistent build trees and compiler cache of the architecture, bind-mounted in every layer
+    char rootfs_cache_dir[MAX_CONFIG_ATTR_LEN];
+    char deb_cache_dir[MAX_CONFIG_ATTR_LEN];
+    char debian_mirror[MAX_CONFIG_ATTR_LEN];
     char thread_chroot_main_dir[MAX_CONFIG_ATTR_LEN];
     char thread_chroot_sshlirp_dir[MAX_CONFIG_ATTR_LEN];
     char thread_chroot_libslirp_dir[MAX_CONFIG_ATTR_LEN];
     char thread_chroot_vdens_dir[MAX_CONFIG_ATTR_LEN];
     char thread_chroot_target_dir[MAX_CONFIG_ATTR_LEN];
-    char thread_chroot_log_file[MAX_CONFIG_ATTR_LEN];
-    char thread_log_file[MAX_CONFIG_ATTR_LEN];
-    pthread_mutex_t *chroot_setup_mutex;
+    char thread_chroot_workspace_dir[MAX_CONFIG_ATTR_LEN];  // Mount point of workspace_dir inside the chroot
+    resource_scheduler_t *scheduler;
+    log_mux_t *log_mux;                                 // Where the stages of the build write their records (see logmux/logmux.h)
+    spawn_cancel_t cancel;                              // Cancellation of the build in progress (see spawn/spawn.h)
 } thread_args_t;
 
 typedef struct {
     int status;
     char *new_release;
+    char sshlirp_commit[GIT_COMMIT_ID_LEN];              // Commits checked out by the last check (the ones the builds are pinned to)
+    char libslirp_commit[GIT_COMMIT_ID_LEN];
+    char vdens_commit[GIT_COMMIT_ID_LEN];
 } commit_status_t;
 
+#define BUILD_MAX_STAGES 8
+
+typedef enum {
+    STAGE_OUTCOME_SKIPPED,                              // Not run (not part of this build, or skipped after the failure of another stage)
+    STAGE_OUTCOME_DONE,
+    STAGE_OUTCOME_FAILED
+} stage_outcome_t;
+
+#define STAGE_MAX_STEPS 16
+#define STAGE_STEP_NAME_LEN 24
+#define STAGE_STEP_MARKER "::step "                     // Line printed by the scripts when a sub-step starts ("::step end" closes it)
+
+// Sub-step of a stage (apt, meson, ninja...), delimited by the markers the scripts print on their output (see logmux/logmux.h)
+typedef struct {
+    char name[STAGE_STEP_NAME_LEN];
+    struct timespec start;                              // CLOCK_MONOTONIC
+    struct timespec end;                                // Zero while the sub-step is running
+} stage_step_t;
+
+// Accounting of one stage of a build: the times are taken by the stage executor, the resources are added up by the stage for each
+// script it runs (see execute_script_for_thread)
+typedef struct {
+    const char *name;
+    const char *tag;                                    // Short name (see build_stage_t)
+    stage_outcome_t outcome;
+    int exit_status;                                    // Status the stage returned (0: success)
+    int cpu_tokens;                                     // CPU tokens granted to the stage by the admission scheduler
+    int term_signal;                                    // Signal that killed one of its scripts (0: none)
+    struct timespec start;                              // CLOCK_MONOTONIC
+    struct timespec end;
+    struct timeval cpu_user;                            // CPU time of the scripts of the stage (and of the processes they waited for)
+    struct timeval cpu_sys;
+    long max_rss_kb;                                    // Peak RSS of the biggest process among them
+    long long bytes_written;                            // Written to disk by the scripts (block output), or by the stage itself (sources copy)
+    int scripts_run;
+    stage_step_t steps[STAGE_MAX_STEPS];                // In the order they started (the steps after the first STAGE_MAX_STEPS are not recorded)
+    int num_steps;
+} stage_result_t;
+
 typedef struct {
     int status;
     char *error_message;
-    char *stats;
+    stage_result_t stages[BUILD_MAX_STAGES];            // Indexed like build_job_t.stages (see worker.c)
+    int completed_tasks;
+    int total_tasks;
+    int chroot_ready;                                   // The base chroot is set up: the next builds skip its setup (see pull_round)
 } thread_result_t;
 
+// Resource class of a build stage: the ready stages wait in one queue per class, so a stage only waits behind the stages bound to the
+// same resource and, e.g., the sources copy of an architecture can start while the other ones compile and test
+typedef enum {
+    STAGE_CLASS_IO,                                     // Disk and network I/O bound (debootstrap download, provisioning, sources copy...)
+    STAGE_CLASS_CPU,                                    // CPU bound (debootstrap second stage, compilation)
+    STAGE_CLASS_NET,                                    // Bound to /dev/net/tun (tests)
+    STAGE_CLASS_COUNT
+} stage_class_t;
+
+typedef enum {
+    STAGE_SKIPPED,                                      // Not part of this build (or skipped after the failure of another stage)
+    STAGE_WAITING,                                      // Waiting for the stages it depends on
+    STAGE_READY,                                        // In the ready queue of its class, waiting for its tokens
+    STAGE_RUNNING,
+    STAGE_DONE
+} stage_state_t;
+
+// Stage of a build, node of the dependency graph of the build (declared by worker.c, run by the stage executor of the worker pool)
+typedef struct build_stage {
+    const char *name;
+    const char *tag;                                    // Short name of the stage in the records of the main log
+    stage_class_t stage_class;
+    resource_request_t cost;                            // Tokens requested to the admission scheduler
+    int (*run)(thread_args_t *args, stage_result_t *accounting, FILE *log_fp);
+    stage_state_t state;
+    stage_result_t accounting;                          // Copied into the result of the build when the stage ends
+    int deps_left;                                      // Stages still to complete before this one is ready
+    int dependents[BUILD_MAX_STAGES];                   // Stages (indexes in the build) waiting for this one
+    int num_dependents;
+    time_t ready_since;
+    struct build_job *job;
+    struct build_stage *next;                           // Ready queue of its class
+} build_stage_t;
+
+// Build of one target, queued to the worker pool (see pool/pool.h)
+typedef struct build_job {
+    int index;                                          // Index of the target (position in the architectures list)
+    thread_args_t *args;
+    thread_result_t *result;                            // Built along the stages (NULL if it could not be allocated)
+    build_stage_t stages[BUILD_MAX_STAGES];             // Dependency graph of the build (see worker.c)
+    int stages_left;                                    // Stages not completed yet (nor skipped)
+    int stages_running;
+    int failed;                                         // A stage failed: the stages not started yet are skipped
+    int cancelled;                                      // Cancelled by worker_pool_cancel before it completed
+    int completed;                                      // In the completion queue, or already taken off it
+    int completed_tasks;
+    int total_tasks;
+    FILE *log_fp;                                       // Records of the build not bound to a stage (see logmux/logmux.h), open from its queueing to its collection
+    struct build_job *next;
+} build_job_t;
+
+// Fixed set of threads running the stages of the builds: up to max_active_builds builds are taken from the job queue at the same time,
+// and their ready stages are run as soon as their resource class has free tokens. The results are handed back through a completion queue,
+// in the order the builds finish
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;                      // A job was queued, a stage became ready or some tokens were released
+    int completion_fd;                                  // eventfd, readable when the completion queue is not empty (watched by the event loop)
+    build_job_t *pending_head;                          // Job queue (FIFO)
+    build_job_t *pending_tail;
+    build_stage_t *ready_head[STAGE_CLASS_COUNT];       // Ready stages, one FIFO per resource class
+    build_stage_t *ready_tail[STAGE_CLASS_COUNT];
+    build_job_t *completed_head;                        // Completion queue (FIFO, in completion order)
+    build_job_t *completed_tail;
+    int active_builds;                                  // Builds taken from the job queue and not completed yet
+    int max_active_builds;
+    int shutting_down;
+    int num_workers;
+    pthread_t *workers;
+} worker_pool_t;
+
+// Blocking work of the main loop (polls of the repositories, pruning of the source snapshots, discard of the build layers), run by the
+// task runner so that the loop keeps handling signals, control requests and completed builds meanwhile (see task/task.h)
+typedef struct loop_task {
+    const char *name;                                   // Name and tag of the log stream of the task (see logmux/logmux.h)
+    const char *tag;
+    int (*run)(struct loop_task *task, FILE *log_fp);
+    void *data;                                         // Inputs and outputs of run, only touched by the main while the task is not running
+    int status;                                         // Returned by run
+    int in_flight;                                      // Submitted and not taken back by the main yet
+    struct loop_task *next;
+} loop_task_t;
+
+// Threads running the tasks of the main loop in submission order: the completed tasks are handed back through a completion queue,
+// like the builds of the worker pool
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    int completion_fd;                                  // eventfd, readable when the completion queue is not empty (watched by the event loop)
+    log_mux_t *log_mux;
+    FILE *log_fp;                                       // Main log, used by the tasks whose log stream cannot be opened
+    loop_task_t *pending_head;                          // Task queue (FIFO)
+    loop_task_t *pending_tail;
+    loop_task_t *completed_head;                        // Completion queue (FIFO, in completion order)
+    loop_task_t *completed_tail;
+    int shutting_down;
+    int num_threads;
+    pthread_t *threads;
+} task_runner_t;
+
+// Commits exported for the builds by one poll: the pipelines of all the architectures build from it, each one when it is free
+typedef struct {
+    unsigned long id;                                   // Increasing with the polls: a pipeline never builds a generation older than the one it built last
+    commit_status_t commits;                            // new_release is owned by the generation
+    char sshlirp_snapshot_dir[MAX_CONFIG_ATTR_LEN];
+    char libslirp_snapshot_dir[MAX_CONFIG_ATTR_LEN];
+    char vdens_snapshot_dir[MAX_CONFIG_ATTR_LEN];
+    char tree_fingerprint[SHA256_HEX_LEN];              // Empty if the sshlirp tree could not be fingerprinted (every architecture is built)
+    char release_dir[MAX_CONFIG_ATTR_LEN*2];
+    struct timespec found_at;                           // When the poll found the commits (CLOCK_MONOTONIC), for the commit-to-artifact latency
+    char trace_file[MAX_CONFIG_ATTR_LEN*2];             // Timeline of the builds of the generation (empty if it could not be created, see trace/trace.h)
+    int refs;                                           // The daemon, as long as it is the newest generation, plus the pipelines building it
+} build_generation_t;
+
+#define REBUILD_MARKER_NAME "rebuild-pending"            // In MAIN_DIR: the daemon stopped before building the commits checked out for every architecture
+
+// Poll of the repositories, run as a task of the main loop (see poll/poll.h): the main fills in the inputs before submitting it and
+// takes the outputs when it comes back. The configuration is only read
+typedef struct {
+    loop_task_t task;
+    int first_poll;                                     // Check (and clone) the repositories before looking for new commits
+    unsigned long generation_id;                        // Id of the generation, if the poll finds new commits
+    char *target_dir;
+    char *sshlirp_source_dir;
+    char *libslirp_source_dir;
+    char *vdens_source_dir;
+    char *sshlirp_repo_url;
+    char *libslirp_repo_url;
+    char *vdens_repo_url;
+    char *versioning_file;
+    char *snapshots_dir;
+    char *traces_dir;
+    char *rebuild_marker;                               // MAIN_DIR/REBUILD_MARKER_NAME
+    char **archs_list;
+    int num_archs;
+    struct timespec started_at;                         // CLOCK_MONOTONIC, set when the poll is submitted
+    int result;                                         // 0: no new commits, 2: new generation ready, 1: error (the daemon stops)
+    build_generation_t *generation;                     // New generation (result 2), handed over to the main
+} repo_poll_t;
+
+// Pruning of the source snapshots no build uses anymore, run as a task of the main loop: it never runs together with a poll,
+// which exports the new snapshots into the same directory
+typedef struct {
+    loop_task_t task;
+    char *snapshots_dir;
+    char (*keep_dirs)[MAX_CONFIG_ATTR_LEN];             // Snapshots of the newest generation and of the builds in progress, copied by the main
+    int num_keep_dirs;
+} snapshot_prune_t;
+
+// Build pipeline of one architecture: it builds one generation at a time and, when it is free, moves straight to the newest one,
+// skipping the generations found by the polls while it was busy
+typedef struct {
+    thread_args_t args;
+    build_job_t job;
+    build_generation_t *building;                       // Generation in the pool (NULL when the pipeline is idle)
+    unsigned long built_generation;                     // Id of the last generation handled (built, failed or reused)
+    int builds_started;                                 // Passed to the worker as pull_round
+    char build_fingerprint[SHA256_HEX_LEN];             // Fingerprint of the build in progress (empty if not computed)
+    struct timespec queued_at;                          // When the build in progress was queued to the pool (CLOCK_MONOTONIC)
+    loop_task_t discard;                                // Discard of the layer of the build collected last (the pipeline is busy until it ends)
+    int awaiting_poll;                                  // Its last build was cancelled: the newest generation is built again after the next poll
+} arch_pipeline_t;
+
+#define EVENT_LOOP_MAX_EVENTS 16                        // Events handled by the main loop for each wake up
+
+// Sources of the events waited for by the main loop of the daemon (see loop/loop.h)
+typedef enum {
+    EVENT_SIGNAL,                                       // signalfd: termination signals
+    EVENT_TIMER,                                        // timerfd: the poll interval has elapsed
+    EVENT_POOL,                                         // completion eventfd of the worker pool: a build has completed
+    EVENT_TASK,                                         // completion eventfd of the task runner: a poll, a pruning or a layer discard has ended
+    EVENT_CONTROL,                                      // Unix control socket: a client connected (see control/control.h)
+    EVENT_WEBHOOK                                       // HTTP webhook listener: a push notification connected
+} event_source_t;
+
+// Event returned by event_loop_wait
+typedef struct {
+    event_source_t source;
+    int fd;
+} loop_event_t;
+
+// Event loop of the daemon: a single epoll instance watching the signals, the poll timer and the completions of the builds
+typedef struct {
+    int epoll_fd;
+    int signal_fd;
+    int timer_fd;
+    int terminate_requested;                            // A termination signal was received
+    int poll_due;                                       // The poll timer has expired since the last poll
+} event_loop_t;
+
+#define CONTROL_REQUEST_LEN 256                         // Longest request line accepted on the control socket
+#define WEBHOOK_REQUEST_LEN 16384                       // Longest HTTP request head accepted by the webhook listener
+#define WEBHOOK_PAYLOAD_LEN (1024 * 1024)               // Longest payload accepted by the webhook listener (it is read and discarded)
+#define CONTROL_TIMEOUT_MS 1000                         // Time a client has to send its request and read the reply (the main loop waits meanwhile)
+#define CONTROL_STATUS_LEN 8192                         // Longest reply to a status request (one line per architecture)
+
+// Commands that can be requested to the daemon
+typedef enum {
+    CONTROL_TRIGGER,                                    // Poll the repositories now (push notification)
+    CONTROL_STATUS,                                     // Reply with the state of the daemon and of the pipeline of each architecture
+    CONTROL_CANCEL,                                     // Cancel the build in progress of an architecture, or of all of them
+    CONTROL_DRAIN,                                      // No more polls nor builds: exit when the builds in progress are done
+    CONTROL_SHUTDOWN                                    // Cancel the builds in progress and exit as soon as they are cleaned up
+} control_command_t;
+
+// Request read from the control socket or from the webhook listener, waiting for its reply
+typedef struct {
+    control_command_t command;
+    char target[16];                                    // Architecture of a cancel request ("all": every architecture)
+    event_source_t source;                              // EVENT_CONTROL or EVENT_WEBHOOK: how the reply is written
+    int client_fd;
+} control_request_t;
+
+// Endpoints through which the daemon receives requests
+typedef struct {
+    int socket_fd;                                      // Unix control socket (CONTROL_SOCKET_PATH)
+    int webhook_fd;                                     // HTTP listener on 127.0.0.1:WEBHOOK_PORT (-1 if disabled)
+} control_t;
+
+// Metrics of the daemon, written in the Prometheus text format (see metrics/metrics.h)
+#define METRICS_FILE_NAME "sshlirp_ci.prom"             // In MAIN_DIR/metrics, to be read by the textfile collector of node_exporter
+#define METRICS_MAX_BUCKETS 12
+
+typedef struct {
+    const double *bounds;                               // Upper bounds of the buckets, increasing (the +Inf bucket is count)
+    int num_bounds;
+    unsigned long buckets[METRICS_MAX_BUCKETS];         // Observations not greater than each bound
+    unsigned long count;
+    double sum;
+} metrics_histogram_t;
+
+// Metrics of the builds of one architecture
+typedef struct {
+    metrics_histogram_t build_seconds;                  // From the queueing of the build to its collection
+    metrics_histogram_t commit_to_artifact_seconds;     // From the poll that found the commits to the publication of the binary (built or reused)
+    metrics_histogram_t stage_seconds[BUILD_MAX_STAGES];
+    double stage_cpu_seconds[BUILD_MAX_STAGES][2];      // User and system CPU time of the scripts of each stage
+    unsigned long stage_failures[BUILD_MAX_STAGES];
+    unsigned long builds_succeeded;
+    unsigned long builds_failed;
+    unsigned long cache_hits;                           // Builds avoided because the build fingerprint was unchanged (binary reused)
+    unsigned long cache_misses;                         // Builds queued after the fingerprint was computed
+    int build_in_progress;
+} arch_metrics_t;
+
+typedef struct {
+    char path[MAX_CONFIG_ATTR_LEN];
+    int num_archs;
+    char **arch_names;
+    arch_metrics_t *archs;
+    const char *stage_tags[BUILD_MAX_STAGES];           // Labels of the stages, taken from the first results
+    metrics_histogram_t poll_seconds;
+    unsigned long polls_new_commits;
+    unsigned long polls_unchanged;
+    unsigned long polls_failed;
+    int builds_queued;                                  // Builds waiting in the job queue of the pool
+    int builds_active;                                  // Builds taken by the pool and not completed yet
+    int dirty;                                          // Something changed since the last write
+} metrics_t;
+
+// Timelines of the rounds, in the trace-event JSON format of Chrome and Perfetto (see trace/trace.h)
+#define TRACE_FILE_PREFIX "round-"                      // In MAIN_DIR/traces: round-<generation>-<release>.json
+
 #endif // TYPES_H
\ No newline at end of file
@@ -4,32 +4,14 @@
 #include "types/types.h"
 #include <stdio.h>
 
-int execute_script(
-    const char* script_path,
-    const char* arg1, 
-    const char* arg2, 
-    const char* arg3, 
-    const char* arg4, 
-    const char* arg5,
-    const char* versioning_file,
-    FILE* log_fp
-);
-
-int execute_script_for_thread(
-    const char* arch,
-    const char* script_path,
-    const char* arg1,
-    const char* arg2,
-    const char* arg3,
-    const char* arg4,
-    const char* arg5,
-    const char* arg6,
-    const int sudo_user,
-    FILE* log_fp
-);
+int execute_script(const char* const argv[], FILE* log_fp);
+
+int execute_script_for_thread(thread_args_t* args, const char* const argv[], stage_result_t* accounting, FILE* log_fp);
 
 char *get_parent_dir(char *path);
 
+int read_head_commit(const char *repo_dir, char *commit, size_t commit_len, FILE *log_fp);
+
 #endif // UTILS_H
 
 
@@ -3,6 +3,18 @@
 
 #include "types/types.h"
 
-void *build_worker(void *arg_ptr);
+int build_worker_begin(build_job_t *job);
+
+void build_worker_stage_log(build_job_t *job, build_stage_t *stage, int stage_status, FILE *stage_log_fp);
+
+int build_worker_stage_done(build_job_t *job, build_stage_t *stage, int stage_status);
+
+void build_worker_cancel(build_job_t *job);
+
+thread_result_t *build_worker_end(build_job_t *job);
+
+void build_worker_close(build_job_t *job);
+
+void print_build_stats(const thread_result_t *result, FILE *log_fp);
 
 #endif // WORKER_H
\ No newline at end of file
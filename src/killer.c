@@ -7,10 +7,12 @@
 #include <time.h>
 #include <sys/types.h>
 #include "daemon_utils.h"
+#include "control/client.h"
 
 #define TERM_WAIT_SECONDS 10
 #define CHECK_INTERVAL_MS 200
 #define KILL_WAIT_SECONDS 2
+#define CONTROL_WAIT_MS 2000
 
 static int process_alive(pid_t pid) {
     return kill(pid, 0) == 0;
@@ -51,11 +53,19 @@ int main(void) {
     printf("Killer: terminazione immediata del daemon sshlirp_ci (PID %d). Stato attuale: %s\n",
            daemon_pid, state_buf[0] ? state_buf : "SCONOSCIUTO");
 
-    // Primo tentativo: SIGTERM (terminazione “sicura” -> permette al codice di chiudere risorse se intercetta il segnale)
-    if (kill(daemon_pid, SIGTERM) != 0) {
+    // Primo tentativo: shutdown tramite il control socket (le build in corso vengono annullate uccidendo i gruppi di processi dei loro
+    // script, e i loro layer vengono rimossi), altrimenti SIGTERM (terminazione “sicura” -> permette al codice di chiudere risorse se intercetta il segnale).
+    // Una richiesta inviata senza risposta in tempo viene comunque servita dal daemon
+    char reply[256] = "";
+    int request_status = control_send_request("shutdown", CONTROL_WAIT_MS, reply, sizeof(reply));
+    int shutdown_requested = request_status == 0 || request_status == -2;
+    if (shutdown_requested) {
+        printf("Shutdown richiesto tramite il control socket (%s).\n", request_status == 0 ? reply : "nessuna risposta in tempo");
+    }
+    if (!shutdown_requested && kill(daemon_pid, SIGTERM) != 0) {
         fprintf(stderr, "Errore nell'invio di SIGTERM a %d: %s\n", daemon_pid, strerror(errno));
     } else {
-        printf("SIGTERM inviato. Attendo fino a %d secondi...\n", TERM_WAIT_SECONDS);
+        printf("%s. Attendo fino a %d secondi...\n", shutdown_requested ? "Shutdown in corso" : "SIGTERM inviato", TERM_WAIT_SECONDS);
         struct timespec ts;
         ts.tv_sec = 0;
         ts.tv_nsec = CHECK_INTERVAL_MS * 1000000L;
@@ -64,13 +74,13 @@ int main(void) {
         int max_wait_ms = TERM_WAIT_SECONDS * 1000;
         while (waited_ms < max_wait_ms) {
             if (!process_alive(daemon_pid)) {
-                printf("Daemon terminato dopo SIGTERM (%d ms).\n", waited_ms);
+                printf("Daemon terminato dopo %s (%d ms).\n", shutdown_requested ? "lo shutdown" : "SIGTERM", waited_ms);
                 goto cleanup;
             }
             nanosleep(&ts, NULL);
             waited_ms += CHECK_INTERVAL_MS;
         }
-        printf("Il daemon non è terminato entro %d secondi dopo SIGTERM.\n", TERM_WAIT_SECONDS);
+        printf("Il daemon non è terminato entro %d secondi dopo %s.\n", TERM_WAIT_SECONDS, shutdown_requested ? "lo shutdown" : "SIGTERM");
     }
 
     // Escalation: SIGKILL
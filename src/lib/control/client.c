@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "control/client.h"
+#include "daemon_utils.h"
+
+// Function that sends a request line (e.g. "shutdown") to the daemon through its control socket and reads the whole reply (the daemon
+// closes the connection after it), waiting at most timeout_ms for each read. The reply is copied without its OK/ERR prefix.
+// Returns 0 if the daemon answered OK, 1 if it answered ERR, -1 if it could not be reached (errno tells why), -2 if the request was sent
+// but the reply did not arrive in time (the daemon will still serve it)
+int control_send_request(const char *request, int timeout_ms, char *reply, size_t reply_len) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+    reply[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%s\n", request);
+    if (len <= 0 || (size_t)len >= sizeof(line) || send(fd, line, (size_t)len, MSG_NOSIGNAL) != len) {
+        close(fd);
+        return -1;
+    }
+
+    size_t used = 0;
+    while (used < reply_len - 1) {
+        ssize_t n = recv(fd, reply + used, reply_len - 1 - used, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int recv_errno = errno;
+            close(fd);
+            errno = recv_errno;
+            return (recv_errno == EAGAIN || recv_errno == EWOULDBLOCK) ? -2 : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    reply[used] = '\0';
+    close(fd);
+
+    // The reply ends with a newline (the lines before it belong to a status reply)
+    if (used > 0 && reply[used - 1] == '\n') {
+        reply[used - 1] = '\0';
+    }
+    int status;
+    size_t prefix;
+    if (strncmp(reply, "OK ", 3) == 0) {
+        status = 0;
+        prefix = 3;
+    } else if (strncmp(reply, "ERR ", 4) == 0) {
+        status = 1;
+        prefix = 4;
+    } else {
+        errno = EPROTO;
+        return -1;
+    }
+    memmove(reply, reply + prefix, strlen(reply + prefix) + 1);
+    return status;
+}
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "control/control.h"
+#include "loop/loop.h"
+#include "daemon_utils.h"
+
+// Function that creates the Unix control socket, readable only by the user running the daemon. A socket left behind by a daemon
+// that was killed is replaced (only one daemon runs at a time, see the PID file)
+static int open_control_socket(FILE *log_fp) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CONTROL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(CONTROL_SOCKET_PATH);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(CONTROL_SOCKET_PATH, 0600) != 0 || listen(fd, 8) != 0) {
+        fprintf(log_fp, "Error: Failed to listen on the control socket %s: %s\n", CONTROL_SOCKET_PATH, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function that creates the webhook listener. It is bound to the loopback interface: a forge outside the host reaches it through a reverse proxy
+static int open_webhook_listener(int port, FILE *log_fp) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the webhook listener: %s\n", strerror(errno));
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        fprintf(log_fp, "Error: Failed to listen for webhooks on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function that opens the control socket and, if webhook_port is not 0, the webhook listener, and adds them to the event loop
+int control_init(control_t *control, int webhook_port, event_loop_t *loop, FILE *log_fp) {
+    control->socket_fd = open_control_socket(log_fp);
+    control->webhook_fd = -1;
+    if (control->socket_fd == -1) {
+        return 1;
+    }
+    if (event_loop_add(loop, control->socket_fd, EVENT_CONTROL, log_fp) != 0) {
+        control_destroy(control);
+        return 1;
+    }
+    fprintf(log_fp, "Control socket listening on %s.\n", CONTROL_SOCKET_PATH);
+
+    if (webhook_port > 0) {
+        control->webhook_fd = open_webhook_listener(webhook_port, log_fp);
+        if (control->webhook_fd == -1 || event_loop_add(loop, control->webhook_fd, EVENT_WEBHOOK, log_fp) != 0) {
+            control_destroy(control);
+            return 1;
+        }
+        fprintf(log_fp, "Webhook listener on http://127.0.0.1:%d/.\n", webhook_port);
+    }
+    return 0;
+}
+
+// Function that reads from a client until the end of the request (end_marker) or until len - 1 bytes. Returns the bytes read, -1 on errors
+// or if the client does not send the whole request within CONTROL_TIMEOUT_MS
+static ssize_t read_request(int fd, char *buffer, size_t len, const char *end_marker) {
+    size_t used = 0;
+    buffer[0] = '\0';
+    while (used < len - 1 && !strstr(buffer, end_marker)) {
+        ssize_t n = recv(fd, buffer + used, len - 1 - used, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t)n;
+        buffer[used] = '\0';
+    }
+    return (ssize_t)used;
+}
+
+// Function that writes a reply to the client, ignoring a client that has gone away (no SIGPIPE)
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Function that parses a request line of the control socket ("trigger", "status", "cancel <arch>", "cancel all", "drain" or "shutdown")
+static int parse_control_request(char *line, control_request_t *request) {
+    line[strcspn(line, "\r\n")] = '\0';
+    request->target[0] = '\0';
+    if (strcmp(line, "trigger") == 0) {
+        request->command = CONTROL_TRIGGER;
+        return 0;
+    }
+    if (strcmp(line, "status") == 0) {
+        request->command = CONTROL_STATUS;
+        return 0;
+    }
+    if (strcmp(line, "drain") == 0) {
+        request->command = CONTROL_DRAIN;
+        return 0;
+    }
+    if (strcmp(line, "shutdown") == 0) {
+        request->command = CONTROL_SHUTDOWN;
+        return 0;
+    }
+    if (strncmp(line, "cancel ", 7) == 0 && line[7] != '\0' && strlen(line + 7) < sizeof(request->target)) {
+        request->command = CONTROL_CANCEL;
+        strcpy(request->target, line + 7);
+        return 0;
+    }
+    return 1;
+}
+
+// Function that returns the reason phrase of the HTTP statuses replied by the webhook listener
+static const char *http_reason(int http_status) {
+    switch (http_status) {
+        case 202: return "Accepted";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        default: return "Bad Request";
+    }
+}
+
+// Function that parses the head of an HTTP request to the webhook listener: every POST is a push notification (the payload of the
+// forge is not needed, the poll finds out what moved) and is discarded. Returns the HTTP status to reply with an error, 0 if the request is valid
+static int parse_webhook_request(int fd, char *head, size_t head_len, control_request_t *request) {
+    char *body = strstr(head, "\r\n\r\n");
+    if (!body) {
+        return head_len >= WEBHOOK_REQUEST_LEN - 1 ? 431 : 400;
+    }
+    body += 4;
+
+    if (strncmp(head, "POST ", 5) != 0) {
+        return 405;
+    }
+
+    // Drain the payload announced by Content-Length, so that the client does not see a reset while it is still sending it
+    long content_length = 0;
+    for (char *line = strstr(head, "\r\n"); line && line < body; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            content_length = strtol(line + 17, NULL, 10);
+            break;
+        }
+    }
+    if (content_length > WEBHOOK_PAYLOAD_LEN) {
+        return 413;
+    }
+    long pending = content_length - (long)(head_len - (size_t)(body - head));
+    char discard[4096];
+    while (pending > 0) {
+        ssize_t n = recv(fd, discard, sizeof(discard), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 400;
+        }
+        pending -= n;
+    }
+
+    request->command = CONTROL_TRIGGER;
+    return 0;
+}
+
+// Function that accepts a connection on the endpoint that woke up the event loop and reads its request. Returns 0 if a request was read:
+// the caller must answer it with control_reply. Otherwise the connection has already been answered and closed (or there was none) and 1 is returned
+int control_accept(control_t *control, const loop_event_t *event, control_request_t *request, FILE *log_fp) {
+    int listen_fd = event->source == EVENT_WEBHOOK ? control->webhook_fd : control->socket_fd;
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fprintf(log_fp, "Warning: Failed to accept a connection on the %s: %s\n", event->source == EVENT_WEBHOOK ? "webhook listener" : "control socket", strerror(errno));
+        }
+        return 1;
+    }
+
+    // The requests are handled by the main loop: a client that does not send its request in time is dropped
+    struct timeval timeout = {CONTROL_TIMEOUT_MS / 1000, (CONTROL_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    request->source = event->source;
+    request->client_fd = fd;
+
+    if (event->source == EVENT_WEBHOOK) {
+        char *head = malloc(WEBHOOK_REQUEST_LEN);
+        if (!head) {
+            close(fd);
+            return 1;
+        }
+        ssize_t len = read_request(fd, head, WEBHOOK_REQUEST_LEN, "\r\n\r\n");
+        int http_status = len <= 0 ? 400 : parse_webhook_request(fd, head, (size_t)len, request);
+        free(head);
+        if (http_status != 0) {
+            char reply[128];
+            int reply_len = snprintf(reply, sizeof(reply), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", http_status, http_reason(http_status));
+            send_all(fd, reply, (size_t)reply_len);
+            close(fd);
+            fprintf(log_fp, "Webhook request rejected (HTTP %d).\n", http_status);
+            return 1;
+        }
+        return 0;
+    }
+
+    char line[CONTROL_REQUEST_LEN];
+    if (read_request(fd, line, sizeof(line), "\n") <= 0 || parse_control_request(line, request) != 0) {
+        control_reply(request, 0, "unknown request");
+        return 1;
+    }
+    return 0;
+}
+
+// Function that answers a request and closes its connection: on the control socket the message prefixed by OK or ERR (the reply
+// to a status request spans several lines, the client reads until the connection is closed), on the webhook listener an HTTP
+// response (202 or 503) with the message as its body
+void control_reply(control_request_t *request, int ok, const char *message) {
+    char head[CONTROL_REQUEST_LEN];
+    int len;
+    if (request->source == EVENT_WEBHOOK) {
+        int http_status = ok ? 202 : 503;
+        len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                       http_status, http_reason(http_status), strlen(message) + 1);
+    } else {
+        len = snprintf(head, sizeof(head), "%s ", ok ? "OK" : "ERR");
+    }
+    if (len > 0 && (size_t)len < sizeof(head)) {
+        send_all(request->client_fd, head, (size_t)len);
+        send_all(request->client_fd, message, strlen(message));
+        send_all(request->client_fd, "\n", 1);
+    }
+    close(request->client_fd);
+    request->client_fd = -1;
+}
+
+// Function that closes the endpoints and removes the control socket
+void control_destroy(control_t *control) {
+    if (control->webhook_fd >= 0) {
+        close(control->webhook_fd);
+        control->webhook_fd = -1;
+    }
+    if (control->socket_fd >= 0) {
+        close(control->socket_fd);
+        control->socket_fd = -1;
+        unlink(CONTROL_SOCKET_PATH);
+    }
+}
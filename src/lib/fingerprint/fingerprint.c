@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "fingerprint/fingerprint.h"
+#include "fingerprint/sha256.h"
+
+#define FINGERPRINT_PATH_LEN 4096
+#define FINGERPRINT_READ_BUF_LEN 65536
+#define FINGERPRINT_VERSION "sshlirpci-fingerprint-v1"    // Bump it when the composition of the fingerprint changes
+
+// File of the tree to hash
+typedef struct {
+    char *path;                                         // Relative to the root of the tree
+    char kind;                                          // 'f' regular file, 'x' executable file, 'l' symlink
+    uint8_t digest[SHA256_DIGEST_LEN];
+} tree_entry_t;
+
+// Files of the tree to hash, collected by a single walk and hashed in parallel by the hashing threads
+typedef struct {
+    tree_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    const char *root_dir;
+    pthread_mutex_t lock;
+    size_t next;                                        // Next file to hash
+    int failed;
+    FILE *log_fp;
+} tree_files_t;
+
+// Entries that cannot change the binaries (documentation, repository metadata): a commit that only touches them does not need a build
+static int is_ignored(const char *name, int is_dir) {
+    if (is_dir) {
+        return strcmp(name, ".git") == 0 || strcmp(name, ".github") == 0 || strcmp(name, "doc") == 0 || strcmp(name, "docs") == 0;
+    }
+
+    size_t len = strlen(name);
+    if (len > 3 && strcmp(name + len - 3, ".md") == 0) {
+        return 1;
+    }
+    return strncmp(name, "README", 6) == 0 || strncmp(name, "LICENSE", 7) == 0 || strncmp(name, "COPYING", 7) == 0 ||
+           strcmp(name, "AUTHORS") == 0 || strcmp(name, "ChangeLog") == 0 || strcmp(name, "CHANGELOG") == 0 ||
+           strcmp(name, "NEWS") == 0 || strcmp(name, ".gitignore") == 0;
+}
+
+static int add_file(tree_files_t *files, const char *rel_path, char kind) {
+    if (files->count == files->capacity) {
+        size_t new_capacity = files->capacity ? files->capacity * 2 : 256;
+        tree_entry_t *new_entries = realloc(files->entries, new_capacity * sizeof(*new_entries));
+        if (!new_entries) {
+            return 1;
+        }
+        files->entries = new_entries;
+        files->capacity = new_capacity;
+    }
+
+    tree_entry_t *entry = &files->entries[files->count];
+    entry->path = strdup(rel_path);
+    if (!entry->path) {
+        return 1;
+    }
+    entry->kind = kind;
+    files->count++;
+    return 0;
+}
+
+// Function that collects (recursively) the files of the tree that take part in the fingerprint
+static int collect_files(tree_files_t *files, const char *rel_dir) {
+    char dir_path[FINGERPRINT_PATH_LEN];
+    int written = rel_dir[0] ? snprintf(dir_path, sizeof(dir_path), "%s/%s", files->root_dir, rel_dir) : snprintf(dir_path, sizeof(dir_path), "%s", files->root_dir);
+    if (written < 0 || (size_t)written >= sizeof(dir_path)) {
+        fprintf(files->log_fp, "Error: Path too long while fingerprinting %s\n", files->root_dir);
+        return 1;
+    }
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(files->log_fp, "Error: Failed to open directory %s for fingerprinting: %s\n", dir_path, strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    struct dirent *entry;
+    while (status == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char rel_path[FINGERPRINT_PATH_LEN];
+        written = rel_dir[0] ? snprintf(rel_path, sizeof(rel_path), "%s/%s", rel_dir, entry->d_name) : snprintf(rel_path, sizeof(rel_path), "%s", entry->d_name);
+        if (written < 0 || (size_t)written >= sizeof(rel_path)) {
+            fprintf(files->log_fp, "Error: Path too long while fingerprinting %s\n", files->root_dir);
+            status = 1;
+            break;
+        }
+
+        char full_path[FINGERPRINT_PATH_LEN];
+        written = snprintf(full_path, sizeof(full_path), "%s/%s", files->root_dir, rel_path);
+        if (written < 0 || (size_t)written >= sizeof(full_path)) {
+            fprintf(files->log_fp, "Error: Path too long while fingerprinting %s\n", files->root_dir);
+            status = 1;
+            break;
+        }
+
+        struct stat st;
+        if (lstat(full_path, &st) != 0) {
+            fprintf(files->log_fp, "Error: Failed to stat %s for fingerprinting: %s\n", full_path, strerror(errno));
+            status = 1;
+            break;
+        }
+
+        if (is_ignored(entry->d_name, S_ISDIR(st.st_mode))) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            status = collect_files(files, rel_path);
+        } else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
+            char kind = S_ISLNK(st.st_mode) ? 'l' : ((st.st_mode & S_IXUSR) ? 'x' : 'f');
+            if (add_file(files, rel_path, kind) != 0) {
+                fprintf(files->log_fp, "Error: Out of memory while fingerprinting %s\n", files->root_dir);
+                status = 1;
+            }
+        }
+    }
+
+    closedir(dir);
+    return status;
+}
+
+// Function that hashes the content of a file (or the target of a symlink)
+static int hash_entry(const char *path, char kind, uint8_t digest[SHA256_DIGEST_LEN], FILE *log_fp) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+
+    if (kind == 'l') {
+        char target[FINGERPRINT_PATH_LEN];
+        ssize_t len = readlink(path, target, sizeof(target));
+        if (len < 0 || (size_t)len >= sizeof(target)) {
+            fprintf(log_fp, "Error: Failed to read symlink %s for fingerprinting: %s\n", path, len < 0 ? strerror(errno) : "target too long");
+            return 1;
+        }
+        sha256_update(&ctx, target, (size_t)len);
+        sha256_final(&ctx, digest);
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(log_fp, "Error: Failed to open %s for fingerprinting: %s\n", path, strerror(errno));
+        return 1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char *buffer = malloc(FINGERPRINT_READ_BUF_LEN);
+    if (!buffer) {
+        close(fd);
+        fprintf(log_fp, "Error: Out of memory while fingerprinting %s\n", path);
+        return 1;
+    }
+
+    int status = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, FINGERPRINT_READ_BUF_LEN)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(log_fp, "Error: Failed to read %s for fingerprinting: %s\n", path, strerror(errno));
+            status = 1;
+            break;
+        }
+        sha256_update(&ctx, buffer, (size_t)n);
+    }
+
+    free(buffer);
+    close(fd);
+    if (status == 0) {
+        sha256_final(&ctx, digest);
+    }
+    return status;
+}
+
+// Hashing thread: takes the next file of the list until the list is empty (or another thread failed)
+static void *hash_worker(void *arg) {
+    tree_files_t *files = arg;
+
+    while (1) {
+        pthread_mutex_lock(&files->lock);
+        if (files->failed || files->next >= files->count) {
+            pthread_mutex_unlock(&files->lock);
+            break;
+        }
+        size_t index = files->next++;
+        pthread_mutex_unlock(&files->lock);
+
+        tree_entry_t *entry = &files->entries[index];
+        char full_path[FINGERPRINT_PATH_LEN];
+        int written = snprintf(full_path, sizeof(full_path), "%s/%s", files->root_dir, entry->path);
+        if (written < 0 || (size_t)written >= sizeof(full_path) || hash_entry(full_path, entry->kind, entry->digest, files->log_fp) != 0) {
+            pthread_mutex_lock(&files->lock);
+            files->failed = 1;
+            pthread_mutex_unlock(&files->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const tree_entry_t *)a)->path, ((const tree_entry_t *)b)->path);
+}
+
+static void free_tree_files(tree_files_t *files) {
+    for (size_t i = 0; i < files->count; i++) {
+        free(files->entries[i].path);
+    }
+    free(files->entries);
+    pthread_mutex_destroy(&files->lock);
+}
+
+// Function that computes the fingerprint of a source tree: SHA-256 of the sorted list of (path, kind, content hash) of its files,
+// documentation and repository metadata excluded. The files are hashed in parallel by up to FINGERPRINT_MAX_THREADS threads
+int fingerprint_tree(const char *root_dir, char hex[SHA256_HEX_LEN], FILE *log_fp) {
+    tree_files_t files;
+    memset(&files, 0, sizeof(files));
+    files.root_dir = root_dir;
+    files.log_fp = log_fp;
+    pthread_mutex_init(&files.lock, NULL);
+
+    if (collect_files(&files, "") != 0) {
+        free_tree_files(&files);
+        return 1;
+    }
+
+    // The order of readdir depends on the filesystem: the fingerprint uses the sorted paths
+    qsort(files.entries, files.count, sizeof(*files.entries), compare_entries);
+
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = online_cpus > 0 ? (int)online_cpus : 1;
+    if (num_threads > FINGERPRINT_MAX_THREADS) {
+        num_threads = FINGERPRINT_MAX_THREADS;
+    }
+    if ((size_t)num_threads > files.count) {
+        num_threads = files.count > 0 ? (int)files.count : 1;
+    }
+
+    pthread_t threads[FINGERPRINT_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, hash_worker, &files) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        // No thread could be started: the calling thread hashes everything
+        hash_worker(&files);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (files.failed) {
+        free_tree_files(&files);
+        return 1;
+    }
+
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    for (size_t i = 0; i < files.count; i++) {
+        const tree_entry_t *entry = &files.entries[i];
+        sha256_update(&ctx, entry->path, strlen(entry->path) + 1);
+        sha256_update(&ctx, &entry->kind, 1);
+        sha256_update(&ctx, entry->digest, SHA256_DIGEST_LEN);
+    }
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+
+    fprintf(log_fp, "Fingerprint of %s: %s (%zu files, hashing threads: %d)\n", root_dir, hex, files.count, started > 0 ? started : 1);
+    free_tree_files(&files);
+    return 0;
+}
+
+// Function that computes the SHA-256 of a single file (e.g. a published binary)
+int fingerprint_file(const char *path, char hex[SHA256_HEX_LEN], FILE *log_fp) {
+    uint8_t digest[SHA256_DIGEST_LEN];
+    if (hash_entry(path, 'f', digest, log_fp) != 0) {
+        return 1;
+    }
+    sha256_to_hex(digest, hex);
+    return 0;
+}
+
+// Function that adds a labelled value to the fingerprint being computed
+static void hash_field(sha256_ctx_t *ctx, const char *label, const void *value, size_t len) {
+    uint64_t encoded_len = len;
+    sha256_update(ctx, label, strlen(label) + 1);
+    sha256_update(ctx, &encoded_len, sizeof(encoded_len));
+    sha256_update(ctx, value, len);
+}
+
+// Function that adds the content of a file to the fingerprint being computed
+static int hash_file_field(sha256_ctx_t *ctx, const char *label, const char *path, FILE *log_fp) {
+    uint8_t digest[SHA256_DIGEST_LEN];
+    if (hash_entry(path, 'f', digest, log_fp) != 0) {
+        return 1;
+    }
+    hash_field(ctx, label, digest, sizeof(digest));
+    return 0;
+}
+
+// Function that computes the fingerprint of everything that determines the binary of an architecture: the sshlirp source tree,
+// the libslirp commit, the packages installed in the chroot (provisioning manifest) and the build scripts, which hold the build flags.
+// Fails if one of the inputs is not available yet (e.g. the chroot has never been provisioned): the architecture must then be built
+int compute_build_fingerprint(const thread_args_t *args, const char *tree_fingerprint, char hex[SHA256_HEX_LEN], FILE *log_fp) {
+    char manifest_path[FINGERPRINT_PATH_LEN];
+    int written = snprintf(manifest_path, sizeof(manifest_path), "%s%s", args->chroot_path, PROVISION_MANIFEST_PATH);
+    if (written < 0 || (size_t)written >= sizeof(manifest_path)) {
+        fprintf(log_fp, "Error: Path too long for the provisioning manifest of %s\n", args->chroot_path);
+        return 1;
+    }
+    if (access(manifest_path, R_OK) != 0) {
+        fprintf(log_fp, "No provisioning manifest for architecture %s yet: no build fingerprint.\n", args->arch);
+        return 1;
+    }
+
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    hash_field(&ctx, "version", FINGERPRINT_VERSION, strlen(FINGERPRINT_VERSION));
+    hash_field(&ctx, "arch", args->arch, strlen(args->arch));
+    hash_field(&ctx, "sshlirp_tree", tree_fingerprint, strlen(tree_fingerprint));
+    hash_field(&ctx, "libslirp_commit", args->libslirp_commit, strlen(args->libslirp_commit));
+    if (hash_file_field(&ctx, "provision_manifest", manifest_path, log_fp) != 0 ||
+        hash_file_field(&ctx, "provision_script", PROVISION_SCRIPT_PATH, log_fp) != 0 ||
+        hash_file_field(&ctx, "compile_script", COMPILE_SCRIPT_PATH, log_fp) != 0) {
+        return 1;
+    }
+
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256_final(&ctx, digest);
+    sha256_to_hex(digest, hex);
+    return 0;
+}
+
+// Function that reads the record of the last successful build of an architecture (fingerprint of its inputs and path of its binary).
+// Returns 1 if there is no valid record
+int read_build_record(const char *fingerprints_dir, const char *arch, char fingerprint[SHA256_HEX_LEN], char *artifact, size_t artifact_len, FILE *log_fp) {
+    char record_path[FINGERPRINT_PATH_LEN];
+    snprintf(record_path, sizeof(record_path), "%s/%s", fingerprints_dir, arch);
+
+    FILE *fp = fopen(record_path, "r");
+    if (!fp) {
+        if (errno != ENOENT) {
+            fprintf(log_fp, "Warning: Failed to open the build record %s: %s\n", record_path, strerror(errno));
+        }
+        return 1;
+    }
+
+    char line[FINGERPRINT_PATH_LEN];
+    int found_fingerprint = 0, found_artifact = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "fingerprint=", 12) == 0 && strlen(line + 12) == SHA256_HEX_LEN - 1) {
+            memcpy(fingerprint, line + 12, SHA256_HEX_LEN);
+            found_fingerprint = 1;
+        } else if (strncmp(line, "artifact=", 9) == 0 && strlen(line + 9) < artifact_len) {
+            snprintf(artifact, artifact_len, "%s", line + 9);
+            found_artifact = 1;
+        }
+    }
+    fclose(fp);
+
+    return (found_fingerprint && found_artifact) ? 0 : 1;
+}
+
+// Function that records the fingerprint and the binary of a successful build. The record is replaced atomically (rename)
+int save_build_record(const char *fingerprints_dir, const char *arch, const char *fingerprint, const char *artifact, FILE *log_fp) {
+    if (mkdir(fingerprints_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(log_fp, "Error: Failed to create the build records directory %s: %s\n", fingerprints_dir, strerror(errno));
+        return 1;
+    }
+
+    char record_path[FINGERPRINT_PATH_LEN];
+    char tmp_path[FINGERPRINT_PATH_LEN];
+    snprintf(record_path, sizeof(record_path), "%s/%s", fingerprints_dir, arch);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.tmp", fingerprints_dir, arch);
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        fprintf(log_fp, "Error: Failed to write the build record %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+    fprintf(fp, "fingerprint=%s\nartifact=%s\n", fingerprint, artifact);
+    if (fclose(fp) != 0 || rename(tmp_path, record_path) != 0) {
+        fprintf(log_fp, "Error: Failed to save the build record %s: %s\n", record_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function that publishes the binary of a previous build with the same fingerprint at target_path, as a hardlink (no copy).
+// Returns 1 if the previous binary is gone or cannot be linked: the architecture must then be built
+int reuse_build_artifact(const char *artifact, const char *target_path, FILE *log_fp) {
+    struct stat artifact_st, target_st;
+    if (stat(artifact, &artifact_st) != 0 || !S_ISREG(artifact_st.st_mode)) {
+        fprintf(log_fp, "Previous binary %s not available anymore.\n", artifact);
+        return 1;
+    }
+
+    // Same release as the previous build (e.g. a round that only moved vdens): the binary is already in place
+    if (stat(target_path, &target_st) == 0 && target_st.st_dev == artifact_st.st_dev && target_st.st_ino == artifact_st.st_ino) {
+        return 0;
+    }
+
+    char tmp_path[FINGERPRINT_PATH_LEN];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.reuse-tmp", target_path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        fprintf(log_fp, "Error: Path too long: %s\n", target_path);
+        return 1;
+    }
+    unlink(tmp_path);
+    if (link(artifact, tmp_path) != 0) {
+        fprintf(log_fp, "Warning: Failed to hardlink %s to %s: %s\n", artifact, tmp_path, strerror(errno));
+        return 1;
+    }
+    if (rename(tmp_path, target_path) != 0) {
+        fprintf(log_fp, "Warning: Failed to publish %s: %s\n", target_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -3,12 +3,18 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include "init/init.h"
 #include "utils/utils.h"
+#include "sync/sync.h"
+#include "spawn/spawn.h"
 
-// Function to load architectures from the configuration file
-static void load_architectures(char** archs_list, int* num_archs_out) {
+#define REMOTE_PROBE_MAX 2                              // Remotes probed by check_new_commit (sshlirp and libslirp)
+
+// Function to load architectures from the configuration file (the list is allocated here, with one entry per architecture)
+static void load_architectures(char*** archs_list_out, int* num_archs_out) {
+    *archs_list_out = NULL;
     FILE* fp = fopen(DEFAULT_CONFIG_PATH, "r");
     if (!fp) {
         perror("Error: Error opening config file, please check the path in /src/include/types/types.h, row 6.");
@@ -16,7 +22,7 @@ static void load_architectures(char** archs_list, int* num_archs_out) {
         return;
     }
 
-    char line[MIN_CONFIG_ATTR_LEN];
+    char line[MAX_CONFIG_LINE_LEN];
     char* architectures_val_str = NULL;
     int count = 0;
 
@@ -71,6 +77,14 @@ static void load_architectures(char** archs_list, int* num_archs_out) {
     }
 
     // Second pass: populate the array
+    char** archs_list = calloc(count, sizeof(char*));
+    if (!archs_list) {
+        perror("calloc failed for the architectures list");
+        free(architectures_val_str);
+        *num_archs_out = 0;
+        return;
+    }
+    *archs_list_out = archs_list;
     token = strtok(architectures_val_str, ",");
     int current_arch = 0;
     while (token && current_arch < count) {
@@ -78,6 +92,11 @@ static void load_architectures(char** archs_list, int* num_archs_out) {
         if (!archs_list[current_arch]) {
             perror("strdup failed for an architecture token");
             free(architectures_val_str);
+            for (int i = 0; i < current_arch; i++) {
+                free(archs_list[i]);
+            }
+            free(archs_list);
+            *archs_list_out = NULL;
             *num_archs_out = 0;
             return;
         }
@@ -137,8 +156,55 @@ static void load_poll_interval(int* poll_interval) {
     *poll_interval = 0;
 }
 
+// Function to load the number of builds run at the same time by the worker pool (optional, DEFAULT_MAX_PARALLEL_BUILDS if missing)
+static void load_max_parallel_builds(int* max_parallel_builds) {
+    *max_parallel_builds = DEFAULT_MAX_PARALLEL_BUILDS;
+
+    FILE* fp = fopen(DEFAULT_CONFIG_PATH, "r");
+    if (!fp) {
+        return;
+    }
+
+    char line[CONFIG_ATTR_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, CONFIG_MAX_PARALLEL_BUILDS_KEY, strlen(CONFIG_MAX_PARALLEL_BUILDS_KEY)) == 0) {
+            int value = atoi(line + strlen(CONFIG_MAX_PARALLEL_BUILDS_KEY));
+            if (value > 0) {
+                *max_parallel_builds = value;
+            }
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+// Function to load the port of the local webhook listener (optional, 0 if missing: the webhook listener is disabled)
+static void load_webhook_port(int* webhook_port) {
+    *webhook_port = 0;
+
+    FILE* fp = fopen(DEFAULT_CONFIG_PATH, "r");
+    if (!fp) {
+        return;
+    }
+
+    char line[CONFIG_ATTR_LEN];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, CONFIG_WEBHOOK_PORT_KEY, strlen(CONFIG_WEBHOOK_PORT_KEY)) == 0) {
+            int value = atoi(line + strlen(CONFIG_WEBHOOK_PORT_KEY));
+            if (value > 0 && value <= 65535) {
+                *webhook_port = value;
+            }
+            break;
+        }
+    }
+    fclose(fp);
+}
+
 // Function to free the memory allocated for the list of architectures
 static void free_architectures(char** archs_list, int num_archs) {
+    if (!archs_list) {
+        return;
+    }
     for (int i = 0; i < num_archs; i++) {
         free(archs_list[i]);
     }
@@ -154,7 +220,8 @@ static void free_resources(
     char* vdens_repo_url,
     char* main_dir,
     char* target_dir,
-    char* log_file) {
+    char* log_file,
+    char* debian_mirror) {
     
     free_architectures(archs, *num_archs);
     free(sshlirp_repo_url);
@@ -163,68 +230,81 @@ static void free_resources(
     free(main_dir);
     free(target_dir);
     free(log_file);
+    free(debian_mirror);
 }
 
 // Function to load configuration variables
 int conf_vars_loader(
-    char** archs, 
-    int* num_archs, 
+    char*** archs_list,
+    int* num_archs,
     char* sshlirp_repo_url, 
     char* libslirp_repo_url, 
     char* vdens_repo_url,
     char* main_dir,
     char* target_dir,
     char* log_file,
-    int* poll_interval) {
+    char* debian_mirror,
+    int* poll_interval,
+    int* max_parallel_builds,
+    int* webhook_port) {
 
-        load_architectures(archs, num_archs);
+        load_architectures(archs_list, num_archs);
+        char** archs = *archs_list;
         if (*num_archs == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "No architectures found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_SSHLIRP_KEY, sshlirp_repo_url);
         if (strlen(sshlirp_repo_url) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "SSHLIRP_REPO_URL not found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_LIBSLIRP_KEY, libslirp_repo_url);
         if (strlen(libslirp_repo_url) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "LIBSLIRP_REPO_URL not found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_MAINDIR_KEY, main_dir);
         if (strlen(main_dir) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "MAINDIR not found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_TARGETDIR_KEY, target_dir);
         if (strlen(target_dir) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "TARGET_DIR not found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_VDENS_REPO_URL_KEY, vdens_repo_url);
         if (strlen(vdens_repo_url) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "VDENS_REPO_URL not found in configuration.\n");
             return 1;
         }
         load_path(CONFIG_LOG_KEY, log_file);
         if (strlen(log_file) == 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "LOG_FILE not found in configuration.\n");
             return 1;
         }
+        // Optional: the Debian mirror used by debootstrap (e.g. a local file:// mirror), deb.debian.org by default
+        load_path(CONFIG_DEBIAN_MIRROR_KEY, debian_mirror);
+        if (strlen(debian_mirror) == 0) {
+            strncpy(debian_mirror, DEFAULT_DEBIAN_MIRROR, MIN_CONFIG_ATTR_LEN - 1);
+            debian_mirror[MIN_CONFIG_ATTR_LEN - 1] = '\0';
+        }
         load_poll_interval(poll_interval);
         if (*poll_interval <= 0) {
-            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file);
+            free_resources(archs, num_archs, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, main_dir, target_dir, log_file, debian_mirror);
             fprintf(stderr, "POLL_INTERVAL not found or invalid in configuration.\n");
             return 1;
         }
+        load_max_parallel_builds(max_parallel_builds);
+        load_webhook_port(webhook_port);
         return 0;
     }
 
@@ -252,6 +332,28 @@ static int get_last_release(const char* versioning_file, commit_status_t* result
     return 0;
 }
 
+// Function that records in result the commits checked out in the host repositories: the builds of the round are pinned to them
+static int record_commits(commit_status_t* result, const char* sshlirp_source_dir, const char* libslirp_source_dir, const char* vdens_source_dir, FILE* log_fp) {
+    if (read_head_commit(sshlirp_source_dir, result->sshlirp_commit, sizeof(result->sshlirp_commit), log_fp) != 0 ||
+        read_head_commit(libslirp_source_dir, result->libslirp_commit, sizeof(result->libslirp_commit), log_fp) != 0) {
+        fprintf(log_fp, "Error: Error reading the commits checked out in the host repositories.\n");
+        return 1;
+    }
+    fprintf(log_fp, "Commits recorded: sshlirp %s, libslirp %s.\n", result->sshlirp_commit, result->libslirp_commit);
+
+#ifdef TEST_ENABLED
+    if (read_head_commit(vdens_source_dir, result->vdens_commit, sizeof(result->vdens_commit), log_fp) != 0) {
+        fprintf(log_fp, "Error: Error reading the commit checked out in the vdens repository.\n");
+        return 1;
+    }
+    fprintf(log_fp, "Commit recorded: vdens %s.\n", result->vdens_commit);
+#else
+    (void)vdens_source_dir;
+#endif
+
+    return 0;
+}
+
 // Function to check if host directories exist or create them and clone repositories
 // Note: this function launches a script and based on its return values, can return the following values:
 // 1: error
@@ -262,15 +364,13 @@ commit_status_t check_host_dirs(
     char* sshlirp_source_dir, 
     char* libslirp_source_dir, 
     char* vdens_source_dir,
-    char* log_file, 
     char* sshlirp_repo_url, 
     char* libslirp_repo_url, 
     char* vdens_repo_url,
-    char* thread_log_dir, 
     FILE* log_fp, 
     char* versioning_file
 ) {
-    commit_status_t result = {1, NULL};
+    commit_status_t result = {1, NULL, "", "", ""};
     // 1. Check for existence and, if necessary, create the directories and the log file on the host machine
 
     // ex: /home/sshlirpCI/thread-binaries
@@ -307,41 +407,19 @@ commit_status_t check_host_dirs(
     }
 #endif
 
-    // ex: /home/sshlirpCI/log/threads (I'm sure the log directory already exists, created in main.c)
-    if (access(thread_log_dir, F_OK) == -1) {
-        if (mkdir(thread_log_dir, 0755) == -1) {
-            fprintf(log_fp, "Error: Error creating thread log directory: %s\n", strerror(errno));
-            return result;
-        }
-    }
-
     // 2. Clone the repos in their respective paths -> launch the embedded gitClone.sh script
     int script_status;
 
-    script_status = execute_script(
-        GIT_CLONE_SCRIPT_PATH,
-        sshlirp_repo_url, 
-        sshlirp_source_dir, 
-        log_file, 
-        NULL, 
-        NULL, 
-        versioning_file, 
-        log_fp);
+    const char* sshlirp_clone_argv[] = {GIT_CLONE_SCRIPT_PATH, sshlirp_repo_url, sshlirp_source_dir, versioning_file, NULL};
+    script_status = execute_script(sshlirp_clone_argv, log_fp);
     if (script_status == 1) {
         fprintf(log_fp, "Error: Error cloning sshlirp repository via embedded script. Script exit status: %d\n", script_status);
         return result;
     }
 
     // Note: in the case of git clone of libslirp I don't pass the versioning_file, because otherwise the script would write the latest version of libslirp to it
-    script_status = execute_script(
-        GIT_CLONE_SCRIPT_PATH,
-        libslirp_repo_url, 
-        libslirp_source_dir, 
-        log_file, 
-        NULL, 
-        NULL, 
-        "", 
-        log_fp);
+    const char* libslirp_clone_argv[] = {GIT_CLONE_SCRIPT_PATH, libslirp_repo_url, libslirp_source_dir, NULL};
+    script_status = execute_script(libslirp_clone_argv, log_fp);
     if (script_status == 1) {
         fprintf(log_fp, "Error: Error cloning libslirp repository via embedded script. Script exit status: %d\n", script_status);
         return result;
@@ -349,15 +427,8 @@ commit_status_t check_host_dirs(
 
 #ifdef TEST_ENABLED
     // Clone the vdens repo only if testing is enabled and I don't pass the versioning file
-    script_status = execute_script(
-        GIT_CLONE_SCRIPT_PATH,
-        vdens_repo_url, 
-        vdens_source_dir, 
-        log_file, 
-        NULL, 
-        NULL, 
-        "", 
-        log_fp);
+    const char* vdens_clone_argv[] = {GIT_CLONE_SCRIPT_PATH, vdens_repo_url, vdens_source_dir, NULL};
+    script_status = execute_script(vdens_clone_argv, log_fp);
     if (script_status == 1) {
         fprintf(log_fp, "Error: Error cloning vdens repository via embedded script. Script exit status: %d\n", script_status);
         return result;
@@ -369,26 +440,102 @@ commit_status_t check_host_dirs(
         return result;
     }
 
+    if (record_commits(&result, sshlirp_source_dir, libslirp_source_dir, vdens_source_dir, log_fp) != 0) {
+        return result;
+    }
+
     result.status = script_status;
     return result;
 }
 
-// Function to check for (and possibly pull) new commits in the sshlirp repo from the remote repo
+// Function that reads the commit of HEAD from the output of git ls-remote ("<id>\tHEAD"; anything else git printed is skipped)
+static int parse_remote_head(char* output, char* commit, size_t commit_len) {
+    for (char* line = strtok(output, "\n"); line; line = strtok(NULL, "\n")) {
+        char* tab = strchr(line, '\t');
+        if (!tab || strcmp(tab + 1, "HEAD") != 0) {
+            continue;
+        }
+        size_t id_len = (size_t)(tab - line);
+        if ((id_len == 40 || id_len == 64) && id_len < commit_len && strspn(line, "0123456789abcdef") == id_len) {
+            memcpy(commit, line, id_len);
+            commit[id_len] = '\0';
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function that asks the remotes for the commit of their HEAD with git ls-remote (only the ref advertisement: one round-trip and nothing
+// written to disk). The remotes are all probed at the same time, so the probe costs the slowest round-trip, not their sum
+static int probe_remote_heads(const char* const urls[], char heads[][GIT_COMMIT_ID_LEN], int num_remotes, FILE* log_fp) {
+    spawned_process_t children[REMOTE_PROBE_MAX];
+    int started[REMOTE_PROBE_MAX] = {0};
+    int result = 0;
+
+    for (int i = 0; i < num_remotes; i++) {
+        const char* argv[] = {"git", "ls-remote", "--quiet", urls[i], "HEAD", NULL};
+        started[i] = spawn_process(argv, &children[i], log_fp) == 0;
+        if (!started[i]) {
+            result = 1;
+        }
+    }
+
+    for (int i = 0; i < num_remotes; i++) {
+        if (!started[i]) {
+            continue;
+        }
+        char* output = NULL;
+        size_t output_len = 0;
+        FILE* output_fp = open_memstream(&output, &output_len);
+        spawn_status_t status = {0};
+        int wait_result = spawn_wait(&children[i], output_fp ? output_fp : log_fp, &status, log_fp);
+        if (output_fp) {
+            fclose(output_fp);
+        }
+
+        if (wait_result != 0 || !status.exited || status.exit_code != 0 || !output || parse_remote_head(output, heads[i], GIT_COMMIT_ID_LEN) != 0) {
+            fprintf(log_fp, "Error: Failed to read the HEAD of %s with git ls-remote (exit status %d).\n", urls[i], status.exited ? status.exit_code : -1);
+            if (output && output_len > 0) {
+                fprintf(log_fp, "Output from git ls-remote: %s\n", output);
+            }
+            result = 1;
+        }
+        free(output);
+    }
+    return result;
+}
+
+// Function to check for (and possibly pull) new commits in the sshlirp repo from the remote repo.
+// The HEADs of the sshlirp and libslirp remotes are probed first (see probe_remote_heads): only if the one of sshlirp has moved the script
+// fetches the probed commits (and nothing else) and checks them out, so a poll that finds nothing new does not touch the repositories
 // Note: this function calls a script and, similarly to the check_host_dirs function, can return the following values:
 // 1: error
 // 0: no new commits were found, the repo is already up to date
 // 2: new commits were found, the repo has been updated
-commit_status_t check_new_commit(char* sshlirp_source_dir, char* sshlirp_repo_url, char* libslirp_source_dir, char* libslirp_repo_url, char* log_file, FILE* log_fp, char* versioning_file) {
-    commit_status_t result = {1, NULL};
-    int script_status = execute_script(
-        CHECK_COMMIT_SCRIPT_PATH,
-        sshlirp_source_dir, 
-        sshlirp_repo_url, 
-        libslirp_source_dir, 
-        libslirp_repo_url, 
-        log_file, 
-        versioning_file, 
-        log_fp);
+commit_status_t check_new_commit(char* sshlirp_source_dir, char* sshlirp_repo_url, char* libslirp_source_dir, char* libslirp_repo_url, char* vdens_source_dir, FILE* log_fp, char* versioning_file) {
+    commit_status_t result = {1, NULL, "", "", ""};
+
+    char local_head[GIT_COMMIT_ID_LEN];
+    if (read_head_commit(sshlirp_source_dir, local_head, sizeof(local_head), log_fp) != 0) {
+        return result;
+    }
+
+    const char* urls[] = {sshlirp_repo_url, libslirp_repo_url};
+    char remote_heads[2][GIT_COMMIT_ID_LEN];
+    if (probe_remote_heads(urls, remote_heads, 2, log_fp) != 0) {
+        fprintf(log_fp, "Error: Error checking the remote repositories for new commits.\n");
+        return result;
+    }
+
+    if (strcmp(local_head, remote_heads[0]) == 0) {
+        fprintf(log_fp, "No new commits found for sshlirp (HEAD %.12s).\n", local_head);
+        result.status = 0;
+        return result;
+    }
+    fprintf(log_fp, "HEAD of sshlirp moved from %.12s to %.12s (libslirp %.12s), fetching...\n", local_head, remote_heads[0], remote_heads[1]);
+
+    const char* argv[] = {CHECK_COMMIT_SCRIPT_PATH, sshlirp_source_dir, remote_heads[0], libslirp_source_dir, remote_heads[1], versioning_file, NULL};
+    int script_status = execute_script(argv, log_fp);
 
     if (script_status == 1) {
         fprintf(log_fp, "Error: Error checking for new commits. Script exit status: %d\n", script_status);
@@ -403,6 +550,11 @@ commit_status_t check_new_commit(char* sshlirp_source_dir, char* sshlirp_repo_ur
             return result;
         }
 
+        // The commits just pulled are the ones the build of this round will export (see export_source_snapshots)
+        if (record_commits(&result, sshlirp_source_dir, libslirp_source_dir, vdens_source_dir, log_fp) != 0) {
+            return result;
+        }
+
         result.status = script_status;
         return result;
     }
@@ -415,4 +567,117 @@ commit_status_t check_new_commit(char* sshlirp_source_dir, char* sshlirp_repo_ur
 
     fprintf(log_fp, "Unexpected commit check status from script: %d\n", script_status);
     return result;
-}
\ No newline at end of file
+}
+
+// Function that reads the release and the commits checked out in the host repositories, to build them again (see REBUILD_MARKER_NAME).
+// Returns status 2 (commits to build) on success, 1 on errors
+commit_status_t read_checked_out_commits(char* sshlirp_source_dir, char* libslirp_source_dir, char* vdens_source_dir, FILE* log_fp, char* versioning_file) {
+    commit_status_t result = {1, NULL, "", "", ""};
+    if (get_last_release(versioning_file, &result, log_fp) != 0 ||
+        record_commits(&result, sshlirp_source_dir, libslirp_source_dir, vdens_source_dir, log_fp) != 0) {
+        return result;
+    }
+    result.status = 2;
+    return result;
+}
+
+// Function that exports one repository at the given commit into its snapshot (<snapshots_dir>/<repo name>-<commit>) and returns its path
+static int export_snapshot(
+    const char* repo_dir,
+    const char* commit,
+    const char* snapshots_dir,
+    const char* patch_script,
+    FILE* log_fp,
+    char* snapshot_dir,
+    size_t snapshot_dir_len
+) {
+    // The patch script is an optional last argument
+    const char* argv[] = {EXPORT_SNAPSHOT_SCRIPT_PATH, repo_dir, commit, snapshots_dir, patch_script, NULL};
+    int script_status = execute_script(argv, log_fp);
+    if (script_status != 0 && script_status != 2) {
+        fprintf(log_fp, "Error: Error exporting %s at commit %s via embedded script. Script exit status: %d\n", repo_dir, commit, script_status);
+        return 1;
+    }
+
+    const char* repo_name = strrchr(repo_dir, '/');
+    repo_name = repo_name ? repo_name + 1 : repo_dir;
+    snprintf(snapshot_dir, snapshot_dir_len, "%s/%s-%s", snapshots_dir, repo_name, commit);
+    return 0;
+}
+
+// Function that exports the trees of the recorded commits (no history, no edits of the working trees) into immutable snapshots,
+// which all the build threads then sync into their sources in parallel. The vdens patch (modifyVdens.sh) is applied to its snapshot
+// before it is published. A snapshot already exported for the same commit is reused
+int export_source_snapshots(
+    const commit_status_t* commits,
+    char* sshlirp_source_dir,
+    char* libslirp_source_dir,
+    char* vdens_source_dir,
+    char* snapshots_dir,
+    FILE* log_fp,
+    char* sshlirp_snapshot_dir,
+    char* libslirp_snapshot_dir,
+    char* vdens_snapshot_dir,
+    size_t snapshot_dir_len
+) {
+    if (access(snapshots_dir, F_OK) == -1) {
+        if (mkdir(snapshots_dir, 0755) == -1) {
+            fprintf(log_fp, "Error: Error creating snapshots directory %s: %s\n", snapshots_dir, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (export_snapshot(sshlirp_source_dir, commits->sshlirp_commit, snapshots_dir, NULL, log_fp, sshlirp_snapshot_dir, snapshot_dir_len) != 0) {
+        return 1;
+    }
+    if (export_snapshot(libslirp_source_dir, commits->libslirp_commit, snapshots_dir, NULL, log_fp, libslirp_snapshot_dir, snapshot_dir_len) != 0) {
+        return 1;
+    }
+
+#ifdef TEST_ENABLED
+    if (export_snapshot(vdens_source_dir, commits->vdens_commit, snapshots_dir, MODIFY_VDENS_SCRIPT_PATH, log_fp, vdens_snapshot_dir, snapshot_dir_len) != 0) {
+        return 1;
+    }
+#else
+    (void)vdens_source_dir;
+    vdens_snapshot_dir[0] = '\0';
+#endif
+
+    return 0;
+}
+
+// Function that removes the snapshots (and the leftovers of interrupted exports) not listed in keep_dirs: the pipelines of the
+// architectures build different commits at the same time, so a snapshot is only removed once no pipeline is building it
+int prune_source_snapshots(const char* snapshots_dir, const char* const* keep_dirs, int num_keep_dirs, FILE* log_fp) {
+    DIR* dir = opendir(snapshots_dir);
+    if (!dir) {
+        return errno == ENOENT ? 0 : 1;
+    }
+
+    int status = 0;
+    struct dirent* entry;
+    char snapshot_path[MAX_CONFIG_ATTR_LEN];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name) >= (int)sizeof(snapshot_path)) {
+            continue;
+        }
+
+        int in_use = 0;
+        for (int i = 0; i < num_keep_dirs && !in_use; i++) {
+            in_use = keep_dirs[i] && strcmp(keep_dirs[i], snapshot_path) == 0;
+        }
+        if (in_use) {
+            continue;
+        }
+
+        fprintf(log_fp, "Removing the snapshot %s (no build uses it anymore).\n", snapshot_path);
+        if (remove_tree(snapshot_path, log_fp) != 0) {
+            status = 1;
+        }
+    }
+    closedir(dir);
+    return status;
+}
@@ -8,200 +8,184 @@
 #include <time.h>
 #include "init/worker_init.h"
 #include "utils/utils.h"
+#include "sync/sync.h"
+#include "sched/scheduler.h"
 
-// Function to configure the chroot for the thread (creates the chroot directory, executes the chroot setup script)
-int setup_chroot(thread_args_t* args, FILE* thread_log_fp) {
-
-    // Execute the chroot setup script
-    int script_status = execute_script_for_thread(
-        args->arch,
+// Function that runs one of the two debootstrap stages through the chroot setup script
+static int run_chroot_setup_stage(thread_args_t* args, const char* stage, stage_result_t* accounting, FILE* thread_log_fp) {
+    const char* argv[] = {
         CHROOT_SETUP_SCRIPT_PATH,
         args->arch,
         args->chroot_path,
-        args->thread_log_file,
-        ROOTLESS_DEBOOTSTRAP_PATH,  
-        NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
+        ROOTLESS_DEBOOTSTRAP_PATH,
+        args->sudo_user ? "1" : "0",
+        stage,
+        args->rootfs_cache_dir,
+        args->deb_cache_dir,
+        args->debian_mirror,
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, accounting, thread_log_fp);
 
     if (script_status != 0) {
-        fprintf(thread_log_fp, "[Thread %s] Chroot setup script failed with status: %d\n", args->arch, script_status);
+        fprintf(thread_log_fp, "[Thread %s] Chroot setup script (%s stage) failed with status: %d\n", args->arch, stage, script_status);
         return 1;
     }
 
     return 0;
 }
 
-// Function that checks (and if necessary creates) the worker's directories inside the chroot and its log files (inside and outside the chroot):
-// - thread_chroot_main_dir: main directory of the thread inside the chroot (e.g. <path2chroot>/home/sshlirpCI/)
-// - thread_chroot_sshlirp_dir: sshlirp directory inside the chroot (e.g. <path2chroot>/home/sshlirpCI/sshlirp)
-// - thread_chroot_libslirp_dir: libslirp directory inside the chroot (e.g. <path2chroot>/home/sshlirpCI/libslirp)
-// - thread_chroot_target_dir: destination directory for compiled binaries inside the chroot (e.g. <path2chroot>/home/sshlirpCI/thread-binaries)
-// - getparent(thread_chroot_log_file): log directory of the thread inside the chroot (e.g. <path2chroot>/home/sshlirpCI/log)
-// - thread_chroot_log_file: log file of the thread inside the chroot (e.g. <path2chroot>/home/sshlirpCI/log/thread_sshlirp.log)
-int check_worker_dirs(thread_args_t* args, FILE* thread_log_fp) {
-    // ex: <path2chroot>/home/sshlirpCI/
+// Function that runs the first debootstrap stage (--foreign): download and unpack of the packages, network and I/O bound.
+// It does nothing if the rootfs (or its first stage) is already present, and it restores the whole rootfs from the base rootfs cache
+// (MAIN_DIR/rootfs-cache) when a tarball for the same suite, architecture and package set was saved by a previous setup
+int setup_chroot_first_stage(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    return run_chroot_setup_stage(args, "first", accounting, thread_log_fp);
+}
+
+// Function that runs the second debootstrap stage (--second-stage) through _enter: configuration of the packages, CPU bound
+// and emulated by qemu for the foreign architectures. It does nothing if the rootfs is already complete, otherwise at the end
+// it saves the new rootfs in the base rootfs cache
+int setup_chroot_second_stage(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    return run_chroot_setup_stage(args, "second", accounting, thread_log_fp);
+}
+
+// Function that checks (and if necessary creates) the worker's directories inside the build layer.
+// Note: they are created in the upper directory of the layer (build_root), so they appear at the same paths in the chroot once entered:
+// - thread_chroot_main_dir: main directory of the thread inside the chroot (e.g. <build_root>/home/sshlirpCI/)
+// - thread_chroot_sshlirp_dir: sshlirp directory inside the chroot (e.g. <build_root>/home/sshlirpCI/sshlirp)
+// - thread_chroot_libslirp_dir: libslirp directory inside the chroot (e.g. <build_root>/home/sshlirpCI/libslirp)
+// - thread_chroot_target_dir: destination directory for compiled binaries inside the chroot (e.g. <build_root>/home/sshlirpCI/thread-binaries)
+int check_worker_dirs(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    (void)accounting;   // Only mkdir, no scripts to account for
+    // ex: <build_root>/home/sshlirpCI/
     char path_buffer[1024];
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, args->thread_chroot_main_dir);
+    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->build_root_path, args->thread_chroot_main_dir);
     if(access(path_buffer, F_OK) == -1) {
         if (mkdir(path_buffer, 0755) == -1) {
             fprintf(thread_log_fp, "[Thread %s] Failed to create main directory (%s) inside chroot: %s\n", args->arch, path_buffer, strerror(errno));
             return 1;
         }
     }
-    // ex: <path2chroot>/home/sshlirpCI/sshlirp
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, args->thread_chroot_sshlirp_dir);
+    // ex: <build_root>/home/sshlirpCI/sshlirp
+    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->build_root_path, args->thread_chroot_sshlirp_dir);
     if(access(path_buffer, F_OK) == -1) {
         if (mkdir(path_buffer, 0755) == -1) {
             fprintf(thread_log_fp, "[Thread %s] Failed to create sshlirp directory inside chroot: %s\n", args->arch, strerror(errno));
             return 1;
         }
     }
-    // ex: <path2chroot>/home/sshlirpCI/libslirp
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, args->thread_chroot_libslirp_dir);
+    // ex: <build_root>/home/sshlirpCI/libslirp
+    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->build_root_path, args->thread_chroot_libslirp_dir);
     if(access(path_buffer, F_OK) == -1) {
         if (mkdir(path_buffer, 0755) == -1) {
             fprintf(thread_log_fp, "[Thread %s] Failed to create libslirp directory inside chroot: %s\n", args->arch, strerror(errno));
             return 1;
         }
     }
-    // ex: <path2chroot>/home/sshlirpCI/thread_binaries
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, args->thread_chroot_target_dir);
+    // ex: <build_root>/home/sshlirpCI/thread_binaries
+    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->build_root_path, args->thread_chroot_target_dir);
     if(access(path_buffer, F_OK) == -1) {
         if (mkdir(path_buffer, 0755) == -1) {
             fprintf(thread_log_fp, "[Thread %s] Failed to create target directory inside chroot: %s\n", args->arch, strerror(errno));
             return 1;
         }
     }
-    // ex: <path2chroot>/home/sshlirpCI/log
-    char* log_parent_dir_rel = get_parent_dir(args->thread_chroot_log_file);
-    if (!log_parent_dir_rel) {
-        fprintf(thread_log_fp, "[Thread %s] Failed to get parent directory for chroot log file\n", args->arch);
-        return 1;
-    }
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, log_parent_dir_rel);
-    free(log_parent_dir_rel);
+    return 0;
+}
 
-    if(access(path_buffer, F_OK) == -1) {
-        if (mkdir(path_buffer, 0755) == -1) {
-            fprintf(thread_log_fp, "[Thread %s] Failed to create log directory inside chroot: %s\n", args->arch, strerror(errno));
-            return 1;
-        }
-    }
+// Function that installs the toolchain and the build (and test) dependencies into the chroot, downloading only the packages that are not
+// already in the shared package cache (MAIN_DIR/deb-cache). The provision script records a manifest of
+// the installed packages inside the chroot and repeats the apt work only when the dependency list or the suite change, so on most rounds
+// it returns immediately without even entering the chroot
+int provision_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    const char* argv[] = {
+        PROVISION_SCRIPT_PATH,
+        args->chroot_path,
+        args->arch,
+#ifdef TEST_ENABLED
+        "1",
+#else
+        "0",
+#endif
+        args->deb_cache_dir,
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, accounting, thread_log_fp);
 
-    // ex: <path2chroot>/home/sshlirpCI/log/thread_sshlirp.log
-    snprintf(path_buffer, sizeof(path_buffer), "%s%s", args->chroot_path, args->thread_chroot_log_file);
-    FILE* thread_chroot_log_fp = fopen(path_buffer, "a");
-    if (!thread_chroot_log_fp) {
-        fprintf(thread_log_fp, "[Thread %s] Failed to open thread log file inside chroot %s: %s\n", args->arch, path_buffer, strerror(errno));
+    if (script_status != 0) {
+        fprintf(thread_log_fp, "[Thread %s] Provision script failed with status: %d\n", args->arch, script_status);
         return 1;
     }
-    fclose(thread_chroot_log_fp);
 
     return 0;
 }
 
-// Function that copies the sshlirp and libslirp sources into the chroot from the host directories
-int copy_sources_to_chroot(thread_args_t* args, FILE* thread_log_fp) {
-    // Execute the script to copy sources into the chroot (I don't perform the actual chroot yet) for sshlirp
-    int script_status = execute_script_for_thread(
-        args->arch,
-        COPY_SOURCE_SCRIPT_PATH,
-        args->sshlirp_host_source_dir,
-        args->chroot_path,
-        args->thread_chroot_sshlirp_dir,
-        args->thread_log_file,
-        NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
+// Function that synchronizes one host source tree into the synced sources tree of the thread, logging what the sync had to do
+// (the bytes copied are the bytes written by the stage)
+static int sync_source_tree(thread_args_t* args, const char* host_src_dir, const char* thread_chroot_dir, stage_result_t* accounting, FILE* thread_log_fp) {
+    char dst_dir[MAX_CONFIG_ATTR_LEN*2];
+    snprintf(dst_dir, sizeof(dst_dir), "%s%s", args->sources_root_path, thread_chroot_dir);
 
-    if (script_status != 0) {
-        fprintf(thread_log_fp, "[Thread %s] Copy sources script failed for sshlirp with status: %d\n", args->arch, script_status);
+    sync_stats_t stats;
+    if (sync_tree(host_src_dir, dst_dir, &stats, thread_log_fp) != 0) {
+        fprintf(thread_log_fp, "[Thread %s] Failed to sync %s into %s\n", args->arch, host_src_dir, dst_dir);
         return 1;
     }
 
-    // Now for libslirp
-    script_status = execute_script_for_thread(
-        args->arch,
-        COPY_SOURCE_SCRIPT_PATH,
-        args->libslirp_host_source_dir,
-        args->chroot_path,
-        args->thread_chroot_libslirp_dir,
-        args->thread_log_file,
-        NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
+    fprintf(thread_log_fp, "[Thread %s] Synced %s into %s: %ld unchanged, %ld hardlinked, %ld reflinked, %ld copied (%lld bytes), %ld removed.\n",
+            args->arch, host_src_dir, dst_dir, stats.files_unchanged, stats.files_linked, stats.files_cloned, stats.files_copied,
+            stats.bytes_copied, stats.entries_removed);
+    accounting->bytes_written += stats.bytes_copied;
+    return 0;
+}
 
-    if (script_status != 0) {
-        fprintf(thread_log_fp, "[Thread %s] Copy sources script failed for libslirp with status: %d\n", args->arch, script_status);
+// Function that brings the sshlirp and libslirp (and vdens, if testing is enabled) sources of the chroot up to date with the snapshots of the
+// commits to build (exported once by the main, see export_source_snapshots). The sources live in a persistent tree (sources_root_path)
+// mounted as a lower layer of the build overlay, so they stay in place between rounds and each sync only writes the files changed by the
+// new commits (see sync_tree)
+int copy_sources_to_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    if (sync_source_tree(args, args->sshlirp_snapshot_dir, args->thread_chroot_sshlirp_dir, accounting, thread_log_fp) != 0) {
         return 1;
     }
 
-    // If testing is enabled, also copy vdens, modifying it on the host first
-#ifdef TEST_ENABLED
-    
-    char vdens_c_path[MAX_CONFIG_ATTR_LEN + 10];
-
-    snprintf(vdens_c_path, sizeof(vdens_c_path), "%s/vdens.c", args->vdens_host_source_dir);
-    fprintf(thread_log_fp, "Modifying file %s to disable namespaces...\n", vdens_c_path);
-
-    // Execute the script to modify the vdens.c file to disable namespaces (they cause errors in the chroot)
-    script_status = execute_script_for_thread(
-        args->arch,
-        MODIFY_VDENS_SCRIPT_PATH,
-        vdens_c_path, 
-        args->thread_log_file, 
-        NULL, NULL, NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
-
-    if (script_status != 0) {
-        fprintf(thread_log_fp, "Error: Error modifying vdens.c file in %s. Script exit status: %d\n", vdens_c_path, script_status);
+    if (sync_source_tree(args, args->libslirp_snapshot_dir, args->thread_chroot_libslirp_dir, accounting, thread_log_fp) != 0) {
         return 1;
     }
 
-    // Execute the copy script
-    script_status = execute_script_for_thread(
-        args->arch,
-        COPY_SOURCE_SCRIPT_PATH,
-        args->vdens_host_source_dir,
-        args->chroot_path,
-        args->thread_chroot_vdens_dir,
-        args->thread_log_file,
-        NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
-
-    if (script_status != 0) {
-        fprintf(thread_log_fp, "[Thread %s] Copy sources script failed for vdens with status: %d\n", args->arch, script_status);
+    // If testing is enabled, also sync vdens (its snapshot has already been patched to disable namespaces, which cause errors in the chroot)
+#ifdef TEST_ENABLED
+    if (sync_source_tree(args, args->vdens_snapshot_dir, args->thread_chroot_vdens_dir, accounting, thread_log_fp) != 0) {
         return 1;
     }
-
 #endif
 
     return 0;
 }
 
 // Function that compiles and verifies the sshlirp sources inside the chroot (when I run the script I will actually enter the chroot)
-int compile_and_verify_in_chroot(thread_args_t* args, FILE* thread_log_fp) {
+int compile_and_verify_in_chroot(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    // Register the compilation in the scheduler: the CPU tokens not held by the other stages are split among the compilations in flight,
+    // and compile.sh reads its share (make/ninja jobs) from the jobs file in the workspace, which the scheduler updates when stages start or end
+    compile_slot_t slot;
+    snprintf(slot.jobs_file, sizeof(slot.jobs_file), "%s/%s", args->workspace_dir, BUILD_JOBS_FILE);
+    int jobs = scheduler_compile_begin(args->scheduler, &slot, accounting->cpu_tokens, thread_log_fp);
+    fprintf(thread_log_fp, "[Thread %s] Compiling with %d parallel jobs.\n", args->arch, jobs);
+
     // Execute the compilation script inside the chroot
-    int script_status = execute_script_for_thread(
-        args->arch,
+    const char* argv[] = {
         COMPILE_SCRIPT_PATH,
-        args->chroot_path,
+        args->build_root_path,
         args->thread_chroot_sshlirp_dir,
         args->thread_chroot_libslirp_dir,
         args->thread_chroot_target_dir,
         args->arch,
-        args->thread_chroot_log_file,
-        args->sudo_user,
-        thread_log_fp
-    );
+        args->thread_chroot_workspace_dir,
+        args->libslirp_commit,
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, accounting, thread_log_fp);
+
+    scheduler_compile_end(args->scheduler, &slot, thread_log_fp);
 
     if (script_status != 0) {
         fprintf(thread_log_fp, "[Thread %s] Compile script failed with status: %d\n", args->arch, script_status);
@@ -211,25 +195,53 @@ int compile_and_verify_in_chroot(thread_args_t* args, FILE* thread_log_fp) {
     return 0;
 }
 
-int remove_sources_copy_from_chroot(thread_args_t* args, FILE* thread_log_fp) {
-    // Execute the script to remove sources inside the chroot
-    int script_status = execute_script_for_thread(
-        args->arch,
-        REMOVE_SOURCE_SCRIPT_PATH,
+// Function that creates the throwaway copy-on-write layer of this build (build_dir) over the base chroot, discarding the layer of the previous build.
+// From now on the build scripts work on build_root_path: the host-side writes (sources copy, worker directories, test setup) go to the upper
+// directory of the layer, while the _enter of the layer mounts the overlay inside its own mount namespace, so the base chroot is never modified
+// and creating the layer only costs a few mkdir
+int create_build_layer(thread_args_t* args, stage_result_t* accounting, FILE* thread_log_fp) {
+    const char* argv[] = {
+        BUILD_LAYER_SCRIPT_PATH,
+        "create",
         args->chroot_path,
-        args->thread_chroot_sshlirp_dir,
-        args->thread_chroot_libslirp_dir,
-        args->thread_log_file,
-        NULL, NULL,
-        args->sudo_user,
-        thread_log_fp
-    );
+        args->sources_root_path,
+        args->build_dir,
+        args->workspace_dir,
+        args->thread_chroot_workspace_dir,
+        args->sudo_user ? "1" : "0",
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, accounting, thread_log_fp);
 
     if (script_status != 0) {
-        fprintf(thread_log_fp, "[Thread %s] Remove sources script failed with status: %d\n", args->arch, script_status);
+        fprintf(thread_log_fp, "[Thread %s] Build layer script (create) failed with status: %d\n", args->arch, script_status);
         return 1;
     }
 
     return 0;
 }
 
+// Function that discards the layer of the build: the overlay was already unmounted together with its mount namespace,
+// so everything the build wrote (installed libraries, binaries, test files) goes away with the layer directory. The build trees and the compiler
+// cache are in the workspace of the architecture (workspace_dir), which is only bind-mounted in the layer and is kept
+int discard_build_layer(thread_args_t* args, FILE* log_fp) {
+    const char* argv[] = {
+        BUILD_LAYER_SCRIPT_PATH,
+        "discard",
+        args->chroot_path,
+        args->sources_root_path,
+        args->build_dir,
+        args->workspace_dir,
+        args->thread_chroot_workspace_dir,
+        args->sudo_user ? "1" : "0",
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, NULL, log_fp);
+
+    if (script_status != 0) {
+        fprintf(log_fp, "[Thread %s] Build layer script (discard) failed with status: %d\n", args->arch, script_status);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include "logmux/logmux.h"
+
+// Stream of one stage of a build: its lines become records of the main log, prefixed with the tag "[arch:stage] "
+typedef struct {
+    log_mux_t *mux;
+    char tag[LOG_MUX_TAG_LEN];
+    size_t tag_len;
+    char line[SPAWN_LINE_LEN];                          // Line being written (longer lines are split, like the output of the scripts)
+    size_t len;
+    stage_result_t *accounting;                         // Sub-steps of the stage, taken from the markers of the scripts (NULL: not recorded)
+} log_stream_t;
+
+// Function that writes a whole batch to the main log. A batch that cannot be written (e.g. full disk) is dropped: there is nowhere to report it
+static void write_batch(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Flusher thread: appends the batch to the main log with a single write when it reaches LOG_MUX_FLUSH_LEN, when its oldest record is
+// LOG_MUX_FLUSH_MS old or when a flush is requested. The records keep being added to the other buffer while a batch is written
+static void *log_mux_flusher(void *arg) {
+    log_mux_t *mux = arg;
+
+    pthread_mutex_lock(&mux->lock);
+    while (1) {
+        if (mux->used == 0) {
+            mux->flush_requested = 0;
+            if (mux->stopping) {
+                break;
+            }
+            pthread_cond_wait(&mux->records_waiting, &mux->lock);
+            continue;
+        }
+        if (mux->used < LOG_MUX_FLUSH_LEN && !mux->flush_requested && !mux->stopping) {
+            struct timespec deadline = mux->oldest_record;
+            deadline.tv_nsec += (long)LOG_MUX_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+                deadline.tv_nsec %= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&mux->records_waiting, &mux->lock, &deadline) != ETIMEDOUT) {
+                continue;
+            }
+        }
+
+        char *batch = mux->batch;
+        size_t len = mux->used;
+        mux->batch = mux->spare;
+        mux->spare = batch;
+        mux->used = 0;
+        mux->flush_requested = 0;
+        mux->writing = 1;
+        pthread_mutex_unlock(&mux->lock);
+
+        write_batch(mux->fd, batch, len);
+
+        pthread_mutex_lock(&mux->lock);
+        mux->writing = 0;
+        mux->batches_written++;
+        pthread_cond_broadcast(&mux->batch_written);
+    }
+    pthread_mutex_unlock(&mux->lock);
+
+    return NULL;
+}
+
+// Function that starts the log multiplexer: the records of the builds are appended to log_file (the main log) by the flusher thread.
+// Returns 0 on success, 1 otherwise
+int log_mux_init(log_mux_t *mux, const char *log_file, FILE *log_fp) {
+    memset(mux, 0, sizeof(*mux));
+    mux->fd = open(log_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (mux->fd == -1) {
+        fprintf(log_fp, "Error: Failed to open the main log %s for the builds: %s\n", log_file, strerror(errno));
+        return 1;
+    }
+
+    mux->batch = malloc(LOG_MUX_BUFFER_LEN);
+    mux->spare = malloc(LOG_MUX_BUFFER_LEN);
+    if (!mux->batch || !mux->spare) {
+        fprintf(log_fp, "Error: Out of memory while creating the log multiplexer.\n");
+        free(mux->batch);
+        free(mux->spare);
+        close(mux->fd);
+        return 1;
+    }
+
+    pthread_mutex_init(&mux->lock, NULL);
+    pthread_cond_init(&mux->records_waiting, NULL);
+    pthread_cond_init(&mux->batch_written, NULL);
+    if (pthread_create(&mux->flusher, NULL, log_mux_flusher, mux) != 0) {
+        fprintf(log_fp, "Error: Failed to create the flusher thread of the log multiplexer.\n");
+        pthread_cond_destroy(&mux->batch_written);
+        pthread_cond_destroy(&mux->records_waiting);
+        pthread_mutex_destroy(&mux->lock);
+        free(mux->batch);
+        free(mux->spare);
+        close(mux->fd);
+        return 1;
+    }
+    return 0;
+}
+
+// Function that adds a record (tag, text and newline) to the batch, waiting for the flusher if the batch is full
+static void append_record(log_mux_t *mux, const char *tag, size_t tag_len, const char *text, size_t len) {
+    size_t record_len = tag_len + len + 1;
+
+    pthread_mutex_lock(&mux->lock);
+    while (mux->used + record_len > LOG_MUX_BUFFER_LEN && !mux->stopping) {
+        mux->flush_requested = 1;
+        pthread_cond_signal(&mux->records_waiting);
+        pthread_cond_wait(&mux->batch_written, &mux->lock);
+    }
+    if (mux->used + record_len > LOG_MUX_BUFFER_LEN) {
+        pthread_mutex_unlock(&mux->lock);
+        return;
+    }
+
+    if (mux->used == 0) {
+        clock_gettime(CLOCK_REALTIME, &mux->oldest_record);
+    }
+    char *record = mux->batch + mux->used;
+    memcpy(record, tag, tag_len);
+    memcpy(record + tag_len, text, len);
+    record[tag_len + len] = '\n';
+    mux->used += record_len;
+    if (mux->used == record_len || mux->used >= LOG_MUX_FLUSH_LEN) {
+        pthread_cond_signal(&mux->records_waiting);
+    }
+    pthread_mutex_unlock(&mux->lock);
+}
+
+// Function that closes the sub-step in progress of a stage, if any
+static void end_step(stage_result_t *accounting, const struct timespec *now) {
+    if (accounting->num_steps > 0) {
+        stage_step_t *step = &accounting->steps[accounting->num_steps - 1];
+        if (step->end.tv_sec == 0 && step->end.tv_nsec == 0) {
+            step->end = *now;
+        }
+    }
+}
+
+// Function that handles a sub-step marker ("::step <name>" or "::step end"): the sub-step in progress ends and, unless the marker is
+// "end", a new one starts. The name is reduced to letters, digits, '.', '-' and '_' (it ends up in the timeline as it is)
+static void record_step(stage_result_t *accounting, const char *name, size_t len) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    end_step(accounting, &now);
+    if ((len == 3 && strncmp(name, "end", 3) == 0) || len == 0 || accounting->num_steps == STAGE_MAX_STEPS) {
+        return;
+    }
+
+    stage_step_t *step = &accounting->steps[accounting->num_steps++];
+    size_t n = 0;
+    for (size_t i = 0; i < len && n < sizeof(step->name) - 1; i++) {
+        char c = name[i];
+        step->name[n++] = (isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_') ? c : '_';
+    }
+    step->name[n] = '\0';
+    step->start = now;
+    step->end.tv_sec = 0;
+    step->end.tv_nsec = 0;
+}
+
+// Function that handles a complete line of a stage stream: the sub-step markers are recorded (not logged), every other line is a record
+static void handle_line(log_stream_t *stream) {
+    size_t marker_len = sizeof(STAGE_STEP_MARKER) - 1;
+    if (stream->accounting && stream->len >= marker_len && memcmp(stream->line, STAGE_STEP_MARKER, marker_len) == 0) {
+        record_step(stream->accounting, stream->line + marker_len, stream->len - marker_len);
+    } else {
+        append_record(stream->mux, stream->tag, stream->tag_len, stream->line, stream->len);
+    }
+    stream->len = 0;
+}
+
+// Write function of the stage streams: each complete line is a record
+static ssize_t log_stream_write(void *cookie, const char *buf, size_t size) {
+    log_stream_t *stream = cookie;
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i] != '\n') {
+            stream->line[stream->len++] = buf[i];
+        }
+        if (buf[i] == '\n' || stream->len == sizeof(stream->line)) {
+            handle_line(stream);
+        }
+    }
+    return (ssize_t)size;
+}
+
+// Close function of the stage streams: a last line without newline is still a record, and a sub-step still open ends here
+static int log_stream_close(void *cookie) {
+    log_stream_t *stream = cookie;
+    if (stream->len > 0) {
+        handle_line(stream);
+    }
+    if (stream->accounting) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        end_step(stream->accounting, &now);
+    }
+    free(stream);
+    return 0;
+}
+
+// Function that opens the stream of a stage of a build (stage is a short name, e.g. "compile", or "build" for the messages of the build
+// itself): whatever is written to it is appended to the main log a line at a time, each line tagged with arch and stage.
+// The stream is unbuffered (each fprintf reaches the multiplexer at once) and must be closed with fclose. If accounting is not NULL,
+// the sub-step markers printed by the scripts (STAGE_STEP_MARKER) are recorded in it instead of being logged. Returns NULL on errors
+FILE *log_mux_open(log_mux_t *mux, const char *arch, const char *stage, stage_result_t *accounting) {
+    log_stream_t *stream = malloc(sizeof(log_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->mux = mux;
+    stream->len = 0;
+    stream->accounting = accounting;
+    int tag_len = snprintf(stream->tag, sizeof(stream->tag), "[%s:%s] ", arch, stage);
+    stream->tag_len = tag_len < 0 ? 0 : ((size_t)tag_len < sizeof(stream->tag) ? (size_t)tag_len : sizeof(stream->tag) - 1);
+
+    cookie_io_functions_t functions = {NULL, log_stream_write, NULL, log_stream_close};
+    FILE *fp = fopencookie(stream, "w", functions);
+    if (!fp) {
+        free(stream);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IONBF, 0);
+    return fp;
+}
+
+// Function that waits until the records added so far are in the main log (e.g. before the main writes about a build that has just completed)
+void log_mux_flush(log_mux_t *mux) {
+    pthread_mutex_lock(&mux->lock);
+    unsigned long target = mux->batches_written + (mux->writing ? 1 : 0) + (mux->used > 0 ? 1 : 0);
+    if (mux->used > 0) {
+        mux->flush_requested = 1;
+        pthread_cond_signal(&mux->records_waiting);
+    }
+    while (mux->batches_written < target) {
+        pthread_cond_wait(&mux->batch_written, &mux->lock);
+    }
+    pthread_mutex_unlock(&mux->lock);
+}
+
+// Function that writes the records still waiting and stops the flusher (all the stage streams must have been closed)
+void log_mux_destroy(log_mux_t *mux) {
+    pthread_mutex_lock(&mux->lock);
+    mux->stopping = 1;
+    pthread_cond_signal(&mux->records_waiting);
+    pthread_mutex_unlock(&mux->lock);
+    pthread_join(mux->flusher, NULL);
+
+    pthread_cond_destroy(&mux->batch_written);
+    pthread_cond_destroy(&mux->records_waiting);
+    pthread_mutex_destroy(&mux->lock);
+    free(mux->batch);
+    free(mux->spare);
+    close(mux->fd);
+}
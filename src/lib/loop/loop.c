@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "loop/loop.h"
+
+// Function that fills the set of the signals that terminate the daemon
+static void termination_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGINT);
+}
+
+// Function that creates the event loop of the daemon: the termination signals are blocked and read from a signalfd, and a timerfd
+// expires every poll_interval seconds (from the start of one poll to the start of the next one).
+// Note: it must be called before any thread is created, so that all the threads inherit the blocked signals and the signals are only seen here
+int event_loop_init(event_loop_t *loop, int poll_interval, FILE *log_fp) {
+    memset(loop, 0, sizeof(*loop));
+    loop->signal_fd = -1;
+    loop->timer_fd = -1;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the epoll instance of the event loop: %s\n", strerror(errno));
+        return 1;
+    }
+
+    sigset_t set;
+    termination_signals(&set);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) != 0) {
+        fprintf(log_fp, "Error: Failed to block the termination signals: %s\n", strerror(errno));
+        event_loop_destroy(loop);
+        return 1;
+    }
+    loop->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop->signal_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the signalfd of the event loop: %s\n", strerror(errno));
+        event_loop_destroy(loop);
+        return 1;
+    }
+
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timer_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the poll timer of the event loop: %s\n", strerror(errno));
+        event_loop_destroy(loop);
+        return 1;
+    }
+    struct itimerspec interval = {0};
+    interval.it_value.tv_sec = poll_interval;
+    interval.it_interval.tv_sec = poll_interval;
+    if (timerfd_settime(loop->timer_fd, 0, &interval, NULL) != 0) {
+        fprintf(log_fp, "Error: Failed to arm the poll timer: %s\n", strerror(errno));
+        event_loop_destroy(loop);
+        return 1;
+    }
+
+    if (event_loop_add(loop, loop->signal_fd, EVENT_SIGNAL, log_fp) != 0 || event_loop_add(loop, loop->timer_fd, EVENT_TIMER, log_fp) != 0) {
+        event_loop_destroy(loop);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function that adds a file descriptor to the loop: event_loop_wait reports it with its source when it becomes readable
+int event_loop_add(event_loop_t *loop, int fd, event_source_t source, FILE *log_fp) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)source << 32) | (uint32_t)fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        fprintf(log_fp, "Error: Failed to add fd %d to the event loop: %s\n", fd, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Function that reads the pending termination signals from the signalfd
+static void read_signals(event_loop_t *loop, FILE *log_fp) {
+    struct signalfd_siginfo info;
+    while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        fprintf(log_fp, "Signal %s received from pid %u.\n", strsignal((int)info.ssi_signo), info.ssi_pid);
+        loop->terminate_requested = 1;
+    }
+}
+
+// Function that reads the expirations of the poll timer: the polls missed while a poll was running are merged into one
+static void read_timer(event_loop_t *loop) {
+    uint64_t expirations;
+    if (read(loop->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && expirations > 0) {
+        loop->poll_due = 1;
+    }
+}
+
+// Function that waits up to timeout_ms milliseconds (-1: with no limit) for the next events. The signals and the timer are handled here
+// (terminate_requested and poll_due are set), the other ready file descriptors are returned in events.
+// Returns the number of events returned (0 if only the signals or the timer woke up the loop, or at the timeout), -1 on errors
+int event_loop_wait(event_loop_t *loop, loop_event_t *events, int max_events, int timeout_ms, FILE *log_fp) {
+    struct epoll_event ready[EVENT_LOOP_MAX_EVENTS];
+    if (max_events > EVENT_LOOP_MAX_EVENTS) {
+        max_events = EVENT_LOOP_MAX_EVENTS;
+    }
+
+    int n = epoll_wait(loop->epoll_fd, ready, max_events, timeout_ms);
+    if (n == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(log_fp, "Error: Failed to wait for the events of the daemon: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int num_events = 0;
+    for (int i = 0; i < n; i++) {
+        event_source_t source = (event_source_t)(ready[i].data.u64 >> 32);
+        int fd = (int)(uint32_t)ready[i].data.u64;
+        if (source == EVENT_SIGNAL) {
+            read_signals(loop, log_fp);
+        } else if (source == EVENT_TIMER) {
+            read_timer(loop);
+        } else {
+            events[num_events].source = source;
+            events[num_events].fd = fd;
+            num_events++;
+        }
+    }
+    return num_events;
+}
+
+// Function that closes the file descriptors of the loop (the termination signals stay blocked)
+void event_loop_destroy(event_loop_t *loop) {
+    if (loop->timer_fd >= 0) {
+        close(loop->timer_fd);
+    }
+    if (loop->signal_fd >= 0) {
+        close(loop->signal_fd);
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    loop->timer_fd = loop->signal_fd = loop->epoll_fd = -1;
+}
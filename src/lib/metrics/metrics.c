@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "metrics/metrics.h"
+#include "utils/utils.h"
+
+// Buckets (seconds) of the histograms: a whole build takes from minutes (new commit, warm caches) to hours (first round, emulated
+// architectures), a stage from a fraction of a second (worker directories) to hours, a poll from a few hundred ms (ls-remote) to minutes (clone)
+static const double BUILD_BOUNDS[] = {60, 300, 600, 1200, 1800, 3600, 7200, 14400, 28800};
+static const double STAGE_BOUNDS[] = {1, 5, 15, 60, 300, 600, 1800, 3600, 7200, 14400};
+static const double POLL_BOUNDS[] = {0.25, 0.5, 1, 2, 5, 10, 30, 60, 300};
+
+#define NUM_BOUNDS(bounds) ((int)(sizeof(bounds) / sizeof((bounds)[0])))
+
+static void histogram_init(metrics_histogram_t *histogram, const double *bounds, int num_bounds) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->bounds = bounds;
+    histogram->num_bounds = num_bounds;
+}
+
+static void histogram_observe(metrics_histogram_t *histogram, double value) {
+    for (int i = 0; i < histogram->num_bounds; i++) {
+        if (value <= histogram->bounds[i]) {
+            histogram->buckets[i]++;
+            break;
+        }
+    }
+    histogram->count++;
+    histogram->sum += value;
+}
+
+// Function that prepares the metrics of the daemon, written to path (its directory is created if missing) by metrics_write.
+// arch_names must stay valid as long as the metrics. Returns 0 on success, 1 otherwise
+int metrics_init(metrics_t *metrics, const char *path, char **arch_names, int num_archs, FILE *log_fp) {
+    memset(metrics, 0, sizeof(*metrics));
+    strncpy(metrics->path, path, sizeof(metrics->path) - 1);
+    metrics->path[sizeof(metrics->path) - 1] = '\0';
+
+    char *metrics_dir = get_parent_dir(metrics->path);
+    if (!metrics_dir) {
+        fprintf(log_fp, "Error: Out of memory while preparing the metrics.\n");
+        return 1;
+    }
+    if (mkdir(metrics_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(log_fp, "Error: Failed to create the metrics directory %s: %s\n", metrics_dir, strerror(errno));
+        free(metrics_dir);
+        return 1;
+    }
+    free(metrics_dir);
+
+    metrics->archs = calloc(num_archs, sizeof(arch_metrics_t));
+    if (!metrics->archs) {
+        fprintf(log_fp, "Error: Out of memory while preparing the metrics.\n");
+        return 1;
+    }
+    metrics->num_archs = num_archs;
+    metrics->arch_names = arch_names;
+    for (int i = 0; i < num_archs; i++) {
+        arch_metrics_t *arch = &metrics->archs[i];
+        histogram_init(&arch->build_seconds, BUILD_BOUNDS, NUM_BOUNDS(BUILD_BOUNDS));
+        histogram_init(&arch->commit_to_artifact_seconds, BUILD_BOUNDS, NUM_BOUNDS(BUILD_BOUNDS));
+        for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+            histogram_init(&arch->stage_seconds[s], STAGE_BOUNDS, NUM_BOUNDS(STAGE_BOUNDS));
+        }
+    }
+    histogram_init(&metrics->poll_seconds, POLL_BOUNDS, NUM_BOUNDS(POLL_BOUNDS));
+    metrics->dirty = 1;
+    return 0;
+}
+
+// Function that returns the seconds elapsed since a CLOCK_MONOTONIC time
+double metrics_seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Function that records a poll and its outcome (poll_status like the commit checks: 2 new commits, 0 nothing new, 1 error)
+void metrics_record_poll(metrics_t *metrics, double seconds, int poll_status) {
+    histogram_observe(&metrics->poll_seconds, seconds);
+    if (poll_status == 2) {
+        metrics->polls_new_commits++;
+    } else if (poll_status == 0) {
+        metrics->polls_unchanged++;
+    } else {
+        metrics->polls_failed++;
+    }
+    metrics->dirty = 1;
+}
+
+// Function that records a build queued to the pool: a cache miss if its fingerprint was computed (and did not match the last build)
+void metrics_record_queued(metrics_t *metrics, int arch, int fingerprinted) {
+    if (fingerprinted) {
+        metrics->archs[arch].cache_misses++;
+    }
+    metrics->archs[arch].build_in_progress = 1;
+    metrics->dirty = 1;
+}
+
+// Function that records a build avoided by reusing the binary of the previous one (cache hit), published in the new release
+void metrics_record_reuse(metrics_t *metrics, int arch, double commit_to_artifact_seconds) {
+    metrics->archs[arch].cache_hits++;
+    histogram_observe(&metrics->archs[arch].commit_to_artifact_seconds, commit_to_artifact_seconds);
+    metrics->dirty = 1;
+}
+
+// Function that records a collected build: its duration, and the duration, CPU time and outcome of each stage that ran
+void metrics_record_build(metrics_t *metrics, int arch, const thread_result_t *result, double build_seconds) {
+    arch_metrics_t *arch_metrics = &metrics->archs[arch];
+    arch_metrics->build_in_progress = 0;
+    histogram_observe(&arch_metrics->build_seconds, build_seconds);
+    metrics->dirty = 1;
+    if (!result) {
+        arch_metrics->builds_failed++;
+        return;
+    }
+    if (result->status == 0) {
+        arch_metrics->builds_succeeded++;
+    } else {
+        arch_metrics->builds_failed++;
+    }
+
+    for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+        const stage_result_t *stage = &result->stages[s];
+        if (stage->tag) {
+            metrics->stage_tags[s] = stage->tag;
+        }
+        if (stage->outcome == STAGE_OUTCOME_SKIPPED) {
+            continue;
+        }
+        double seconds = (double)(stage->end.tv_sec - stage->start.tv_sec) + (double)(stage->end.tv_nsec - stage->start.tv_nsec) / 1e9;
+        histogram_observe(&arch_metrics->stage_seconds[s], seconds);
+        arch_metrics->stage_cpu_seconds[s][0] += (double)stage->cpu_user.tv_sec + (double)stage->cpu_user.tv_usec / 1e6;
+        arch_metrics->stage_cpu_seconds[s][1] += (double)stage->cpu_sys.tv_sec + (double)stage->cpu_sys.tv_usec / 1e6;
+        if (stage->outcome == STAGE_OUTCOME_FAILED) {
+            arch_metrics->stage_failures[s]++;
+        }
+    }
+}
+
+// Function that records the publication of a built binary
+void metrics_record_artifact(metrics_t *metrics, int arch, double commit_to_artifact_seconds) {
+    histogram_observe(&metrics->archs[arch].commit_to_artifact_seconds, commit_to_artifact_seconds);
+    metrics->dirty = 1;
+}
+
+// Function that records the builds waiting in the job queue of the pool and the ones in progress
+void metrics_set_pool_depth(metrics_t *metrics, int builds_queued, int builds_active) {
+    if (metrics->builds_queued != builds_queued || metrics->builds_active != builds_active) {
+        metrics->builds_queued = builds_queued;
+        metrics->builds_active = builds_active;
+        metrics->dirty = 1;
+    }
+}
+
+static void write_header(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Function that writes the series of a histogram (labels without braces, empty for none)
+static void write_histogram(FILE *fp, const char *name, const char *labels, const metrics_histogram_t *histogram) {
+    const char *separator = labels[0] != '\0' ? "," : "";
+    unsigned long cumulative = 0;
+    for (int i = 0; i < histogram->num_bounds; i++) {
+        cumulative += histogram->buckets[i];
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, separator, histogram->bounds[i], cumulative);
+    }
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, separator, histogram->count);
+    if (labels[0] != '\0') {
+        fprintf(fp, "%s_sum{%s} %.3f\n%s_count{%s} %lu\n", name, labels, histogram->sum, name, labels, histogram->count);
+    } else {
+        fprintf(fp, "%s_sum %.3f\n%s_count %lu\n", name, histogram->sum, name, histogram->count);
+    }
+}
+
+static void write_metrics(metrics_t *metrics, FILE *fp) {
+    char labels[MIN_CONFIG_ATTR_LEN];
+
+    write_header(fp, "sshlirpci_build_duration_seconds", "histogram", "Time from the queueing of a build to its collection.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        snprintf(labels, sizeof(labels), "arch=\"%s\"", metrics->arch_names[a]);
+        write_histogram(fp, "sshlirpci_build_duration_seconds", labels, &metrics->archs[a].build_seconds);
+    }
+
+    write_header(fp, "sshlirpci_stage_duration_seconds", "histogram", "Wall-clock duration of the stages of the builds.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+            if (metrics->stage_tags[s]) {
+                snprintf(labels, sizeof(labels), "arch=\"%s\",stage=\"%s\"", metrics->arch_names[a], metrics->stage_tags[s]);
+                write_histogram(fp, "sshlirpci_stage_duration_seconds", labels, &metrics->archs[a].stage_seconds[s]);
+            }
+        }
+    }
+
+    write_header(fp, "sshlirpci_stage_cpu_seconds_total", "counter", "CPU time used by the scripts of the stages of the builds.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+            if (metrics->stage_tags[s]) {
+                fprintf(fp, "sshlirpci_stage_cpu_seconds_total{arch=\"%s\",stage=\"%s\",mode=\"user\"} %.3f\n", metrics->arch_names[a], metrics->stage_tags[s], metrics->archs[a].stage_cpu_seconds[s][0]);
+                fprintf(fp, "sshlirpci_stage_cpu_seconds_total{arch=\"%s\",stage=\"%s\",mode=\"system\"} %.3f\n", metrics->arch_names[a], metrics->stage_tags[s], metrics->archs[a].stage_cpu_seconds[s][1]);
+            }
+        }
+    }
+
+    write_header(fp, "sshlirpci_stage_failures_total", "counter", "Failed stages of the builds (a failed test does not fail the build).");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+            if (metrics->stage_tags[s]) {
+                fprintf(fp, "sshlirpci_stage_failures_total{arch=\"%s\",stage=\"%s\"} %lu\n", metrics->arch_names[a], metrics->stage_tags[s], metrics->archs[a].stage_failures[s]);
+            }
+        }
+    }
+
+    write_header(fp, "sshlirpci_commit_to_artifact_seconds", "histogram", "Time from the poll that found new commits to the publication of the binary.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        snprintf(labels, sizeof(labels), "arch=\"%s\"", metrics->arch_names[a]);
+        write_histogram(fp, "sshlirpci_commit_to_artifact_seconds", labels, &metrics->archs[a].commit_to_artifact_seconds);
+    }
+
+    write_header(fp, "sshlirpci_builds_total", "counter", "Builds collected, by result.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        fprintf(fp, "sshlirpci_builds_total{arch=\"%s\",result=\"success\"} %lu\n", metrics->arch_names[a], metrics->archs[a].builds_succeeded);
+        fprintf(fp, "sshlirpci_builds_total{arch=\"%s\",result=\"failure\"} %lu\n", metrics->arch_names[a], metrics->archs[a].builds_failed);
+    }
+
+    write_header(fp, "sshlirpci_build_cache_requests_total", "counter", "Build fingerprint lookups: hit when the previous binary was reused.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        fprintf(fp, "sshlirpci_build_cache_requests_total{arch=\"%s\",result=\"hit\"} %lu\n", metrics->arch_names[a], metrics->archs[a].cache_hits);
+        fprintf(fp, "sshlirpci_build_cache_requests_total{arch=\"%s\",result=\"miss\"} %lu\n", metrics->arch_names[a], metrics->archs[a].cache_misses);
+    }
+
+    write_header(fp, "sshlirpci_build_in_progress", "gauge", "1 while a build of the architecture is in the pool.");
+    for (int a = 0; a < metrics->num_archs; a++) {
+        fprintf(fp, "sshlirpci_build_in_progress{arch=\"%s\"} %d\n", metrics->arch_names[a], metrics->archs[a].build_in_progress);
+    }
+
+    write_header(fp, "sshlirpci_builds_queued", "gauge", "Builds waiting in the job queue of the worker pool.");
+    fprintf(fp, "sshlirpci_builds_queued %d\n", metrics->builds_queued);
+    write_header(fp, "sshlirpci_builds_active", "gauge", "Builds taken by the worker pool and not completed yet.");
+    fprintf(fp, "sshlirpci_builds_active %d\n", metrics->builds_active);
+
+    write_header(fp, "sshlirpci_poll_duration_seconds", "histogram", "Duration of the polls of the repositories (check and export of new commits).");
+    write_histogram(fp, "sshlirpci_poll_duration_seconds", "", &metrics->poll_seconds);
+
+    write_header(fp, "sshlirpci_polls_total", "counter", "Polls of the repositories, by outcome.");
+    fprintf(fp, "sshlirpci_polls_total{result=\"new_commits\"} %lu\n", metrics->polls_new_commits);
+    fprintf(fp, "sshlirpci_polls_total{result=\"unchanged\"} %lu\n", metrics->polls_unchanged);
+    fprintf(fp, "sshlirpci_polls_total{result=\"failed\"} %lu\n", metrics->polls_failed);
+}
+
+// Function that writes the metrics, if they changed since the last write. The file is replaced atomically (written next to it, then renamed),
+// so a collector never reads a partial file. Returns 0 on success (or if there was nothing to write), 1 otherwise
+int metrics_write(metrics_t *metrics, FILE *log_fp) {
+    if (!metrics->dirty) {
+        return 0;
+    }
+
+    char tmp_path[MAX_CONFIG_ATTR_LEN + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics->path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        fprintf(log_fp, "Warning: Failed to write the metrics to %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+    write_metrics(metrics, fp);
+    if (fclose(fp) != 0 || rename(tmp_path, metrics->path) != 0) {
+        fprintf(log_fp, "Warning: Failed to write the metrics to %s: %s\n", metrics->path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+    metrics->dirty = 0;
+    return 0;
+}
+
+// Function that frees the metrics (the last file written is left in place)
+void metrics_destroy(metrics_t *metrics) {
+    free(metrics->archs);
+    metrics->archs = NULL;
+    metrics->num_archs = 0;
+}
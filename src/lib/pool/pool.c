@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "pool/pool.h"
+#include "sched/scheduler.h"
+#include "worker.h"
+#include "logmux/logmux.h"
+#include "spawn/spawn.h"
+
+// Function that appends a stage to the ready queue of its class (called with the lock held)
+static void push_ready(worker_pool_t *pool, build_stage_t *stage) {
+    stage->state = STAGE_READY;
+    stage->ready_since = time(NULL);
+    stage->next = NULL;
+    if (pool->ready_tail[stage->stage_class]) {
+        pool->ready_tail[stage->stage_class]->next = stage;
+    } else {
+        pool->ready_head[stage->stage_class] = stage;
+    }
+    pool->ready_tail[stage->stage_class] = stage;
+}
+
+// Function that takes out of the ready queues the stages of a failed build: they will never run (called with the lock held)
+static void drop_ready_stages(worker_pool_t *pool, build_job_t *job) {
+    for (int c = 0; c < STAGE_CLASS_COUNT; c++) {
+        build_stage_t **link = &pool->ready_head[c];
+        pool->ready_tail[c] = NULL;
+        while (*link) {
+            if ((*link)->job == job) {
+                (*link)->state = STAGE_SKIPPED;
+                *link = (*link)->next;
+            } else {
+                pool->ready_tail[c] = *link;
+                link = &(*link)->next;
+            }
+        }
+    }
+}
+
+// Function that hands a build back through the completion queue and wakes up the event loop of the main (called with the lock held)
+static void complete_job(worker_pool_t *pool, build_job_t *job) {
+    job->completed = 1;
+    job->next = NULL;
+    if (pool->completed_tail) {
+        pool->completed_tail->next = job;
+    } else {
+        pool->completed_head = job;
+    }
+    pool->completed_tail = job;
+
+    // The write can only fail if the counter is full, i.e. the main has not read it yet and will be woken up anyway
+    uint64_t one = 1;
+    ssize_t written = write(pool->completion_fd, &one, sizeof(one));
+    (void)written;
+}
+
+// Function that takes the queued builds into the graph while there is room, making ready the stages without dependencies (called with the lock held).
+// Note: nothing called with the lock held writes to the log streams, which can block when the log multiplexer is behind (see logmux/logmux.h):
+// the workers log outside of it, and the build messages are written when the build is queued and when it is collected
+static void admit_builds(worker_pool_t *pool) {
+    while (pool->pending_head && pool->active_builds < pool->max_active_builds) {
+        build_job_t *job = pool->pending_head;
+        pool->pending_head = job->next;
+        if (!pool->pending_head) {
+            pool->pending_tail = NULL;
+        }
+
+        pool->active_builds++;
+        for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+            if (job->stages[i].state == STAGE_WAITING && job->stages[i].deps_left == 0) {
+                push_ready(pool, &job->stages[i]);
+            }
+        }
+    }
+}
+
+// Function that picks the oldest ready stage of a class whose tokens are free right now, and takes them (called with the lock held).
+// Only the head of each queue is offered to the scheduler: within a class the stages start in the order they became ready
+static build_stage_t *pick_admitted_stage(worker_pool_t *pool, resource_request_t *granted) {
+    for (int c = 0; c < STAGE_CLASS_COUNT; c++) {
+        build_stage_t *stage = pool->ready_head[c];
+        if (!stage) {
+            continue;
+        }
+        if (scheduler_try_acquire(stage->job->args->scheduler, &stage->cost, granted) != 0) {
+            continue;
+        }
+        pool->ready_head[c] = stage->next;
+        if (!pool->ready_head[c]) {
+            pool->ready_tail[c] = NULL;
+        }
+        stage->next = NULL;
+        return stage;
+    }
+    return NULL;
+}
+
+// Function that records the end of a stage: its dependents become ready or, if the build failed, the stages not started are skipped.
+// The build is completed when its last running stage ends (called with the lock held)
+static void finish_stage(worker_pool_t *pool, build_stage_t *stage, int stage_status) {
+    build_job_t *job = stage->job;
+    job->stages_running--;
+    job->stages_left--;
+    stage->state = STAGE_DONE;
+
+    if (build_worker_stage_done(job, stage, stage_status) != 0 && !job->failed) {
+        job->failed = 1;
+        drop_ready_stages(pool, job);
+    }
+    if (!job->failed) {
+        for (int i = 0; i < stage->num_dependents; i++) {
+            build_stage_t *dependent = &job->stages[stage->dependents[i]];
+            if (--dependent->deps_left == 0) {
+                push_ready(pool, dependent);
+            }
+        }
+    }
+
+    if (job->stages_running == 0 && (job->stages_left == 0 || job->failed)) {
+        job->result = build_worker_end(job);
+        pool->active_builds--;
+        complete_job(pool, job);
+        admit_builds(pool);
+    }
+}
+
+// Pool thread: runs the admitted stages of the builds one at a time, until the pool is destroyed
+static void *pool_worker(void *arg) {
+    worker_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        admit_builds(pool);
+
+        resource_request_t granted;
+        build_stage_t *stage = pick_admitted_stage(pool, &granted);
+        if (!stage) {
+            if (pool->shutting_down && pool->active_builds == 0 && !pool->pending_head) {
+                break;
+            }
+            // Woken up when a build is queued, a stage becomes ready or a stage ends (releasing its tokens). The timeout lets me
+            // notice memory freed by processes that are not stages of the daemon
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += SCHED_RECHECK_SECONDS;
+            pthread_cond_timedwait(&pool->work_available, &pool->lock, &deadline);
+            continue;
+        }
+
+        build_job_t *job = stage->job;
+        stage->state = STAGE_RUNNING;
+        stage->accounting.cpu_tokens = granted.cpu;
+        job->stages_running++;
+        pthread_mutex_unlock(&pool->lock);
+
+        // Each stage writes to its own stream, so that the records of two stages of the build running at the same time are told apart
+        FILE *stage_fp = log_mux_open(job->args->log_mux, job->args->arch, stage->tag, &stage->accounting);
+        if (!stage_fp) {
+            stage_fp = job->log_fp;
+        }
+        scheduler_log_admission(job->args->scheduler, &granted, job->args->arch, stage->name, stage->ready_since, stage_fp);
+        // The admission may have taken CPU tokens back from the compilations in flight
+        scheduler_publish_jobs(job->args->scheduler, stage_fp);
+        // A stage taken just before the build was cancelled does not start (the cancellation only skips the stages still queued)
+        int stage_status = 1;
+        clock_gettime(CLOCK_MONOTONIC, &stage->accounting.start);
+        if (spawn_cancelled(&job->args->cancel)) {
+            clock_gettime(CLOCK_MONOTONIC, &stage->accounting.end);
+            fprintf(stage_fp, "Stage %s not started for %s: the build was cancelled.\n", stage->name, job->args->arch);
+        } else {
+            fprintf(stage_fp, "Stage %s started for %s.\n", stage->name, job->args->arch);
+            stage_status = stage->run(job->args, &stage->accounting, stage_fp);
+            clock_gettime(CLOCK_MONOTONIC, &stage->accounting.end);
+            build_worker_stage_log(job, stage, stage_status, stage_fp);
+        }
+        scheduler_release(job->args->scheduler, &granted, stage_fp);
+        if (stage_fp != job->log_fp) {
+            fclose(stage_fp);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        finish_stage(pool, stage, stage_status);
+        pthread_cond_broadcast(&pool->work_available);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// Function that starts the threads of the pool. The threads live as long as the daemon and wait for jobs between the builds.
+// There are BUILD_STAGE_WIDTH threads for each build that can be in progress (max_builds), so that the parallel branches of every build can run.
+// The completions are signalled on completion_fd, to be watched by the event loop (see worker_pool_next_completion)
+int worker_pool_init(worker_pool_t *pool, int max_builds, FILE *log_fp) {
+    memset(pool, 0, sizeof(*pool));
+    if (max_builds < 1) {
+        max_builds = 1;
+    }
+    pool->max_active_builds = max_builds;
+    int num_workers = max_builds * BUILD_STAGE_WIDTH;
+
+    pool->workers = calloc(num_workers, sizeof(pthread_t));
+    if (!pool->workers) {
+        fprintf(log_fp, "Error: Out of memory while creating the worker pool.\n");
+        return 1;
+    }
+    pool->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->completion_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the completion eventfd of the worker pool: %s\n", strerror(errno));
+        free(pool->workers);
+        return 1;
+    }
+    if (pthread_mutex_init(&pool->lock, NULL) != 0 ||
+        pthread_cond_init(&pool->work_available, NULL) != 0) {
+        fprintf(log_fp, "Error: Failed to initialize the synchronization of the worker pool.\n");
+        close(pool->completion_fd);
+        free(pool->workers);
+        return 1;
+    }
+
+    // Note: the workers inherit the signal mask of the main, where the termination signals are blocked (they are read from the signalfd of the event loop)
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&pool->workers[i], NULL, pool_worker, pool) != 0) {
+            fprintf(log_fp, "Warning: Failed to create worker %d of the pool, continuing with %d workers.\n", i, i);
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    if (pool->num_workers == 0) {
+        fprintf(log_fp, "Error: Could not create any worker thread.\n");
+        worker_pool_destroy(pool);
+        return 1;
+    }
+
+    fprintf(log_fp, "Worker pool started: up to %d builds in progress, %d stage threads.\n", pool->max_active_builds, pool->num_workers);
+    return 0;
+}
+
+// Function that queues a build. The job (and its args) must stay valid until it is returned by worker_pool_next_completion
+void worker_pool_submit(worker_pool_t *pool, build_job_t *job) {
+    job->result = NULL;
+    job->next = NULL;
+    job->cancelled = 0;
+    job->completed = 0;
+
+    // The stages of the build are declared by the worker, together with its log stream and its result (before taking the lock: it logs)
+    int failed = build_worker_begin(job) != 0;
+
+    pthread_mutex_lock(&pool->lock);
+    if (failed) {
+        complete_job(pool, job);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    if (pool->pending_tail) {
+        pool->pending_tail->next = job;
+    } else {
+        pool->pending_head = job;
+    }
+    pool->pending_tail = job;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Function that returns the builds waiting in the job queue and the ones taken by the pool and not completed yet
+void worker_pool_depth(worker_pool_t *pool, int *queued, int *active) {
+    pthread_mutex_lock(&pool->lock);
+    *queued = 0;
+    for (build_job_t *job = pool->pending_head; job; job = job->next) {
+        (*queued)++;
+    }
+    *active = pool->active_builds;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Function that cancels a build queued or in progress (its scripts are stopped by spawn_cancel): a build still in the job queue is taken
+// out of it and completed right away, with every stage skipped. Otherwise the stages not started yet are skipped and, if none of its
+// stages is running, the build is completed right away, else when its running stages end. Nothing is done for a build already completed
+// (or cancelled). Returns 1 if the build was cancelled (job->cancelled is set), 0 otherwise
+int worker_pool_cancel(worker_pool_t *pool, build_job_t *job) {
+    pthread_mutex_lock(&pool->lock);
+    if (job->completed || job->cancelled) {
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+
+    int pending = 0;
+    pool->pending_tail = NULL;
+    for (build_job_t **link = &pool->pending_head; *link; ) {
+        if (*link == job) {
+            *link = job->next;
+            pending = 1;
+        } else {
+            pool->pending_tail = *link;
+            link = &(*link)->next;
+        }
+    }
+
+    job->cancelled = 1;
+    if (!job->failed) {
+        job->failed = 1;
+        drop_ready_stages(pool, job);
+        build_worker_cancel(job);
+    }
+    if (pending) {
+        for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+            job->stages[i].state = STAGE_SKIPPED;
+        }
+        job->result = build_worker_end(job);
+        complete_job(pool, job);
+    } else if (job->stages_running == 0) {
+        job->result = build_worker_end(job);
+        pool->active_builds--;
+        complete_job(pool, job);
+        admit_builds(pool);
+    }
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+// Function that copies the state and the tag of each stage of a build. Returns 1 if the build is still in the job queue
+// (its stages are not declared yet and nothing is copied), 0 otherwise
+int worker_pool_job_stages(worker_pool_t *pool, const build_job_t *job, stage_state_t states[BUILD_MAX_STAGES], const char *tags[BUILD_MAX_STAGES]) {
+    pthread_mutex_lock(&pool->lock);
+    for (build_job_t *pending = pool->pending_head; pending; pending = pending->next) {
+        if (pending == job) {
+            pthread_mutex_unlock(&pool->lock);
+            return 1;
+        }
+    }
+    for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+        states[i] = job->stages[i].state;
+        tags[i] = job->stages[i].tag;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+// Function that takes the oldest completed build off the completion queue, in completion order. Returns NULL when no build has completed.
+// The main calls it when completion_fd becomes readable, until it returns NULL (the eventfd is reset by the read). The log stream of the
+// build is closed here, after taking it off the queue
+build_job_t *worker_pool_next_completion(worker_pool_t *pool) {
+    // Reset the eventfd (EAGAIN if it was already reset): the queue is what tells whether there is a completed build
+    uint64_t count;
+    ssize_t read_bytes = read(pool->completion_fd, &count, sizeof(count));
+    (void)read_bytes;
+
+    pthread_mutex_lock(&pool->lock);
+    build_job_t *job = pool->completed_head;
+    if (job) {
+        pool->completed_head = job->next;
+        if (!pool->completed_head) {
+            pool->completed_tail = NULL;
+        }
+        job->next = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job) {
+        build_worker_close(job);
+    }
+    return job;
+}
+
+// Function that stops the pool: the threads finish the builds still queued, then exit
+void worker_pool_destroy(worker_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->num_workers = 0;
+
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    close(pool->completion_fd);
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "release/release.h"
+#include "fingerprint/fingerprint.h"
+
+#define RELEASE_PATH_LEN 4096
+#define RELEASE_LINE_LEN 1024
+
+// Function that writes the manifest to a temporary file and renames it over the old one: readers (users, mirrors, scripts waiting
+// for an architecture) always see either the previous manifest or the new one, never a partial file
+static int write_manifest(const char *manifest_path, const char *content, FILE *log_fp) {
+    char tmp_path[RELEASE_PATH_LEN];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", manifest_path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        fprintf(log_fp, "Error: Path too long: %s\n", manifest_path);
+        return 1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(log_fp, "Error: Failed to create %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+
+    size_t len = strlen(content);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, content + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(log_fp, "Error: Failed to write %s: %s\n", tmp_path, strerror(errno));
+            close(fd);
+            unlink(tmp_path);
+            return 1;
+        }
+        done += (size_t)n;
+    }
+
+    // The data must be on disk before the rename makes it visible
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        fprintf(log_fp, "Error: Failed to flush %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+    if (rename(tmp_path, manifest_path) != 0) {
+        fprintf(log_fp, "Error: Failed to publish %s: %s\n", manifest_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function that records a binary just published in the release directory in the manifest of the release (release_dir/MANIFEST),
+// replacing the line of the same architecture if there is one. Each line describes one binary:
+//   <arch> <file> sha256=<hex> size=<bytes> sshlirp=<commit> libslirp=<commit> published=<UTC time>
+// It is called by the main thread only, as soon as each architecture lands, so the manifest grows while the round is still running
+int update_release_manifest(const char *release_dir, const char *arch, const char *binary_path, const commit_status_t *commits, FILE *log_fp) {
+    struct stat st;
+    if (stat(binary_path, &st) != 0) {
+        fprintf(log_fp, "Error: Cannot add %s to the release manifest: %s\n", binary_path, strerror(errno));
+        return 1;
+    }
+
+    char binary_hash[SHA256_HEX_LEN];
+    if (fingerprint_file(binary_path, binary_hash, log_fp) != 0) {
+        return 1;
+    }
+
+    char manifest_path[RELEASE_PATH_LEN];
+    int written = snprintf(manifest_path, sizeof(manifest_path), "%s/%s", release_dir, RELEASE_MANIFEST_NAME);
+    if (written < 0 || (size_t)written >= sizeof(manifest_path)) {
+        fprintf(log_fp, "Error: Path too long for the manifest of %s\n", release_dir);
+        return 1;
+    }
+
+    const char *binary_name = strrchr(binary_path, '/');
+    binary_name = binary_name ? binary_name + 1 : binary_path;
+
+    char published[32];
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(published, sizeof(published), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+    char new_line[RELEASE_LINE_LEN];
+    snprintf(new_line, sizeof(new_line), "%s %s sha256=%s size=%lld sshlirp=%s libslirp=%s published=%s\n",
+             arch, binary_name, binary_hash, (long long)st.st_size,
+             commits->sshlirp_commit[0] ? commits->sshlirp_commit : "unknown",
+             commits->libslirp_commit[0] ? commits->libslirp_commit : "unknown", published);
+
+    // Lines of the other architectures are kept as they are
+    size_t arch_len = strlen(arch);
+    size_t content_cap = RELEASE_LINE_LEN * 4;
+    size_t content_len = 0;
+    char *content = malloc(content_cap);
+    if (!content) {
+        fprintf(log_fp, "Error: Out of memory while updating %s\n", manifest_path);
+        return 1;
+    }
+    content[0] = '\0';
+
+    FILE *old_fp = fopen(manifest_path, "r");
+    if (old_fp) {
+        char line[RELEASE_LINE_LEN];
+        while (fgets(line, sizeof(line), old_fp)) {
+            if (strncmp(line, arch, arch_len) == 0 && line[arch_len] == ' ') {
+                continue;
+            }
+            size_t line_len = strlen(line);
+            if (content_len + line_len + 1 > content_cap) {
+                content_cap = (content_len + line_len + 1) * 2;
+                char *grown = realloc(content, content_cap);
+                if (!grown) {
+                    fprintf(log_fp, "Error: Out of memory while updating %s\n", manifest_path);
+                    fclose(old_fp);
+                    free(content);
+                    return 1;
+                }
+                content = grown;
+            }
+            memcpy(content + content_len, line, line_len + 1);
+            content_len += line_len;
+        }
+        fclose(old_fp);
+    } else if (errno != ENOENT) {
+        fprintf(log_fp, "Warning: Failed to read the old manifest %s: %s. It will be rewritten.\n", manifest_path, strerror(errno));
+    }
+
+    size_t new_len = strlen(new_line);
+    if (content_len + new_len + 1 > content_cap) {
+        char *grown = realloc(content, content_len + new_len + 1);
+        if (!grown) {
+            fprintf(log_fp, "Error: Out of memory while updating %s\n", manifest_path);
+            free(content);
+            return 1;
+        }
+        content = grown;
+    }
+    memcpy(content + content_len, new_line, new_len + 1);
+
+    int status = write_manifest(manifest_path, content, log_fp);
+    free(content);
+    if (status == 0) {
+        fprintf(log_fp, "Release manifest %s updated for architecture %s (sha256 %.16s...).\n", manifest_path, arch, binary_hash);
+    }
+    return status;
+}
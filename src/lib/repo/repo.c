@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "repo/repo.h"
+#include "init/init.h"
+#include "fingerprint/fingerprint.h"
+#include "trace/trace.h"
+
+// Function that exports the commits found by the poll into a new generation: their trees become immutable snapshots, fingerprinted once
+// for all the architectures, and the round gets its timeline. Returns NULL on errors (the daemon cannot build the commits)
+static build_generation_t *prepare_generation(repo_poll_t *poll, commit_status_t *commits, FILE *log_fp) {
+    fprintf(log_fp, "New commit for sshlirp found (%s), exporting it for the builds...\n", commits->sshlirp_commit);
+
+    build_generation_t *generation = calloc(1, sizeof(build_generation_t));
+    if (!generation) {
+        fprintf(log_fp, "Error: Out of memory while preparing the build of sshlirp %s.\n", commits->sshlirp_commit);
+        return NULL;
+    }
+    if (export_source_snapshots(commits, poll->sshlirp_source_dir, poll->libslirp_source_dir, poll->vdens_source_dir, poll->snapshots_dir, log_fp,
+                                generation->sshlirp_snapshot_dir, generation->libslirp_snapshot_dir, generation->vdens_snapshot_dir, MAX_CONFIG_ATTR_LEN) != 0) {
+        fprintf(log_fp, "Error: Error exporting the sources snapshots of sshlirp %s.\n", commits->sshlirp_commit);
+        free(generation);
+        return NULL;
+    }
+
+    generation->id = poll->generation_id;
+    generation->commits = *commits;
+    generation->found_at = poll->started_at;
+    commits->new_release = NULL;                        // Now owned by the generation
+    generation->refs = 1;
+
+    if (fingerprint_tree(generation->sshlirp_snapshot_dir, generation->tree_fingerprint, log_fp) != 0) {
+        generation->tree_fingerprint[0] = '\0';
+        fprintf(log_fp, "Warning: Could not fingerprint the sshlirp sources: all the architectures will be built.\n");
+    }
+    snprintf(generation->release_dir, sizeof(generation->release_dir), "%s/%s", poll->target_dir, generation->commits.new_release);
+
+    // The round gets its own timeline: every build of the generation is appended to it when it is collected
+    trace_open_round(generation, poll->traces_dir, poll->archs_list, poll->num_archs, log_fp);
+    return generation;
+}
+
+// Task that polls the repositories: on the first poll it checks the host directories and clones the repositories, then it looks for new
+// commits and, if there are any, exports them into a new generation (poll->generation). On the first poll the commits checked out are
+// exported as well if the daemon stopped before building them (rebuild marker). Returns poll->result
+int repo_poll_run(loop_task_t *task, FILE *log_fp) {
+    repo_poll_t *poll = task->data;
+    commit_status_t initial_check = {1, NULL, "", "", ""};
+    commit_status_t new_commit = {1, NULL, "", "", ""};
+    poll->result = 1;
+    poll->generation = NULL;
+
+    // 1. Check if the host directories and git repositories exist.
+    // Note: this function does nothing if the dirs already exist and if the git repo already exists (possible in case of a crash or interruption)
+    if (poll->first_poll) {
+        initial_check = check_host_dirs(poll->target_dir, poll->sshlirp_source_dir, poll->libslirp_source_dir, poll->vdens_source_dir,
+                                        poll->sshlirp_repo_url, poll->libslirp_repo_url, poll->vdens_repo_url, log_fp, poll->versioning_file);
+        if (initial_check.status != 0 && initial_check.status != 2) {
+            fprintf(log_fp, "Error: Error during search or creation of host directories, log file, or during repository cloning. Status: %d\n", initial_check.status);
+            free(initial_check.new_release);
+            return poll->result;
+        }
+    }
+
+    // 2. If it's not the first start (and so I had already cloned and waited poll_interval seconds) or if the repo was already cloned
+    // (so maybe there was a crash or an interruption), I try to pull any new commits
+    if (!poll->first_poll || initial_check.status == 0) {
+        new_commit = check_new_commit(poll->sshlirp_source_dir, poll->sshlirp_repo_url, poll->libslirp_source_dir, poll->libslirp_repo_url,
+                                      poll->vdens_source_dir, log_fp, poll->versioning_file);
+    }
+
+    // 2.1. Without new commits, the first poll builds again the commits checked out if the builds of the last run did not end
+    // (the daemon was shut down while they were running, or before they started)
+    if (poll->first_poll && new_commit.status == 0 && access(poll->rebuild_marker, F_OK) == 0) {
+        fprintf(log_fp, "The builds of the commits checked out did not end when the daemon stopped (%s): building them again.\n", poll->rebuild_marker);
+        new_commit = read_checked_out_commits(poll->sshlirp_source_dir, poll->libslirp_source_dir, poll->vdens_source_dir, log_fp, poll->versioning_file);
+    }
+
+    // 3. If it's the first start and I actually cloned or if I found new commits, they become the newest generation
+    if ((poll->first_poll && initial_check.status == 2) || new_commit.status == 2) {
+        poll->generation = prepare_generation(poll, new_commit.status == 2 ? &new_commit : &initial_check, log_fp);
+        poll->result = poll->generation ? 2 : 1;
+        // The new generation is built by every architecture: if the daemon stops before, the marker is written again
+        if (poll->generation && poll->first_poll && unlink(poll->rebuild_marker) != 0 && errno != ENOENT) {
+            fprintf(log_fp, "Warning: Failed to remove %s: %s\n", poll->rebuild_marker, strerror(errno));
+        }
+    } else if (new_commit.status == 1) {
+        // The repos were found (or cloned) correctly, but this pull failed: an error in the pull is critical, I can't keep the daemon running
+        fprintf(log_fp, "Error: Error during check_new_commit() or check_host_dirs() call.\n");
+    } else {
+        poll->result = 0;
+    }
+
+    free(initial_check.new_release);
+    free(new_commit.new_release);
+    return poll->result;
+}
+
+// Task that removes the source snapshots no longer needed (the ones not listed in prune->keep_dirs)
+int snapshot_prune_run(loop_task_t *task, FILE *log_fp) {
+    snapshot_prune_t *prune = task->data;
+    const char **keep_dirs = calloc(prune->num_keep_dirs + 1, sizeof(char *));
+    if (!keep_dirs) {
+        // Nothing is removed: the snapshots will be pruned the next time
+        return 1;
+    }
+    for (int i = 0; i < prune->num_keep_dirs; i++) {
+        keep_dirs[i] = prune->keep_dirs[i];
+    }
+
+    int status = prune_source_snapshots(prune->snapshots_dir, keep_dirs, prune->num_keep_dirs, log_fp);
+    if (status != 0) {
+        fprintf(log_fp, "Warning: Some unused snapshots in %s could not be removed.\n", prune->snapshots_dir);
+    }
+    free(keep_dirs);
+    return status;
+}
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "sched/scheduler.h"
+
+// Function that reads the memory currently available on the host (MemAvailable in /proc/meminfo), in MiB.
+// Returns -1 if the value cannot be read
+static long read_mem_available_mb() {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[MIN_CONFIG_ATTR_LEN];
+    long available_kb = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemAvailable: %ld kB", &available_kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    return available_kb < 0 ? -1 : available_kb / 1024;
+}
+
+// Function that clamps a request to the total budget, so that a stage bigger than the whole host can still run (alone)
+static void clamp_request(resource_scheduler_t *sched, const resource_request_t *request, resource_request_t *granted) {
+    granted->cpu = request->cpu > sched->cpu_total ? sched->cpu_total : request->cpu;
+    granted->mem_mb = request->mem_mb > sched->mem_total_mb ? sched->mem_total_mb : request->mem_mb;
+    granted->io = request->io > sched->io_total ? sched->io_total : request->io;
+    granted->net = request->net > sched->net_total ? sched->net_total : request->net;
+}
+
+// Function that checks (with the lock held) if the request fits in what is left of the budget, counting as free the CPU tokens
+// that can be taken back from the compilations (cpu_reclaimable). When nothing is running the request is always admitted, otherwise
+// a stage could wait forever for memory used by other processes of the host
+static int request_fits(resource_scheduler_t *sched, const resource_request_t *granted, int cpu_reclaimable) {
+    if (sched->running == 0) {
+        return 1;
+    }
+    if (sched->cpu_used - cpu_reclaimable + granted->cpu > sched->cpu_total ||
+        sched->mem_used_mb + granted->mem_mb > sched->mem_total_mb ||
+        sched->io_used + granted->io > sched->io_total ||
+        sched->net_used + granted->net > sched->net_total) {
+        return 0;
+    }
+
+    // The budget only counts what the daemon's stages declared, so I also check what the host really has free right now
+    if (granted->mem_mb > 0) {
+        long available_mb = read_mem_available_mb();
+        if (available_mb >= 0 && available_mb - SCHED_MEM_RESERVE_MB < granted->mem_mb) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function that returns (with the lock held) the minimum jobs of a compilation: the CPU tokens of its admission, at least one
+static int min_compile_jobs(const compile_slot_t *slot) {
+    return slot->admitted_cpu > 1 ? slot->admitted_cpu : 1;
+}
+
+// Function that returns (with the lock held) the CPU tokens the compilations hold beyond their minimum jobs, which are given back
+// to the budget when another stage needs them
+static int reclaimable_cpu(resource_scheduler_t *sched) {
+    int reclaimable = 0;
+    for (compile_slot_t *slot = sched->compiles; slot; slot = slot->next) {
+        reclaimable += slot->jobs - min_compile_jobs(slot);
+    }
+    return reclaimable;
+}
+
+// Function that (with the lock held) splits among the compilations in flight the CPU tokens not held by the other stages, leaving
+// reserve tokens free, so that the make/ninja jobs of the compilations plus the tokens of the other stages never exceed the CPUs.
+// Each compilation holds one token for each of its jobs, and never less than its admission tokens. Only the accounting changes here:
+// the jobs files are written by write_compile_jobs
+static void rebalance_compiles(resource_scheduler_t *sched, int reserve) {
+    if (sched->compiles_in_flight == 0) {
+        return;
+    }
+
+    int compile_cpu = 0;
+    for (compile_slot_t *slot = sched->compiles; slot; slot = slot->next) {
+        compile_cpu += slot->jobs;
+    }
+    int share = (sched->cpu_total - (sched->cpu_used - compile_cpu) - reserve) / sched->compiles_in_flight;
+    for (compile_slot_t *slot = sched->compiles; slot; slot = slot->next) {
+        int jobs = share > min_compile_jobs(slot) ? share : min_compile_jobs(slot);
+        sched->cpu_used += jobs - slot->jobs;
+        slot->jobs = jobs;
+    }
+}
+
+// Function that initializes the scheduler, sizing the budget on the online CPUs and on the memory available on the host
+int scheduler_init(resource_scheduler_t *sched, FILE *log_fp) {
+    memset(sched, 0, sizeof(*sched));
+
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    sched->cpu_total = online_cpus > 0 ? (int)online_cpus : 1;
+
+    long available_mb = read_mem_available_mb();
+    if (available_mb < 0) {
+        fprintf(log_fp, "Warning: Could not read MemAvailable from /proc/meminfo, the memory budget of the scheduler will not be enforced.\n");
+        available_mb = SCHED_MEM_RESERVE_MB * 1024L;
+    }
+    sched->mem_total_mb = available_mb > SCHED_MEM_RESERVE_MB * 2 ? available_mb - SCHED_MEM_RESERVE_MB : available_mb / 2;
+    sched->io_total = SCHED_IO_TOKENS;
+    sched->net_total = SCHED_NET_TOKENS;
+
+    if (pthread_mutex_init(&sched->lock, NULL) != 0) {
+        fprintf(log_fp, "Error: Failed to initialize the scheduler mutex.\n");
+        return 1;
+    }
+
+    fprintf(log_fp, "Resource scheduler initialized: %d CPU tokens, %ld MiB memory tokens, %d I/O tokens, %d network tokens.\n", sched->cpu_total, sched->mem_total_mb, sched->io_total, sched->net_total);
+    return 0;
+}
+
+// Function that admits the stage if its tokens are free right now, taking them from the budget. Returns 0 if admitted, 1 otherwise.
+// It never blocks: the stage executor of the worker pool (see pool/pool.h) only offers the oldest ready stage of each resource class,
+// so the stages of a class are admitted in arrival order, and retries when a stage ends (or every SCHED_RECHECK_SECONDS, for the free memory).
+// The CPU tokens the compilations took beyond their admission ones are taken back when the stage needs them: the caller must then call
+// scheduler_publish_jobs to write the new jobs of the compilations. Nothing is logged here (the pool calls it with its lock held),
+// see scheduler_log_admission
+int scheduler_try_acquire(resource_scheduler_t *sched, const resource_request_t *request, resource_request_t *granted) {
+    pthread_mutex_lock(&sched->lock);
+    clamp_request(sched, request, granted);
+    if (!request_fits(sched, granted, reclaimable_cpu(sched))) {
+        pthread_mutex_unlock(&sched->lock);
+        return 1;
+    }
+    if (!request_fits(sched, granted, 0)) {
+        rebalance_compiles(sched, granted->cpu);
+    }
+
+    sched->cpu_used += granted->cpu;
+    sched->mem_used_mb += granted->mem_mb;
+    sched->io_used += granted->io;
+    sched->net_used += granted->net;
+    sched->running++;
+    pthread_mutex_unlock(&sched->lock);
+    return 0;
+}
+
+// Function that logs the admission of a stage, with the stages running and the CPU tokens in use right now
+void scheduler_log_admission(
+    resource_scheduler_t *sched,
+    const resource_request_t *granted,
+    const char *arch,
+    const char *stage,
+    time_t wait_start,
+    FILE *log_fp
+) {
+    pthread_mutex_lock(&sched->lock);
+    int cpu_used = sched->cpu_used;
+    int running = sched->running;
+    pthread_mutex_unlock(&sched->lock);
+
+    fprintf(log_fp, "[Thread %s] Stage %s admitted (cpu %d, mem %ld MiB, io %d, net %d) after %ld s of wait. Running stages: %d, CPU tokens in use: %d.\n",
+            arch, stage, granted->cpu, granted->mem_mb, granted->io, granted->net, (long)(time(NULL) - wait_start), running, cpu_used);
+}
+
+// Function that writes the jobs of a compilation to its jobs file (atomically: compile.sh may be reading it)
+static int write_jobs_file(compile_slot_t *slot, int jobs, FILE *log_fp) {
+    char tmp_path[sizeof(slot->jobs_file) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", slot->jobs_file);
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        fprintf(log_fp, "Warning: Failed to write the jobs file %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+    fprintf(fp, "%d\n", jobs);
+    if (fclose(fp) != 0 || rename(tmp_path, slot->jobs_file) != 0) {
+        fprintf(log_fp, "Warning: Failed to publish the jobs file %s: %s\n", slot->jobs_file, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    slot->written_jobs = jobs;
+    return 0;
+}
+
+// Function that (with the lock held) writes the jobs files of the compilations whose jobs changed.
+// A make/ninja run that already started keeps its jobs, but the next one of the same compile.sh (libslirp, then sshlirp) picks up the new value:
+// when a stage ends, the cores it frees go to the compilations still running, and when a stage needs them they are taken back
+static void write_compile_jobs(resource_scheduler_t *sched, FILE *log_fp) {
+    for (compile_slot_t *slot = sched->compiles; slot; slot = slot->next) {
+        if (slot->written_jobs != slot->jobs) {
+            write_jobs_file(slot, slot->jobs, log_fp);
+        }
+    }
+}
+
+// Function that writes the jobs files changed by scheduler_try_acquire (taking CPU tokens back from the compilations)
+void scheduler_publish_jobs(resource_scheduler_t *sched, FILE *log_fp) {
+    pthread_mutex_lock(&sched->lock);
+    write_compile_jobs(sched, log_fp);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+// Function that gives back to the budget the tokens of a stage. The CPU tokens left free go to the compilations in flight
+void scheduler_release(resource_scheduler_t *sched, const resource_request_t *granted, FILE *log_fp) {
+    pthread_mutex_lock(&sched->lock);
+    sched->cpu_used -= granted->cpu;
+    sched->mem_used_mb -= granted->mem_mb;
+    sched->io_used -= granted->io;
+    sched->net_used -= granted->net;
+    sched->running--;
+    rebalance_compiles(sched, 0);
+    write_compile_jobs(sched, log_fp);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+// Function that registers a compilation in flight, admitted with admitted_cpu CPU tokens, and returns its make/ninja jobs (written to
+// slot->jobs_file as well). The slot must stay valid until scheduler_compile_end
+int scheduler_compile_begin(resource_scheduler_t *sched, compile_slot_t *slot, int admitted_cpu, FILE *log_fp) {
+    pthread_mutex_lock(&sched->lock);
+    slot->admitted_cpu = admitted_cpu;
+    slot->written_jobs = 0;
+    // The admission tokens are already in cpu_used: a compilation admitted without CPU tokens still takes one for its job
+    slot->jobs = admitted_cpu;
+    if (slot->jobs < 1) {
+        slot->jobs = 1;
+        sched->cpu_used++;
+    }
+    slot->next = sched->compiles;
+    sched->compiles = slot;
+    sched->compiles_in_flight++;
+    rebalance_compiles(sched, 0);
+    write_compile_jobs(sched, log_fp);
+    int jobs = slot->jobs;
+    pthread_mutex_unlock(&sched->lock);
+    return jobs;
+}
+
+// Function that unregisters a compilation, giving back the CPU tokens it held beyond its admission ones (those are released by the pool
+// when the stage ends), and gives them to the compilations still running
+void scheduler_compile_end(resource_scheduler_t *sched, compile_slot_t *slot, FILE *log_fp) {
+    pthread_mutex_lock(&sched->lock);
+    for (compile_slot_t **link = &sched->compiles; *link; link = &(*link)->next) {
+        if (*link == slot) {
+            *link = slot->next;
+            sched->compiles_in_flight--;
+            sched->cpu_used -= slot->jobs - slot->admitted_cpu;
+            break;
+        }
+    }
+    slot->next = NULL;
+    rebalance_compiles(sched, 0);
+    write_compile_jobs(sched, log_fp);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void scheduler_destroy(resource_scheduler_t *sched) {
+    pthread_mutex_destroy(&sched->lock);
+}
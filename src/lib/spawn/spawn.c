@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "spawn/spawn.h"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define SPAWN_POLL_MS 200                               // Without a pidfd, how often the child is checked with waitpid
+
+extern char **environ;
+
+// Output of one pipe of the child, accumulated until a whole line can be written to the log
+typedef struct {
+    int fd;
+    char line[SPAWN_LINE_LEN];
+    size_t len;
+} output_stream_t;
+
+// Function that opens a pidfd for the child (Linux >= 5.3). Returns -1 if the kernel does not support it
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Function that writes the complete lines of a stream to the log, keeping the last partial line (all of it if flush is set)
+static void write_lines(output_stream_t *stream, FILE *output_fp, int flush) {
+    size_t start = 0;
+    for (size_t i = 0; i < stream->len; i++) {
+        if (stream->line[i] == '\n') {
+            fwrite(stream->line + start, 1, i + 1 - start, output_fp);
+            start = i + 1;
+        }
+    }
+    if (flush || (start == 0 && stream->len == sizeof(stream->line))) {
+        // A line longer than the buffer is split, a partial line at the end of the output gets its newline
+        if (start < stream->len) {
+            fwrite(stream->line + start, 1, stream->len - start, output_fp);
+            fputc('\n', output_fp);
+        }
+        start = stream->len;
+    }
+    memmove(stream->line, stream->line + start, stream->len - start);
+    stream->len -= start;
+}
+
+// Function that reads what is available on a pipe of the child. Returns 0 while the pipe is open, 1 at the end of the output (or on errors)
+static int read_stream(output_stream_t *stream, FILE *output_fp) {
+    while (1) {
+        ssize_t n = read(stream->fd, stream->line + stream->len, sizeof(stream->line) - stream->len);
+        if (n > 0) {
+            stream->len += (size_t)n;
+            write_lines(stream, output_fp, 0);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        write_lines(stream, output_fp, 1);
+        return 1;
+    }
+}
+
+// Function that turns a wait status into a spawn_status_t
+static void decode_status(const siginfo_t *info, spawn_status_t *status) {
+    memset(status, 0, sizeof(*status));
+    if (info->si_code == CLD_EXITED) {
+        status->exited = 1;
+        status->exit_code = info->si_status;
+    } else {
+        status->term_signal = info->si_status;
+        status->core_dumped = info->si_code == CLD_DUMPED;
+    }
+}
+
+// Function that reaps the child: the exit is seen through its pidfd when there is one, otherwise with its pid. With nohang set it returns 1
+// if the child is still running. Returns 0 once the child is reaped, -1 on errors.
+// Note: waitid does not return the resources used by the child, so it only waits for the exit (WNOWAIT) and wait4 reaps the child
+// (the pid cannot be reused before that)
+static int reap_child(spawned_process_t *child, spawn_status_t *status, int nohang) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    int options = WEXITED | WNOWAIT | (nohang ? WNOHANG : 0);
+    int rc;
+    do {
+        rc = child->pidfd >= 0 ? waitid((idtype_t)P_PIDFD, (id_t)child->pidfd, &info, options) : waitid(P_PID, (id_t)child->pid, &info, options);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == -1) {
+        return -1;
+    }
+    if (info.si_pid == 0) {
+        return 1;
+    }
+    decode_status(&info, status);
+
+    // The child is still a zombie, so its process group cannot be reused yet: after a cancellation, whatever the script left behind goes
+    // with it. Its slot is cleared before the pid is released, so spawn_cancel never signals a process group reused by someone else
+    if (child->cancel) {
+        pthread_mutex_lock(&child->cancel->lock);
+        if (child->cancel->cancelled) {
+            kill(-child->pid, SIGKILL);
+        }
+        if (child->cancel_slot >= 0) {
+            child->cancel->process_groups[child->cancel_slot] = 0;
+            child->cancel_slot = -1;
+        }
+        pthread_mutex_unlock(&child->cancel->lock);
+    }
+
+    int wait_status;
+    pid_t pid;
+    do {
+        pid = wait4(child->pid, &wait_status, 0, &status->usage);
+    } while (pid == -1 && errno == EINTR);
+    return pid == child->pid ? 0 : -1;
+}
+
+// Function that starts a program with a direct exec of argv, without a shell (argv[0] is looked up in PATH unless it contains a slash).
+// The child gets /dev/null as stdin, a pipe for stdout and one for stderr, read by spawn_wait, and its own process group (the one of
+// everything it starts, see spawn_cancel). Returns 0 on success, 1 otherwise
+int spawn_process(const char *const argv[], spawned_process_t *child, FILE *log_fp) {
+    child->pid = -1;
+    child->pidfd = -1;
+    child->stdout_fd = -1;
+    child->stderr_fd = -1;
+    child->cancel = NULL;
+    child->cancel_slot = -1;
+
+    // O_CLOEXEC: the pipes of a child must not leak into the children spawned at the same time by the other threads, or the end of its output
+    // would only be seen when all of them exit
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+        fprintf(log_fp, "Error: Failed to create the output pipe for %s: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        fprintf(log_fp, "Error: Failed to create the error pipe for %s: %s\n", argv[0], strerror(errno));
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return 1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+
+    // The child starts with the default signal dispositions and an empty mask (the daemon blocks the termination signals, see event_loop_init)
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t empty_set, default_set;
+    sigemptyset(&empty_set);
+    sigemptyset(&default_set);
+    sigaddset(&default_set, SIGTERM);
+    sigaddset(&default_set, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &empty_set);
+    posix_spawnattr_setsigdefault(&attr, &default_set);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    pid_t pid;
+    int spawn_error = posix_spawnp(&pid, argv[0], &actions, &attr, (char *const *)argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+
+    if (spawn_error != 0) {
+        fprintf(log_fp, "Error: Failed to start %s: %s%s\n", argv[0], strerror(spawn_error),
+                spawn_error == EACCES ? " (the script must be executable: chmod +x)" : "");
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return 1;
+    }
+
+    child->pid = pid;
+    child->pidfd = open_pidfd(pid);
+    child->stdout_fd = out_pipe[0];
+    child->stderr_fd = err_pipe[0];
+    fcntl(child->stdout_fd, F_SETFL, O_NONBLOCK);
+    fcntl(child->stderr_fd, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+// Function that streams the stdout and stderr of the child to output_fp (a line at a time) until the child exits, then reaps it.
+// The child is waited on through its pidfd, not through the end of its output: a background process that inherited the pipes
+// cannot keep the caller waiting. A child registered with a cancellation is checked every SPAWN_POLL_MS: once cancelled, it has
+// SPAWN_KILL_GRACE_MS to exit on the SIGTERM of spawn_cancel before its process group is killed.
+// Returns 0 once the child is reaped (its exit is in status), 1 on errors
+int spawn_wait(spawned_process_t *child, FILE *output_fp, spawn_status_t *status, FILE *log_fp) {
+    output_stream_t *streams = calloc(2, sizeof(output_stream_t));
+    if (!streams) {
+        fprintf(log_fp, "Warning: Out of memory while reading the output of %d, the output will be discarded.\n", (int)child->pid);
+    } else {
+        streams[0].fd = child->stdout_fd;
+        streams[1].fd = child->stderr_fd;
+    }
+
+    int open_streams = streams ? 2 : 0;
+    int reaped = 0;
+    int result = 0;
+    int killed = 0;
+    struct timespec cancelled_at = {0, 0};
+    while (!reaped) {
+        struct pollfd fds[3];
+        int nfds = 0;
+        for (int i = 0; streams && i < 2; i++) {
+            if (streams[i].fd >= 0) {
+                fds[nfds].fd = streams[i].fd;
+                fds[nfds].events = POLLIN;
+                nfds++;
+            }
+        }
+        int pidfd_index = -1;
+        if (child->pidfd >= 0) {
+            pidfd_index = nfds;
+            fds[nfds].fd = child->pidfd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+
+        int ready = poll(fds, nfds, (child->pidfd >= 0 && !child->cancel) ? -1 : SPAWN_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(log_fp, "Error: Failed to wait for the child %d: %s\n", (int)child->pid, strerror(errno));
+            result = 1;
+            break;
+        }
+
+        if (child->cancel && !killed && spawn_cancelled(child->cancel)) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (cancelled_at.tv_sec == 0 && cancelled_at.tv_nsec == 0) {
+                cancelled_at = now;
+            } else if ((now.tv_sec - cancelled_at.tv_sec) * 1000 + (now.tv_nsec - cancelled_at.tv_nsec) / 1000000 >= SPAWN_KILL_GRACE_MS) {
+                fprintf(log_fp, "Warning: %d did not exit %d ms after the cancellation, killing its process group.\n", (int)child->pid, SPAWN_KILL_GRACE_MS);
+                kill(-child->pid, SIGKILL);
+                killed = 1;
+            }
+        }
+
+        for (int i = 0; streams && i < 2; i++) {
+            if (streams[i].fd >= 0 && read_stream(&streams[i], output_fp) != 0) {
+                close(streams[i].fd);
+                streams[i].fd = -1;
+                open_streams--;
+            }
+        }
+
+        // The pidfd becomes readable when the child exits. Without a pidfd the child is polled, and waited for (blocking) after the end of its output
+        if (pidfd_index >= 0 && !(fds[pidfd_index].revents & POLLIN)) {
+            continue;
+        }
+        int rc = reap_child(child, status, child->pidfd >= 0 || open_streams > 0);
+        if (rc < 0) {
+            fprintf(log_fp, "Error: Failed to reap the child %d: %s\n", (int)child->pid, strerror(errno));
+            result = 1;
+            break;
+        }
+        reaped = rc == 0;
+    }
+
+    // What the child wrote before exiting is still in the pipes
+    for (int i = 0; streams && i < 2; i++) {
+        if (streams[i].fd >= 0) {
+            read_stream(&streams[i], output_fp);
+            write_lines(&streams[i], output_fp, 1);
+        }
+    }
+    fflush(output_fp);
+
+    free(streams);
+    close(child->stdout_fd);
+    close(child->stderr_fd);
+    if (child->pidfd >= 0) {
+        close(child->pidfd);
+    }
+    child->stdout_fd = child->stderr_fd = child->pidfd = -1;
+    return result;
+}
+
+// Function that runs a program to completion (see spawn_process and spawn_wait), streaming its output to output_fp.
+// If cancel is not NULL the child is registered with it while it runs, and nothing is started once it has been cancelled
+int spawn_run(const char *const argv[], FILE *output_fp, spawn_status_t *status, spawn_cancel_t *cancel, FILE *log_fp) {
+    spawned_process_t child;
+    if (!cancel) {
+        if (spawn_process(argv, &child, log_fp) != 0) {
+            return 1;
+        }
+        return spawn_wait(&child, output_fp, status, log_fp);
+    }
+
+    // The child is registered before the lock is released: a cancellation either prevents the start or finds its process group
+    pthread_mutex_lock(&cancel->lock);
+    if (cancel->cancelled) {
+        pthread_mutex_unlock(&cancel->lock);
+        fprintf(log_fp, "Error: %s not started: the build was cancelled.\n", argv[0]);
+        return 1;
+    }
+    if (spawn_process(argv, &child, log_fp) != 0) {
+        pthread_mutex_unlock(&cancel->lock);
+        return 1;
+    }
+    for (int i = 0; i < BUILD_STAGE_WIDTH && child.cancel_slot < 0; i++) {
+        if (cancel->process_groups[i] == 0) {
+            child.cancel_slot = i;
+            cancel->process_groups[i] = child.pid;
+        }
+    }
+    child.cancel = cancel;
+    pthread_mutex_unlock(&cancel->lock);
+
+    int result = spawn_wait(&child, output_fp, status, log_fp);
+
+    // The slot is still taken only if the child could not be reaped (see reap_child)
+    if (child.cancel_slot >= 0) {
+        pthread_mutex_lock(&cancel->lock);
+        cancel->process_groups[child.cancel_slot] = 0;
+        pthread_mutex_unlock(&cancel->lock);
+    }
+    return result;
+}
+
+// Function that prepares the cancellation of the builds of a pipeline (not cancelled, no script running)
+void spawn_cancel_init(spawn_cancel_t *cancel) {
+    memset(cancel, 0, sizeof(*cancel));
+    pthread_mutex_init(&cancel->lock, NULL);
+}
+
+// Function that cancels a build: its scripts not started yet will not start, and the running ones get a SIGTERM to their whole process
+// group (see spawn_wait for the SIGKILL that follows). Returns the number of scripts signalled
+int spawn_cancel(spawn_cancel_t *cancel) {
+    int signalled = 0;
+    pthread_mutex_lock(&cancel->lock);
+    cancel->cancelled = 1;
+    for (int i = 0; i < BUILD_STAGE_WIDTH; i++) {
+        if (cancel->process_groups[i] > 0 && kill(-cancel->process_groups[i], SIGTERM) == 0) {
+            signalled++;
+        }
+    }
+    pthread_mutex_unlock(&cancel->lock);
+    return signalled;
+}
+
+// Function that returns 1 if the build has been cancelled, 0 otherwise
+int spawn_cancelled(spawn_cancel_t *cancel) {
+    pthread_mutex_lock(&cancel->lock);
+    int cancelled = cancel->cancelled;
+    pthread_mutex_unlock(&cancel->lock);
+    return cancelled;
+}
+
+// Function that clears the cancellation once the cancelled build is over, so that its cleanup and the next builds can run scripts again
+void spawn_cancel_reset(spawn_cancel_t *cancel) {
+    pthread_mutex_lock(&cancel->lock);
+    cancel->cancelled = 0;
+    pthread_mutex_unlock(&cancel->lock);
+}
+
+// Function that releases the cancellation of a pipeline (no script of its builds may be running)
+void spawn_cancel_destroy(spawn_cancel_t *cancel) {
+    pthread_mutex_destroy(&cancel->lock);
+}
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "sync/sync.h"
+
+#define SYNC_PATH_LEN 4096
+#define SYNC_COMPARE_BUF_LEN 65536
+
+// Entries never synchronized: the history of the repositories is not needed to build
+static int is_excluded(const char *name) {
+    return strcmp(name, ".git") == 0;
+}
+
+// Function that joins a directory and an entry name, returns 1 if the path does not fit
+static int join_path(char *out, size_t out_len, const char *dir, const char *name) {
+    int written = snprintf(out, out_len, "%s/%s", dir, name);
+    return (written < 0 || (size_t)written >= out_len) ? 1 : 0;
+}
+
+// Function that creates a directory and all its missing parents (like mkdir -p)
+static int mkdir_parents(const char *path, FILE *log_fp) {
+    char buffer[SYNC_PATH_LEN];
+    if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer)) {
+        fprintf(log_fp, "Error: Path too long: %s\n", path);
+        return 1;
+    }
+
+    for (char *p = buffer + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(buffer, 0755) == -1 && errno != EEXIST) {
+            fprintf(log_fp, "Error: Failed to create directory %s: %s\n", buffer, strerror(errno));
+            return 1;
+        }
+        *p = '/';
+    }
+    if (mkdir(buffer, 0755) == -1 && errno != EEXIST) {
+        fprintf(log_fp, "Error: Failed to create directory %s: %s\n", buffer, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Function that removes a file, a link or a whole directory tree of the destination
+static int remove_entry(const char *path, sync_stats_t *stats, FILE *log_fp) {
+    struct stat st;
+    if (lstat(path, &st) == -1) {
+        return errno == ENOENT ? 0 : 1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (!dir) {
+            fprintf(log_fp, "Error: Failed to open directory %s for removal: %s\n", path, strerror(errno));
+            return 1;
+        }
+        struct dirent *entry;
+        char child[SYNC_PATH_LEN];
+        int status = 0;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            if (join_path(child, sizeof(child), path, entry->d_name) != 0 || remove_entry(child, stats, log_fp) != 0) {
+                status = 1;
+            }
+        }
+        closedir(dir);
+        if (status != 0 || rmdir(path) == -1) {
+            fprintf(log_fp, "Error: Failed to remove directory %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    } else if (unlink(path) == -1) {
+        fprintf(log_fp, "Error: Failed to remove %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    stats->entries_removed++;
+    return 0;
+}
+
+// Function that removes a file, a link or a whole directory tree (e.g. a source snapshot no longer used by any build)
+int remove_tree(const char *path, FILE *log_fp) {
+    sync_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    return remove_entry(path, &stats, log_fp);
+}
+
+// Function that checks if two regular files of the same size have the same content. Returns 1 if equal, 0 if not (or on read errors)
+static int same_content(const char *path_a, const char *path_b) {
+    int fd_a = open(path_a, O_RDONLY | O_CLOEXEC);
+    if (fd_a == -1) {
+        return 0;
+    }
+    int fd_b = open(path_b, O_RDONLY | O_CLOEXEC);
+    if (fd_b == -1) {
+        close(fd_a);
+        return 0;
+    }
+
+    char buf_a[SYNC_COMPARE_BUF_LEN];
+    char buf_b[SYNC_COMPARE_BUF_LEN];
+    int equal = 1;
+    for (;;) {
+        ssize_t read_a = read(fd_a, buf_a, sizeof(buf_a));
+        if (read_a <= 0) {
+            equal = read_a == 0 && read(fd_b, buf_b, 1) == 0;
+            break;
+        }
+        ssize_t read_b = 0;
+        while (read_b < read_a) {
+            ssize_t chunk = read(fd_b, buf_b + read_b, read_a - read_b);
+            if (chunk <= 0) {
+                break;
+            }
+            read_b += chunk;
+        }
+        if (read_b != read_a || memcmp(buf_a, buf_b, read_a) != 0) {
+            equal = 0;
+            break;
+        }
+    }
+
+    close(fd_a);
+    close(fd_b);
+    return equal;
+}
+
+// Function that writes the data of src_fd into dst_fd: reflink first (no data written on btrfs/xfs), then copy_file_range
+// (done inside the kernel, server-side on network filesystems), then a plain read/write loop.
+// Returns 0 on success and sets *cloned when the reflink succeeded
+static int copy_data(int src_fd, int dst_fd, off_t size, int *cloned, long long *bytes_copied) {
+    *cloned = 0;
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        *cloned = 1;
+        return 0;
+    }
+
+    off_t copied = 0;
+    while (copied < size) {
+        ssize_t chunk = copy_file_range(src_fd, NULL, dst_fd, NULL, size - copied, 0);
+        if (chunk <= 0) {
+            break;
+        }
+        copied += chunk;
+    }
+
+    if (copied < size) {
+        // copy_file_range not supported between these filesystems (EXDEV/ENOSYS/EINVAL): go on with read/write from where it stopped
+        char buffer[SYNC_COMPARE_BUF_LEN];
+        if (lseek(src_fd, copied, SEEK_SET) == -1 || lseek(dst_fd, copied, SEEK_SET) == -1) {
+            return 1;
+        }
+        ssize_t read_bytes;
+        while ((read_bytes = read(src_fd, buffer, sizeof(buffer))) > 0) {
+            ssize_t written = 0;
+            while (written < read_bytes) {
+                ssize_t chunk = write(dst_fd, buffer + written, read_bytes - written);
+                if (chunk <= 0) {
+                    return 1;
+                }
+                written += chunk;
+            }
+            copied += read_bytes;
+        }
+        if (read_bytes < 0) {
+            return 1;
+        }
+    }
+
+    *bytes_copied += copied;
+    return 0;
+}
+
+// Function that brings a regular file of the destination up to date with the source one.
+// The new version is prepared under a temporary name and renamed over the old one, so the destination never holds a half-written file
+static int sync_file(const char *src, const struct stat *src_st, const char *dst, sync_stats_t *stats, FILE *log_fp) {
+    struct stat dst_st;
+    if (lstat(dst, &dst_st) == 0) {
+        if (S_ISREG(dst_st.st_mode)) {
+            // Hardlinked in a previous round and not replaced on the host since then
+            if (dst_st.st_dev == src_st->st_dev && dst_st.st_ino == src_st->st_ino) {
+                stats->files_unchanged++;
+                return 0;
+            }
+            // Copied in a previous round: comparing the content only costs reads, and it does not depend on mtimes (e.g. git checkouts)
+            if (dst_st.st_size == src_st->st_size && same_content(src, dst)) {
+                if ((dst_st.st_mode & 07777) != (src_st->st_mode & 07777)) {
+                    chmod(dst, src_st->st_mode & 07777);
+                }
+                stats->files_unchanged++;
+                return 0;
+            }
+        } else if (remove_entry(dst, stats, log_fp) != 0) {
+            return 1;
+        }
+    }
+
+    char tmp[SYNC_PATH_LEN];
+    if (snprintf(tmp, sizeof(tmp), "%s.sync-tmp", dst) >= (int)sizeof(tmp)) {
+        fprintf(log_fp, "Error: Path too long: %s\n", dst);
+        return 1;
+    }
+    unlink(tmp);
+
+    // A hardlink writes no data at all. It is safe because the synced tree is only read by the builds (it is a lower layer of their
+    // overlay, so their writes are copied up) and the source is an immutable snapshot, never rewritten in place
+    if (link(src, tmp) == 0) {
+        if (rename(tmp, dst) == -1) {
+            fprintf(log_fp, "Error: Failed to rename %s to %s: %s\n", tmp, dst, strerror(errno));
+            unlink(tmp);
+            return 1;
+        }
+        stats->files_linked++;
+        return 0;
+    }
+
+    int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) {
+        fprintf(log_fp, "Error: Failed to open %s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    int dst_fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, src_st->st_mode & 07777);
+    if (dst_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create %s: %s\n", tmp, strerror(errno));
+        close(src_fd);
+        return 1;
+    }
+
+    int cloned = 0;
+    int status = copy_data(src_fd, dst_fd, src_st->st_size, &cloned, &stats->bytes_copied);
+    if (status == 0 && fchmod(dst_fd, src_st->st_mode & 07777) == -1) {
+        status = 1;
+    }
+    close(src_fd);
+    if (close(dst_fd) == -1) {
+        status = 1;
+    }
+    if (status != 0 || rename(tmp, dst) == -1) {
+        fprintf(log_fp, "Error: Failed to copy %s to %s: %s\n", src, dst, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+
+    if (cloned) {
+        stats->files_cloned++;
+    } else {
+        stats->files_copied++;
+    }
+    return 0;
+}
+
+// Function that recreates a symbolic link of the source in the destination, if missing or pointing elsewhere
+static int sync_symlink(const char *src, const char *dst, sync_stats_t *stats, FILE *log_fp) {
+    char src_target[SYNC_PATH_LEN];
+    ssize_t src_len = readlink(src, src_target, sizeof(src_target) - 1);
+    if (src_len == -1) {
+        fprintf(log_fp, "Error: Failed to read link %s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    src_target[src_len] = '\0';
+
+    char dst_target[SYNC_PATH_LEN];
+    ssize_t dst_len = readlink(dst, dst_target, sizeof(dst_target) - 1);
+    if (dst_len == src_len && memcmp(src_target, dst_target, src_len) == 0) {
+        stats->files_unchanged++;
+        return 0;
+    }
+
+    if (remove_entry(dst, stats, log_fp) != 0) {
+        return 1;
+    }
+    if (symlink(src_target, dst) == -1) {
+        fprintf(log_fp, "Error: Failed to create link %s: %s\n", dst, strerror(errno));
+        return 1;
+    }
+    stats->files_copied++;
+    return 0;
+}
+
+// Function that synchronizes the content of src_dir into dst_dir (which must exist), recursively
+static int sync_dir(const char *src_dir, const char *dst_dir, sync_stats_t *stats, FILE *log_fp) {
+    DIR *dir = opendir(src_dir);
+    if (!dir) {
+        fprintf(log_fp, "Error: Failed to open source directory %s: %s\n", src_dir, strerror(errno));
+        return 1;
+    }
+
+    struct dirent *entry;
+    char src_path[SYNC_PATH_LEN];
+    char dst_path[SYNC_PATH_LEN];
+    int status = 0;
+
+    // First pass: every entry of the source is created or updated in the destination
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || is_excluded(entry->d_name)) {
+            continue;
+        }
+        if (join_path(src_path, sizeof(src_path), src_dir, entry->d_name) != 0 ||
+            join_path(dst_path, sizeof(dst_path), dst_dir, entry->d_name) != 0) {
+            fprintf(log_fp, "Error: Path too long under %s: %s\n", src_dir, entry->d_name);
+            status = 1;
+            break;
+        }
+
+        struct stat src_st;
+        if (lstat(src_path, &src_st) == -1) {
+            fprintf(log_fp, "Error: Failed to stat %s: %s\n", src_path, strerror(errno));
+            status = 1;
+            break;
+        }
+
+        if (S_ISDIR(src_st.st_mode)) {
+            struct stat dst_st;
+            if (lstat(dst_path, &dst_st) == 0 && !S_ISDIR(dst_st.st_mode)) {
+                if (remove_entry(dst_path, stats, log_fp) != 0) {
+                    status = 1;
+                    break;
+                }
+            }
+            if (mkdir(dst_path, src_st.st_mode & 07777) == -1 && errno != EEXIST) {
+                fprintf(log_fp, "Error: Failed to create directory %s: %s\n", dst_path, strerror(errno));
+                status = 1;
+                break;
+            }
+            if (sync_dir(src_path, dst_path, stats, log_fp) != 0) {
+                status = 1;
+                break;
+            }
+        } else if (S_ISREG(src_st.st_mode)) {
+            if (sync_file(src_path, &src_st, dst_path, stats, log_fp) != 0) {
+                status = 1;
+                break;
+            }
+        } else if (S_ISLNK(src_st.st_mode)) {
+            if (sync_symlink(src_path, dst_path, stats, log_fp) != 0) {
+                status = 1;
+                break;
+            }
+        }
+        // Sockets, fifos and devices are not part of a source tree: they are ignored
+    }
+    closedir(dir);
+    if (status != 0) {
+        return status;
+    }
+
+    // Second pass: what is left in the destination but no longer in the source (or excluded) is removed
+    dir = opendir(dst_dir);
+    if (!dir) {
+        fprintf(log_fp, "Error: Failed to open destination directory %s: %s\n", dst_dir, strerror(errno));
+        return 1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (join_path(src_path, sizeof(src_path), src_dir, entry->d_name) != 0 ||
+            join_path(dst_path, sizeof(dst_path), dst_dir, entry->d_name) != 0) {
+            status = 1;
+            continue;
+        }
+        struct stat src_st;
+        if (is_excluded(entry->d_name) || (lstat(src_path, &src_st) == -1 && errno == ENOENT)) {
+            if (remove_entry(dst_path, stats, log_fp) != 0) {
+                status = 1;
+            }
+        }
+    }
+    closedir(dir);
+
+    return status;
+}
+
+// Function that makes dst_dir an exact copy of src_dir (except the .git directories), touching only what changed since the last sync:
+// unchanged files are detected by inode (hardlinked files) or by size and content, new or changed files are hardlinked when source
+// and destination are on the same filesystem, otherwise reflinked or copied with copy_file_range, and extraneous entries are removed.
+// The destination is left in place after the sync, so the next round only pays for the files changed by the new commits.
+// Note: unchanged files keep their inode and their mtime, so the build tools only see as modified the files that really changed
+int sync_tree(const char *src_dir, const char *dst_dir, sync_stats_t *stats, FILE *log_fp) {
+    memset(stats, 0, sizeof(*stats));
+
+    struct stat src_st;
+    if (stat(src_dir, &src_st) == -1 || !S_ISDIR(src_st.st_mode)) {
+        fprintf(log_fp, "Error: Source directory %s does not exist or is not a directory.\n", src_dir);
+        return 1;
+    }
+    if (mkdir_parents(dst_dir, log_fp) != 0) {
+        return 1;
+    }
+
+    return sync_dir(src_dir, dst_dir, stats, log_fp);
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "task/task.h"
+#include "logmux/logmux.h"
+
+// Task runner thread: runs the queued tasks one at a time, each one with its own log stream, until the runner is destroyed
+static void *task_worker(void *arg) {
+    task_runner_t *runner = arg;
+
+    pthread_mutex_lock(&runner->lock);
+    while (1) {
+        loop_task_t *task = runner->pending_head;
+        if (!task) {
+            if (runner->shutting_down) {
+                break;
+            }
+            pthread_cond_wait(&runner->work_available, &runner->lock);
+            continue;
+        }
+        runner->pending_head = task->next;
+        if (!runner->pending_head) {
+            runner->pending_tail = NULL;
+        }
+        pthread_mutex_unlock(&runner->lock);
+
+        // The records of the task are tagged with its name in the main log, like the ones of the stages of the builds
+        FILE *task_fp = log_mux_open(runner->log_mux, task->name, task->tag, NULL);
+        task->status = task->run(task, task_fp ? task_fp : runner->log_fp);
+        if (task_fp) {
+            fclose(task_fp);
+        }
+
+        pthread_mutex_lock(&runner->lock);
+        task->next = NULL;
+        if (runner->completed_tail) {
+            runner->completed_tail->next = task;
+        } else {
+            runner->completed_head = task;
+        }
+        runner->completed_tail = task;
+
+        // The write can only fail if the counter is full, i.e. the main has not read it yet and will be woken up anyway
+        uint64_t one = 1;
+        ssize_t written = write(runner->completion_fd, &one, sizeof(one));
+        (void)written;
+    }
+    pthread_mutex_unlock(&runner->lock);
+
+    return NULL;
+}
+
+// Function that starts the threads of the runner. The completions are signalled on completion_fd, to be watched by the event loop
+// (see task_runner_next_completion)
+int task_runner_init(task_runner_t *runner, int num_threads, log_mux_t *log_mux, FILE *log_fp) {
+    memset(runner, 0, sizeof(*runner));
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    runner->log_mux = log_mux;
+    runner->log_fp = log_fp;
+
+    runner->threads = calloc(num_threads, sizeof(pthread_t));
+    if (!runner->threads) {
+        fprintf(log_fp, "Error: Out of memory while creating the task runner.\n");
+        return 1;
+    }
+    runner->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (runner->completion_fd == -1) {
+        fprintf(log_fp, "Error: Failed to create the completion eventfd of the task runner: %s\n", strerror(errno));
+        free(runner->threads);
+        return 1;
+    }
+    if (pthread_mutex_init(&runner->lock, NULL) != 0 ||
+        pthread_cond_init(&runner->work_available, NULL) != 0) {
+        fprintf(log_fp, "Error: Failed to initialize the synchronization of the task runner.\n");
+        close(runner->completion_fd);
+        free(runner->threads);
+        return 1;
+    }
+
+    // Note: like the ones of the worker pool, the threads inherit the signal mask of the main
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&runner->threads[i], NULL, task_worker, runner) != 0) {
+            fprintf(log_fp, "Warning: Failed to create thread %d of the task runner, continuing with %d threads.\n", i, i);
+            break;
+        }
+        runner->num_threads++;
+    }
+
+    if (runner->num_threads == 0) {
+        fprintf(log_fp, "Error: Could not create any task thread.\n");
+        task_runner_destroy(runner);
+        return 1;
+    }
+    return 0;
+}
+
+// Function that queues a task. The task (and its data) must stay valid, and must not be touched, until it is returned by task_runner_next_completion
+void task_runner_submit(task_runner_t *runner, loop_task_t *task) {
+    task->status = 0;
+    task->in_flight = 1;
+    task->next = NULL;
+
+    pthread_mutex_lock(&runner->lock);
+    if (runner->pending_tail) {
+        runner->pending_tail->next = task;
+    } else {
+        runner->pending_head = task;
+    }
+    runner->pending_tail = task;
+    pthread_cond_signal(&runner->work_available);
+    pthread_mutex_unlock(&runner->lock);
+}
+
+// Function that takes the oldest completed task off the completion queue. Returns NULL when no task has completed.
+// The main calls it when completion_fd becomes readable, until it returns NULL (the eventfd is reset by the read)
+loop_task_t *task_runner_next_completion(task_runner_t *runner) {
+    uint64_t count;
+    ssize_t read_bytes = read(runner->completion_fd, &count, sizeof(count));
+    (void)read_bytes;
+
+    pthread_mutex_lock(&runner->lock);
+    loop_task_t *task = runner->completed_head;
+    if (task) {
+        runner->completed_head = task->next;
+        if (!runner->completed_head) {
+            runner->completed_tail = NULL;
+        }
+        task->next = NULL;
+        task->in_flight = 0;
+    }
+    pthread_mutex_unlock(&runner->lock);
+    return task;
+}
+
+// Function that stops the runner: the threads run the tasks still queued, then exit
+void task_runner_destroy(task_runner_t *runner) {
+    pthread_mutex_lock(&runner->lock);
+    runner->shutting_down = 1;
+    pthread_cond_broadcast(&runner->work_available);
+    pthread_mutex_unlock(&runner->lock);
+
+    for (int i = 0; i < runner->num_threads; i++) {
+        pthread_join(runner->threads[i], NULL);
+    }
+    free(runner->threads);
+    runner->threads = NULL;
+    runner->num_threads = 0;
+
+    pthread_cond_destroy(&runner->work_available);
+    pthread_mutex_destroy(&runner->lock);
+    close(runner->completion_fd);
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "trace/trace.h"
+
+// Timeline of a round (the builds of one generation) in the trace-event JSON format, to be loaded into chrome://tracing or ui.perfetto.dev.
+// The file is in the "JSON Array Format" without the closing ']', which the format allows: the events of each build are appended when
+// the build is collected, without rewriting the file. Every event belongs to process 1 (the daemon), the tracks are its threads:
+// track 0 is the poll, each architecture has BUILD_STAGE_WIDTH tracks (its stages, and the stages running alongside them)
+
+#define TRACE_PID 1
+#define TRACE_POLL_TID 0
+
+// Function that returns the track of a lane of an architecture
+static int arch_tid(int arch, int lane) {
+    return 1 + arch * BUILD_STAGE_WIDTH + lane;
+}
+
+// Function that returns a CLOCK_MONOTONIC time in microseconds since the poll that found the generation (the origin of its timeline)
+static long long trace_us(const build_generation_t *generation, const struct timespec *t) {
+    long long us = (long long)(t->tv_sec - generation->found_at.tv_sec) * 1000000LL + (t->tv_nsec - generation->found_at.tv_nsec) / 1000;
+    return us < 0 ? 0 : us;
+}
+
+static double timeval_seconds(const struct timeval *t) {
+    return (double)t->tv_sec + (double)t->tv_usec / 1e6;
+}
+
+// Function that writes the metadata event naming a track (and fixing its position in the viewer)
+static void write_track_name(FILE *fp, int tid, const char *name, const char *suffix) {
+    fprintf(fp, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s%s\"}}\n", TRACE_PID, tid, name, suffix);
+    fprintf(fp, ",{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}\n", TRACE_PID, tid, tid);
+}
+
+// Function that closes the timeline after appending some events. Returns 0 on success, 1 otherwise
+static int close_trace(FILE *fp, const char *path, FILE *log_fp) {
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        fprintf(log_fp, "Warning: Failed to write the timeline %s.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+// Function that creates the timeline of a generation in traces_dir (created if missing), with its tracks and the span of the poll that
+// found it, and stores its path in the generation. It must be called right after the poll (the span ends now).
+// On errors the generation is left without timeline (trace_file empty). Returns 0 on success, 1 otherwise
+int trace_open_round(build_generation_t *generation, const char *traces_dir, char **arch_names, int num_archs, FILE *log_fp) {
+    generation->trace_file[0] = '\0';
+    if (mkdir(traces_dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(log_fp, "Warning: Failed to create the timelines directory %s: %s\n", traces_dir, strerror(errno));
+        return 1;
+    }
+
+    char path[sizeof(generation->trace_file)];
+    snprintf(path, sizeof(path), "%s/%s%lu-%s.json", traces_dir, TRACE_FILE_PREFIX, generation->id, generation->commits.new_release);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(log_fp, "Warning: Failed to create the timeline %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(fp, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"sshlirp_ci round %lu (release %s)\"}}\n",
+            TRACE_PID, generation->id, generation->commits.new_release);
+    write_track_name(fp, TRACE_POLL_TID, "poll", "");
+    for (int i = 0; i < num_archs; i++) {
+        write_track_name(fp, arch_tid(i, 0), arch_names[i], "");
+        for (int lane = 1; lane < BUILD_STAGE_WIDTH; lane++) {
+            write_track_name(fp, arch_tid(i, lane), arch_names[i], " (parallel stages)");
+        }
+    }
+    fprintf(fp, ",{\"name\":\"Poll\",\"cat\":\"poll\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":0,\"dur\":%lld,"
+                "\"args\":{\"sshlirp\":\"%s\",\"libslirp\":\"%s\",\"vdens\":\"%s\"}}\n",
+            TRACE_PID, TRACE_POLL_TID, trace_us(generation, &now),
+            generation->commits.sshlirp_commit, generation->commits.libslirp_commit, generation->commits.vdens_commit);
+
+    if (close_trace(fp, path, log_fp) != 0) {
+        return 1;
+    }
+    strcpy(generation->trace_file, path);
+    return 0;
+}
+
+// Function that marks on the track of an architecture the publication of the binary of the previous build (build avoided)
+void trace_record_reuse(const build_generation_t *generation, int arch, FILE *log_fp) {
+    if (generation->trace_file[0] == '\0') {
+        return;
+    }
+    FILE *fp = fopen(generation->trace_file, "a");
+    if (!fp) {
+        fprintf(log_fp, "Warning: Failed to open the timeline %s: %s\n", generation->trace_file, strerror(errno));
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(fp, ",{\"name\":\"Binary reused\",\"cat\":\"build\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%lld}\n",
+            TRACE_PID, arch_tid(arch, 0), trace_us(generation, &now));
+    close_trace(fp, generation->trace_file, log_fp);
+}
+
+// Function that appends a build of an architecture to the timeline of its generation: the span of the whole build (from its queueing to
+// now, its collection), the wait for the pool, the span of each stage run, with its accounting, and the spans of the sub-steps of the
+// stages. A stage that started while another one of the build was running goes to the next free track of the architecture
+void trace_record_build(const build_generation_t *generation, int arch, const struct timespec *queued_at, const thread_result_t *result, FILE *log_fp) {
+    if (generation->trace_file[0] == '\0') {
+        return;
+    }
+    FILE *fp = fopen(generation->trace_file, "a");
+    if (!fp) {
+        fprintf(log_fp, "Warning: Failed to open the timeline %s: %s\n", generation->trace_file, strerror(errno));
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long build_start = trace_us(generation, queued_at);
+    long long build_end = trace_us(generation, &now);
+    const char *outcome = !result ? "unknown" : (result->status == 0 ? "succeeded" : "failed");
+    fprintf(fp, ",{\"name\":\"Build\",\"cat\":\"build\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{\"result\":\"%s\"}}\n",
+            TRACE_PID, arch_tid(arch, 0), build_start, build_end - build_start, outcome);
+    if (!result) {
+        close_trace(fp, generation->trace_file, log_fp);
+        return;
+    }
+
+    // Stages in the order they started (insertion sort, there are at most BUILD_MAX_STAGES of them)
+    int order[BUILD_MAX_STAGES];
+    int num_run = 0;
+    for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+        if (result->stages[i].outcome == STAGE_OUTCOME_SKIPPED) {
+            continue;
+        }
+        long long start = trace_us(generation, &result->stages[i].start);
+        int j = num_run++;
+        while (j > 0 && trace_us(generation, &result->stages[order[j - 1]].start) > start) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    if (num_run > 0) {
+        long long first_start = trace_us(generation, &result->stages[order[0]].start);
+        fprintf(fp, ",{\"name\":\"Waiting for the pool\",\"cat\":\"build\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}\n",
+                TRACE_PID, arch_tid(arch, 0), build_start, first_start > build_start ? first_start - build_start : 0);
+    }
+
+    long long lane_end[BUILD_STAGE_WIDTH] = {0};
+    for (int k = 0; k < num_run; k++) {
+        const stage_result_t *stage = &result->stages[order[k]];
+        long long start = trace_us(generation, &stage->start);
+        long long end = trace_us(generation, &stage->end);
+        int lane = 0;
+        while (lane < BUILD_STAGE_WIDTH - 1 && lane_end[lane] > start) {
+            lane++;
+        }
+        lane_end[lane] = end;
+        int tid = arch_tid(arch, lane);
+
+        fprintf(fp, ",{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,"
+                    "\"args\":{\"tag\":\"%s\",\"outcome\":\"%s\",\"exit_status\":%d,\"term_signal\":%d,\"cpu_user_s\":%.3f,\"cpu_sys_s\":%.3f,"
+                    "\"max_rss_kb\":%ld,\"bytes_written\":%lld,\"scripts_run\":%d}}\n",
+                stage->name, TRACE_PID, tid, start, end - start,
+                stage->tag, stage->outcome == STAGE_OUTCOME_DONE ? "done" : "failed", stage->exit_status, stage->term_signal,
+                timeval_seconds(&stage->cpu_user), timeval_seconds(&stage->cpu_sys), stage->max_rss_kb, stage->bytes_written, stage->scripts_run);
+
+        for (int s = 0; s < stage->num_steps; s++) {
+            const stage_step_t *step = &stage->steps[s];
+            long long step_start = trace_us(generation, &step->start);
+            long long step_end = (step->end.tv_sec == 0 && step->end.tv_nsec == 0) ? end : trace_us(generation, &step->end);
+            fprintf(fp, ",{\"name\":\"%s\",\"cat\":\"step\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}\n",
+                    step->name, TRACE_PID, tid, step_start, step_end > step_start ? step_end - step_start : 0);
+        }
+    }
+
+    close_trace(fp, generation->trace_file, log_fp);
+}
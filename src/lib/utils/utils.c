@@ -1,114 +1,70 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <execs.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include "types/types.h"
+#include "spawn/spawn.h"
 
-// Helper function to create, write, make executable, and then remove a temporary script
-// Note: this function is called for both git clone and check commit. In general, the return values of scripts launched with system_safes() are as follows:
+// Function that runs one of the host scripts (git clone, check commit, snapshot export, vdens patch). argv[0] is the path of the script,
+// which is executed directly (no shell) with the following arguments; its stdout and stderr are written to log_fp as they are produced.
+// Note: the return values of these scripts are as follows:
 // 1: error
 // 0: I did nothing (e.g., I have nothing to clone because the repo already exists or I haven't pulled anything new)
 // 2: I did something (e.g., I cloned the repo or pulled a new commit)
-// When errors occur outside the script (but still in this function), I return -1.
-int execute_script(
-    const char* script_path,
-    const char* arg1, 
-    const char* arg2, 
-    const char* arg3,
-    const char* arg4,
-    const char* arg5,
-    const char* versioning_file,
-    FILE* log_fp
-) {
-    if (chmod(script_path, 0700) == -1) {
-        fprintf(log_fp, "Failed to make script executable: %s\n", strerror(errno));
+// If the script cannot be started or it is killed by a signal, I return 1.
+int execute_script(const char* const argv[], FILE* log_fp) {
+    spawn_status_t status;
+    if (spawn_run(argv, log_fp, &status, NULL, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to run script %s\n", argv[0]);
         return 1;
     }
-    char command[MAX_COMMAND_LEN];
 
-    if (strcmp(script_path, GIT_CLONE_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, versioning_file);
-    } else if (strcmp(script_path, CHECK_COMMIT_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, arg4, arg5, versioning_file);
-    } else {
-        fprintf(log_fp, "Unknown script path: %s\n", script_path);
-        return 1;
+    if (status.exited) {
+        return status.exit_code;
     }
 
-    int status = system_safe(command);
+    // If the script did not terminate normally, print an error message
+    fprintf(log_fp, "Script %s terminated abnormally by signal %d (%s)%s\n", argv[0], status.term_signal, strsignal(status.term_signal), status.core_dumped ? ", core dumped" : "");
+    return 1;
+}
 
-    if (status == -1) {
-        fprintf(log_fp, "system_safe() call to execute temp script failed");
-        return 1;
+// Function that adds the resources used by a script to the accounting of its stage
+static void account_script(stage_result_t *accounting, const spawn_status_t *status) {
+    accounting->scripts_run++;
+    timeradd(&accounting->cpu_user, &status->usage.ru_utime, &accounting->cpu_user);
+    timeradd(&accounting->cpu_sys, &status->usage.ru_stime, &accounting->cpu_sys);
+    if (status->usage.ru_maxrss > accounting->max_rss_kb) {
+        accounting->max_rss_kb = status->usage.ru_maxrss;
     }
-    
-    if (WIFEXITED(status)) {
-        return WEXITSTATUS(status);
+    accounting->bytes_written += (long long)status->usage.ru_oublock * 512;
+    if (!status->exited) {
+        accounting->term_signal = status->term_signal;
     }
-
-    // If the script did not terminate normally, print an error message
-    fprintf(log_fp, "Script terminated abnormally. Status: %d\n", status);
-    return 1;
 }
 
-// Helper function to create, write, make executable, and then remove a temporary script inside a chroot
-// Note: unlike the previous function, this one only returns 0 (success) or 1 (error) as the executed scripts (chrootSetup, compile, copySrc, removeSrcCopy)
+// Function that runs one of the scripts of a build (chroot setup, provision, build layer, compile, test) like execute_script,
+// writing its output to the log stream of the stage and adding the resources it used to the accounting of the stage (if not NULL).
+// The script is registered with the cancellation of the build (args->cancel), which kills it together with everything it started
+// Note: unlike the previous function, this one only returns 0 (success) or 1 (error) as these scripts
 // do not need to return special values for the execution of other operations
-int execute_script_for_thread(
-    const char* arch,
-    const char* script_path,
-    const char* arg1,
-    const char* arg2,
-    const char* arg3,
-    const char* arg4,
-    const char* arg5,
-    const char* arg6,
-    const int sudo_user,
-    FILE* log_fp
-) {
-    if (chmod(script_path, 0700) == -1) {
-        fprintf(log_fp, "[Thread %s] Failed to make script executable: %s\n", arch, strerror(errno));
+int execute_script_for_thread(thread_args_t* args, const char* const argv[], stage_result_t* accounting, FILE* log_fp) {
+    const char* arch = args->arch;
+    spawn_status_t status;
+    if (spawn_run(argv, log_fp, &status, &args->cancel, log_fp) != 0) {
+        fprintf(log_fp, "[Thread %s] Error: Failed to run script %s\n", arch, argv[0]);
         return 1;
     }
-    char command[MAX_COMMAND_LEN];
-
-    if (strcmp(script_path, CHROOT_SETUP_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%d\"", script_path, arg1, arg2, arg3, arg4, sudo_user);
-    } else if (strcmp(script_path, COPY_SOURCE_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, arg4);
-    } else if (strcmp(script_path, COMPILE_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, arg4, arg5, arg6);
-    } else if (strcmp(script_path, REMOVE_SOURCE_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, arg4);
-    } else if (strcmp(script_path, MODIFY_VDENS_SCRIPT_PATH) == 0) {
-        snprintf(command, sizeof(command), "%s \"%s\" \"%s\"", script_path, arg1, arg2);
-    } else if (strcmp(script_path, TEST_SCRIPT_PATH) == 0) {
-        if (sudo_user) {
-            snprintf(command, sizeof(command), "%s \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"", script_path, arg1, arg2, arg3, arg4, arg5);
-        } else {
-            fprintf(log_fp, "Warning: [Thread %s - script runner engine] Insufficient permissions to execute script: %s. You cannot run the test script without sudo privileges.\n", arch, script_path);
-            return 1;
-        }
-    } else {
-        fprintf(log_fp, "[Thread %s] Unknown script path: %s\n", arch, script_path);
-        return 1;
+    if (accounting) {
+        account_script(accounting, &status);
     }
 
-    int status = system_safe(command);
-
-    if (status == -1) {
-        fprintf(log_fp, "system_safe() call to execute temp script failed");
-        return 1;
-    }
-    
-    if (WIFEXITED(status)) {
-        return WEXITSTATUS(status);
+    if (status.exited) {
+        return status.exit_code;
     }
 
-    fprintf(log_fp, "[Thread %s] Script terminated abnormally. Status: %d\n", arch, status);
+    fprintf(log_fp, "[Thread %s] Script %s terminated abnormally by signal %d (%s)%s\n", arch, argv[0], status.term_signal, strsignal(status.term_signal), status.core_dumped ? ", core dumped" : "");
     return 1;
 }
 
@@ -150,4 +106,71 @@ char *get_parent_dir(char *path){
     strncpy(dir, path, i);  
     dir[i] = '\0';
     return dir;  
-}
\ No newline at end of file
+}
+
+// Function that reads the first line of a file (without the newline). Returns 0 on success, 1 otherwise
+static int read_first_line(const char *path, char *line, size_t line_len) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return 1;
+    }
+    int status = fgets(line, line_len, fp) ? 0 : 1;
+    fclose(fp);
+    line[strcspn(line, "\r\n")] = '\0';
+    return status;
+}
+
+// Function that reads the commit checked out in a git repository (its HEAD), following the symbolic ref to the loose ref file or,
+// after a gc or a fresh clone, to the packed-refs file. Returns 0 on success, 1 otherwise
+int read_head_commit(const char *repo_dir, char *commit, size_t commit_len, FILE *log_fp) {
+    char path[MAX_CONFIG_ATTR_LEN * 2];
+    char head[MAX_CONFIG_LINE_LEN];
+    char line[MAX_CONFIG_LINE_LEN];
+
+    snprintf(path, sizeof(path), "%s/.git/HEAD", repo_dir);
+    if (read_first_line(path, head, sizeof(head)) != 0) {
+        fprintf(log_fp, "Error: Failed to read %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    const char *id = NULL;
+    if (strncmp(head, "ref: ", 5) != 0) {
+        // Detached HEAD: it already contains the commit id
+        id = head;
+    } else {
+        const char *ref = head + 5;
+        snprintf(path, sizeof(path), "%s/.git/%s", repo_dir, ref);
+        if (read_first_line(path, line, sizeof(line)) == 0) {
+            id = line;
+        } else {
+            snprintf(path, sizeof(path), "%s/.git/packed-refs", repo_dir);
+            FILE *packed_fp = fopen(path, "r");
+            if (packed_fp) {
+                // Lines are "<id> <ref>"; comments start with '#', peeled tags with '^'
+                while (fgets(line, sizeof(line), packed_fp)) {
+                    line[strcspn(line, "\r\n")] = '\0';
+                    char *space = strchr(line, ' ');
+                    if (line[0] == '#' || line[0] == '^' || !space || strcmp(space + 1, ref) != 0) {
+                        continue;
+                    }
+                    *space = '\0';
+                    id = line;
+                    break;
+                }
+                fclose(packed_fp);
+            }
+        }
+        if (!id) {
+            fprintf(log_fp, "Error: Could not resolve %s in repository %s.\n", ref, repo_dir);
+            return 1;
+        }
+    }
+
+    size_t id_len = strlen(id);
+    if ((id_len != 40 && id_len != 64) || id_len >= commit_len || strspn(id, "0123456789abcdef") != id_len) {
+        fprintf(log_fp, "Error: Invalid commit id '%s' read from repository %s.\n", id, repo_dir);
+        return 1;
+    }
+    memcpy(commit, id, id_len + 1);
+    return 0;
+}
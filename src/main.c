@@ -10,21 +10,27 @@
 #include <fcntl.h>
 #include "types/types.h"
 #include "init/init.h"
-#include "worker.h"
+#include "init/worker_init.h"
 #include "daemon_utils.h"
 #include "utils/utils.h"
-
-volatile sig_atomic_t terminate_daemon_flag = 0;
-
-static void sigterm_handler(int signum) {
-    if (signum == SIGTERM) {
-        terminate_daemon_flag = 1;
-    }
-}
+#include "sched/scheduler.h"
+#include "fingerprint/fingerprint.h"
+#include "pool/pool.h"
+#include "release/release.h"
+#include "loop/loop.h"
+#include "control/control.h"
+#include "logmux/logmux.h"
+#include "metrics/metrics.h"
+#include "trace/trace.h"
+#include "spawn/spawn.h"
+#include "task/task.h"
+#include "repo/repo.h"
+#include "worker.h"
 
 static void cleanup_daemon_files() {
     remove(PID_FILE);
     remove(STATE_FILE);
+    remove(CONTROL_SOCKET_PATH);
 }
 
 static void update_daemon_state(const char *state) {
@@ -54,7 +60,11 @@ static void daemonize() {
         exit(EXIT_FAILURE);
     }
 
-    signal(SIGTERM, sigterm_handler);
+    // Block SIGTERM: a termination request that arrives while the daemon starts stays pending, and is read from the signalfd of the event loop
+    sigset_t term_set;
+    sigemptyset(&term_set);
+    sigaddset(&term_set, SIGTERM);
+    sigprocmask(SIG_BLOCK, &term_set, NULL);
 
     // Fork again so I'll be a child of the session leader and I'm sure I won't have access to the terminal
     pid = fork();
@@ -90,9 +100,110 @@ static int started_via_sudo() {
     return 0;
 }
 
+// Function that drops a reference to a generation of commits, freeing it with the last one. Returns 1 if the generation was freed
+static int release_generation(build_generation_t *generation) {
+    if (--generation->refs > 0) {
+        return 0;
+    }
+    free(generation->commits.new_release);
+    free(generation);
+    return 1;
+}
+
+// Function that prunes the source snapshots no longer needed in the task runner: only the ones of the newest generation and of the builds
+// in progress are kept. The caller makes sure that no poll (nor another pruning) is in flight
+static void submit_snapshot_prune(task_runner_t *tasks, snapshot_prune_t *prune, const build_generation_t *latest, const arch_pipeline_t *pipelines, int num_archs) {
+    prune->num_keep_dirs = 0;
+    for (int i = -1; i < num_archs; i++) {
+        const build_generation_t *generation = i < 0 ? latest : pipelines[i].building;
+        if (!generation) {
+            continue;
+        }
+        strcpy(prune->keep_dirs[prune->num_keep_dirs++], generation->sshlirp_snapshot_dir);
+        strcpy(prune->keep_dirs[prune->num_keep_dirs++], generation->libslirp_snapshot_dir);
+        strcpy(prune->keep_dirs[prune->num_keep_dirs++], generation->vdens_snapshot_dir);
+    }
+    task_runner_submit(tasks, &prune->task);
+}
+
+// Task that discards the layer of the build collected last by a pipeline
+static int run_layer_discard(loop_task_t *task, FILE *log_fp) {
+    arch_pipeline_t *pipeline = task->data;
+    return discard_build_layer(&pipeline->args, log_fp);
+}
+
+// Function that writes the reply to a status request: the state of the daemon, then one line for each pipeline (idle, queued,
+// or building, with the stages running and the ones done)
+static void describe_status(char *status, size_t len, worker_pool_t *pool, arch_pipeline_t *pipelines, int num_archs,
+                            const build_generation_t *latest, int builds_in_flight, int polling, int draining) {
+    memset(status, 0, len);
+    FILE *fp = fmemopen(status, len - 1, "w");
+    if (!fp) {
+        snprintf(status, len, "%d builds in flight", builds_in_flight);
+        return;
+    }
+
+    fprintf(fp, "%s, %d builds in flight, %snewest generation %lu (release %s)\n", draining ? "draining" : (builds_in_flight > 0 || polling ? "working" : "sleeping"),
+            builds_in_flight, polling ? "polling, " : "", latest ? latest->id : 0, latest ? latest->commits.new_release : "none");
+    for (int i = 0; i < num_archs; i++) {
+        arch_pipeline_t *pipeline = &pipelines[i];
+        if (!pipeline->building) {
+            fprintf(fp, "%s: idle, last generation %lu%s\n", pipeline->args.arch, pipeline->built_generation,
+                    pipeline->awaiting_poll ? " (build cancelled, starting again after the next poll)" : "");
+            continue;
+        }
+        if (pipeline->discard.in_flight) {
+            fprintf(fp, "%s: discarding the layer of generation %lu\n", pipeline->args.arch, pipeline->building->id);
+            continue;
+        }
+
+        const char *cancelling = pipeline->job.cancelled ? ", cancelling" : "";
+        stage_state_t states[BUILD_MAX_STAGES];
+        const char *tags[BUILD_MAX_STAGES];
+        if (worker_pool_job_stages(pool, &pipeline->job, states, tags) != 0) {
+            fprintf(fp, "%s: generation %lu queued for %.0f s%s\n", pipeline->args.arch, pipeline->building->id, metrics_seconds_since(&pipeline->queued_at), cancelling);
+            continue;
+        }
+
+        int stages_done = 0, stages_total = 0, stages_running = 0;
+        fprintf(fp, "%s: building generation %lu for %.0f s, running", pipeline->args.arch, pipeline->building->id, metrics_seconds_since(&pipeline->queued_at));
+        for (int s = 0; s < BUILD_MAX_STAGES; s++) {
+            if (states[s] == STAGE_SKIPPED) {
+                continue;
+            }
+            stages_total++;
+            if (states[s] == STAGE_DONE) {
+                stages_done++;
+            } else if (states[s] == STAGE_RUNNING) {
+                fprintf(fp, "%s%s", stages_running++ > 0 ? "," : " ", tags[s]);
+            }
+        }
+        fprintf(fp, "%s, %d/%d stages done%s\n", stages_running > 0 ? "" : " nothing (waiting for tokens)", stages_done, stages_total, cancelling);
+    }
+    fclose(fp);
+
+    // The reply adds its own newline
+    size_t used = strlen(status);
+    if (used > 0 && status[used - 1] == '\n') {
+        status[used - 1] = '\0';
+    }
+}
+
+// Function that cancels the build of a pipeline: its scripts are terminated with their process groups and its stages not started yet
+// are skipped. The build is then collected like any failed build (its layer is discarded). Returns 1 if there was a build to cancel:
+// a build already completed, waiting to be collected or discarding its layer, is over and its binary is published as usual
+static int cancel_build(worker_pool_t *pool, arch_pipeline_t *pipeline, FILE *log_fp) {
+    if (!pipeline->building || pipeline->discard.in_flight || !worker_pool_cancel(pool, &pipeline->job)) {
+        return 0;
+    }
+    int signalled = spawn_cancel(&pipeline->args.cancel);
+    fprintf(log_fp, "Build of generation %lu cancelled for architecture %s (%d scripts terminated).\n", pipeline->building->id, pipeline->args.arch, signalled);
+    return 1;
+}
+
 int main() {
     // 0. Load variables from the configuration file
-    char** archs_list = (char**)malloc(MAX_ARCHITECTURES * sizeof(char*));
+    char** archs_list = NULL;
     int num_archs = 0;
     char *sshlirp_repo_url = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
     char *libslirp_repo_url = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
@@ -100,18 +211,40 @@ int main() {
     char *main_dir = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
     char *target_dir = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
     char *log_file = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
+    char *debian_mirror = (char*)malloc((MIN_CONFIG_ATTR_LEN) * sizeof(char));
     int poll_interval = 0;
+    int max_parallel_builds = DEFAULT_MAX_PARALLEL_BUILDS;
+    int webhook_port = 0;
+
+    // Note: the scheduler admits the expensive stages of the threads (chroot setup, compilation, test...) according to the
+    // CPU, memory and I/O budget of the host, so that running all the architectures in parallel cannot starve any of them
+    resource_scheduler_t scheduler;
+
+    // Note: the builds write to the main log through the log multiplexer, which tags their records with architecture and stage
+    // and appends them in batches while the builds run (see logmux/logmux.h)
+    log_mux_t log_mux;
 
-    // Note: the mutex will only be necessary for the chroot setup, a very expensive operation that, if performed in parallel
-    // for many architectures, risks race conditions
-    pthread_mutex_t chroot_setup_mutex;
-    pthread_mutex_init(&chroot_setup_mutex, NULL);
+    // Note: the metrics (build and stage durations, commit-to-artifact latency, cache hits, polls, work in flight) are only updated
+    // by the main loop and written to metrics_file whenever they change (see metrics/metrics.h)
+    metrics_t metrics;
+
+    // Note: the builds are run by a fixed pool of threads (max_parallel_builds, MAX_PARALLEL_BUILDS in ci.conf), not by one thread
+    // per architecture: a matrix of many targets only has that many builds (chroots, layers, compilations) in progress at the same time
+    worker_pool_t pool;
+    event_loop_t loop;
+
+    // Note: the blocking work of the main loop (polls, snapshot pruning, layer discards) runs in the task runner, so that the loop
+    // only does bookkeeping and reacts to signals, control requests and completed builds right away
+    task_runner_t tasks;
+
+    // Note: besides the poll timer, a poll can be requested at any time through the control socket or the webhook listener (push notifications)
+    control_t control;
 
     printf("Starting sshlirp_ci...\n");
     printf("Loading configuration variables...\n");
 
     if(conf_vars_loader(
-            archs_list, 
+            &archs_list,
             &num_archs, 
             sshlirp_repo_url, 
             libslirp_repo_url, 
@@ -119,7 +252,10 @@ int main() {
             main_dir,
             target_dir,
             log_file,
-            &poll_interval) != 0) {
+            debian_mirror,
+            &poll_interval,
+            &max_parallel_builds,
+            &webhook_port) != 0) {
         fprintf(stderr, "Failed to load configuration variables. Exiting.\n");
         // (freeing previously allocated memory, in case of error, is handled by conf_vars_loader itself)
         return 1;
@@ -131,7 +267,13 @@ int main() {
     char sshlirp_source_dir[CONFIG_ATTR_LEN];
     char libslirp_source_dir[CONFIG_ATTR_LEN];
     char vdens_source_dir[CONFIG_ATTR_LEN];
-    char thread_log_dir[CONFIG_ATTR_LEN];
+    char rootfs_cache_dir[CONFIG_ATTR_LEN];
+    char deb_cache_dir[CONFIG_ATTR_LEN];
+    char snapshots_dir[CONFIG_ATTR_LEN];
+    char fingerprints_dir[CONFIG_ATTR_LEN];
+    char metrics_file[CONFIG_ATTR_LEN];
+    char traces_dir[CONFIG_ATTR_LEN];
+    char rebuild_marker[CONFIG_ATTR_LEN];
 
     // Hardcoded thread chroot directories
     char *thread_chroot_main_dir = "/home/sshlirpCI";
@@ -139,13 +281,19 @@ int main() {
     char *thread_chroot_sshlirp_dir = "/home/sshlirpCI/thread_sshlirp";
     char *thread_chroot_libslirp_dir = "/home/sshlirpCI/thread_libslirp";
     char *thread_chroot_vdens_dir = "/home/sshlirpCI/thread_vdens";
-    char *thread_chroot_log_file = "/home/sshlirpCI/log/thread_sshlirpCI.log";
+    char *thread_chroot_workspace_dir = "/home/sshlirpCI/workspace";
 
     snprintf(versioning_file, sizeof(versioning_file), "%s/versions.txt", main_dir);
     snprintf(sshlirp_source_dir, sizeof(sshlirp_source_dir), "%s/sshlirp", main_dir);
     snprintf(libslirp_source_dir, sizeof(libslirp_source_dir), "%s/libslirp", main_dir);
     snprintf(vdens_source_dir, sizeof(vdens_source_dir), "%s/vdens", main_dir);
-    snprintf(thread_log_dir, sizeof(thread_log_dir), "%s/log/threads", main_dir);
+    snprintf(rootfs_cache_dir, sizeof(rootfs_cache_dir), "%s/rootfs-cache", main_dir);
+    snprintf(deb_cache_dir, sizeof(deb_cache_dir), "%s/deb-cache", main_dir);
+    snprintf(snapshots_dir, sizeof(snapshots_dir), "%s/snapshots", main_dir);
+    snprintf(fingerprints_dir, sizeof(fingerprints_dir), "%s/fingerprints", main_dir);
+    snprintf(metrics_file, sizeof(metrics_file), "%s/metrics/%s", main_dir, METRICS_FILE_NAME);
+    snprintf(traces_dir, sizeof(traces_dir), "%s/traces", main_dir);
+    snprintf(rebuild_marker, sizeof(rebuild_marker), "%s/%s", main_dir, REBUILD_MARKER_NAME);
 
     printf("Checking for active daemon instances...\n");
 
@@ -228,367 +376,616 @@ int main() {
     setvbuf(log_fp, NULL, _IOLBF, 0);
     // I don't close log_fp here, I'll close it at the end of main, as I need it to write the daemon's logs
 
-    int round = 0;
-    commit_status_t initial_check = {1, NULL};
-    commit_status_t new_commit = {1, NULL};
+    // 4. Create the event loop of the daemon (before any thread, see event_loop_init) and the admission scheduler shared by all the threads
+    if (event_loop_init(&loop, poll_interval, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to create the event loop. Exiting daemon...\n");
+        fclose(log_fp);
+        return 1;
+    }
+    if (scheduler_init(&scheduler, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to initialize the resource scheduler. Exiting daemon...\n");
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
+    if (log_mux_init(&log_mux, log_file, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to start the log multiplexer. Exiting daemon...\n");
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
 
-    // 5. Start the main loop in the daemon
-    while (1) {
-        if (terminate_daemon_flag) {
-            fprintf(log_fp, "Termination signal received before starting operations, exiting...\n");
-            break;
-        }
-        update_daemon_state(DAEMON_STATE_WORKING);
+    // 4.1. Start the worker pool (no more threads than targets): the loop is woken up by its completions
+    if (worker_pool_init(&pool, max_parallel_builds < num_archs ? max_parallel_builds : num_archs, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to start the worker pool. Exiting daemon...\n");
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
+    if (event_loop_add(&loop, pool.completion_fd, EVENT_POOL, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to watch the completions of the worker pool. Exiting daemon...\n");
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
 
-        // 6. Check if the host directories and git repositories exist
-        if (round == 0) {
-            log_time(log_fp);
-            fprintf(log_fp, "Starting the daemon for the first time...\n");
+    // 4.2. Start the task runner: one thread for the polls and the pruning, plus one for each build whose layer may be discarding
+    if (task_runner_init(&tasks, pool.max_active_builds + 1, &log_mux, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to start the task runner. Exiting daemon...\n");
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
+    if (event_loop_add(&loop, tasks.completion_fd, EVENT_TASK, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to watch the completions of the task runner. Exiting daemon...\n");
+        task_runner_destroy(&tasks);
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
 
-            initial_check = check_host_dirs(target_dir, sshlirp_source_dir, libslirp_source_dir, vdens_source_dir, log_file, sshlirp_repo_url, libslirp_repo_url, vdens_repo_url, thread_log_dir, log_fp, versioning_file);
+    // 4.3. Open the control socket and, if WEBHOOK_PORT is configured, the webhook listener: a push notification starts a poll right away
+    if (control_init(&control, webhook_port, &loop, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to open the control socket or the webhook listener. Exiting daemon...\n");
+        task_runner_destroy(&tasks);
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
 
-            // Note: this function does nothing if the dirs already exist and if the git repo already exists (possible in case of a crash or interruption)
-            if (initial_check.status != 0 && initial_check.status != 2) {
-                fprintf(log_fp, "Error: Error during search or creation of host directories, log file, or during repository cloning. Status: %d\n", initial_check.status);
-                terminate_daemon_flag = 1;
-                break;
-            }
-        }
+    // 4.4. Set up the build pipeline of every architecture (what does not change from a build to the next is filled in once)
+    arch_pipeline_t *pipelines = calloc(num_archs, sizeof(arch_pipeline_t));
+    if (!pipelines) {
+        fprintf(log_fp, "Error: Out of memory while setting up the build pipelines. Exiting daemon...\n");
+        control_destroy(&control);
+        task_runner_destroy(&tasks);
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
+    for (int i = 0; i < num_archs; i++) {
+        thread_args_t *args = &pipelines[i].args;
 
-        // 6.1. If it's not the first start (and so I had already cloned and waited poll_interval seconds) or if the repo was already cloned
-        // (so maybe there was a crash or an interruption), I try to pull any new commits
-        if (round > 0 || initial_check.status == 0) {
-            new_commit = check_new_commit(sshlirp_source_dir, sshlirp_repo_url, libslirp_source_dir, libslirp_repo_url, log_file, log_fp, versioning_file);
-        }
+        // Cancellazione delle build della pipeline (richiesta dal control socket, vedi spawn/spawn.h)
+        spawn_cancel_init(&args->cancel);
 
-        // 7. If it's the first start and I actually cloned or if I found new commits, I prepare the threads for the build
-        if ((round == 0 && initial_check.status == 2) || new_commit.status == 2) {
+        // Passo sudo_user in modo che al momento del lancio degli script critici possa capire se eseguo come root o no
+        args->sudo_user = sudo_user;
 
-            if (round == 0) {
-                fprintf(log_fp, "First daemon run, it's time to launch the threads...\n");
-            } else {
-                fprintf(log_fp, "\n");
-                log_time(log_fp);
-                fprintf(log_fp, "New commit for sshlirp found, proceeding with the build...\n");
-            }
+        // Copia sicura del nome dell'architettura
+        strncpy(args->arch, archs_list[i], sizeof(args->arch) - 1);
+        args->arch[sizeof(args->arch) - 1] = '\0';
 
-            // 7.1. Prepare the threads
-            pthread_t threads[num_archs];
-            thread_args_t args[num_archs];
+        // Copia sicura del chroot_path
+        snprintf(args->chroot_path, sizeof(args->chroot_path), "%s/%s-chroot", main_dir, archs_list[i]);
 
-            // 7.2. Launch the build threads
-            for (int i = 0; i < num_archs; i++) {
+        // Copia sicura dell'albero persistente dei sorgenti sincronizzati del thread (layer inferiore delle build, sopra al chroot base)
+        snprintf(args->sources_root_path, sizeof(args->sources_root_path), "%s/%s-sources", main_dir, archs_list[i]);
 
-                // Inizializzo il pull_round (mi sarà utile nel thread per capire se devo setuppare il chroot, il log file locale... o meno)
-                args[i].pull_round = round;
+        // Copia sicura del layer copy-on-write della build (sopra al chroot base) e della sua directory upper, usata dagli script di build al posto del chroot
+        snprintf(args->build_dir, sizeof(args->build_dir), "%s/%s-build", main_dir, archs_list[i]);
+        snprintf(args->build_root_path, sizeof(args->build_root_path), "%s/%s-build/root", main_dir, archs_list[i]);
 
-                // Passo sudo_user in modo che al momento del lancio degli script critici possa capire se eseguo come root o no
-                args[i].sudo_user = sudo_user;
+        // Copia sicura del workspace persistente del thread (alberi di build di libslirp e sshlirp e cache del compilatore, montato in ogni layer)
+        snprintf(args->workspace_dir, sizeof(args->workspace_dir), "%s/%s-workspace", main_dir, archs_list[i]);
 
-                // Copia sicura del nome dell'architettura
-                strncpy(args[i].arch, archs_list[i], sizeof(args[i].arch) - 1);
-                args[i].arch[sizeof(args[i].arch) - 1] = '\0';
+        // Copia sicura della directory della cache dei rootfs base (condivisa da tutti i thread, un tarball per ogni suite/architettura)
+        strncpy(args->rootfs_cache_dir, rootfs_cache_dir, sizeof(args->rootfs_cache_dir) - 1);
+        args->rootfs_cache_dir[sizeof(args->rootfs_cache_dir) - 1] = '\0';
 
-                // Copia sicura del percorso della directory di codice sorgente di sshlirp nell'host (mi servirà per copiare nel chroot)
-                strncpy(args[i].sshlirp_host_source_dir, sshlirp_source_dir, sizeof(args[i].sshlirp_host_source_dir) - 1);
-                args[i].sshlirp_host_source_dir[sizeof(args[i].sshlirp_host_source_dir) - 1] = '\0';
+        // Copia sicura della directory della cache condivisa dei pacchetti .deb (usata da debootstrap e da apt in tutti i chroot)
+        strncpy(args->deb_cache_dir, deb_cache_dir, sizeof(args->deb_cache_dir) - 1);
+        args->deb_cache_dir[sizeof(args->deb_cache_dir) - 1] = '\0';
 
-                // Copia sicura del percorso della directory di codice sorgente di libslirp nell'host (mi servirà per copiare nel chroot)
-                strncpy(args[i].libslirp_host_source_dir, libslirp_source_dir, sizeof(args[i].libslirp_host_source_dir) - 1);
-                args[i].libslirp_host_source_dir[sizeof(args[i].libslirp_host_source_dir) - 1] = '\0';
+        // Copia sicura del mirror Debian usato da debootstrap
+        strncpy(args->debian_mirror, debian_mirror, sizeof(args->debian_mirror) - 1);
+        args->debian_mirror[sizeof(args->debian_mirror) - 1] = '\0';
 
-                // Copia sicura del percorso della directory di codice sorgente di vdens nell'host (se il testing è abilitato, mi servirà per copiare nel chroot)
-                strncpy(args[i].vdens_host_source_dir, vdens_source_dir, sizeof(args[i].vdens_host_source_dir) - 1);
-                args[i].vdens_host_source_dir[sizeof(args[i].vdens_host_source_dir) - 1] = '\0';
+        // Copia sicura della directory principale del thread (ossia dove, nel chroot, il thread dovrà lavorare -> come percorso "relativo" non può corrispondere alla main dir dell'host
+        // in quanto nel chroot mi conviene usare un percorso semplice come /home/sshlirpCI mentre nell'host la main dir può essere configurata nel ci.conf
+        // in modo che corrisponda a un path personale dove ho i permessi di scrittura)
+        strncpy(args->thread_chroot_main_dir, thread_chroot_main_dir, sizeof(args->thread_chroot_main_dir) - 1);
+        args->thread_chroot_main_dir[sizeof(args->thread_chroot_main_dir) - 1] = '\0';
 
-                // Copia sicura del chroot_path
-                snprintf(args[i].chroot_path, sizeof(args[i].chroot_path), "%s/%s-chroot", main_dir, archs_list[i]);
+        // Copia sicura della directory di codice sorgente di sshlirp nel chroot (il path relativo sarà lo stesso di quello usato nell'host)
+        strncpy(args->thread_chroot_sshlirp_dir, thread_chroot_sshlirp_dir, sizeof(args->thread_chroot_sshlirp_dir) - 1);
+        args->thread_chroot_sshlirp_dir[sizeof(args->thread_chroot_sshlirp_dir) - 1] = '\0';
 
-                // Copia sicura della directory principale del thread (ossia dove, nel chroot, il thread dovrà lavorare -> come percorso "relativo" non può corrispondere alla main dir dell'host
-                // in quanto nel chroot mi conviene usare un percorso semplice come /home/sshlirpCI mentre nell'host la main dir può essere configurata nel ci.conf
-                // in modo che corrisponda a un path personale dove ho i permessi di scrittura)
-                strncpy(args[i].thread_chroot_main_dir, thread_chroot_main_dir, sizeof(args[i].thread_chroot_main_dir) - 1);
-                args[i].thread_chroot_main_dir[sizeof(args[i].thread_chroot_main_dir) - 1] = '\0';
+        // Copia sicura della directory di codice sorgente di libslirp nel chroot (idem)
+        strncpy(args->thread_chroot_libslirp_dir, thread_chroot_libslirp_dir, sizeof(args->thread_chroot_libslirp_dir) - 1);
+        args->thread_chroot_libslirp_dir[sizeof(args->thread_chroot_libslirp_dir) - 1] = '\0';
 
-                // Copia sicura della directory di codice sorgente di sshlirp nel chroot (il path relativo sarà lo stesso di quello usato nell'host)
-                strncpy(args[i].thread_chroot_sshlirp_dir, thread_chroot_sshlirp_dir, sizeof(args[i].thread_chroot_sshlirp_dir) - 1);
-                args[i].thread_chroot_sshlirp_dir[sizeof(args[i].thread_chroot_sshlirp_dir) - 1] = '\0';
+        // Copia sicura della directory di codice sorgente di vdens nel chroot (idem, se il testing è abilitato)
+        strncpy(args->thread_chroot_vdens_dir, thread_chroot_vdens_dir, sizeof(args->thread_chroot_vdens_dir) - 1);
+        args->thread_chroot_vdens_dir[sizeof(args->thread_chroot_vdens_dir) - 1] = '\0';
 
-                // Copia sicura della directory di codice sorgente di libslirp nel chroot (idem)
-                strncpy(args[i].thread_chroot_libslirp_dir, thread_chroot_libslirp_dir, sizeof(args[i].thread_chroot_libslirp_dir) - 1);
-                args[i].thread_chroot_libslirp_dir[sizeof(args[i].thread_chroot_libslirp_dir) - 1] = '\0';
+        // Copia sicura del thread_target_dir (ossia dove, nel chroot, il thread dovrà inserire il binario)
+        strncpy(args->thread_chroot_target_dir, thread_chroot_target_dir, sizeof(args->thread_chroot_target_dir) - 1);
+        args->thread_chroot_target_dir[sizeof(args->thread_chroot_target_dir) - 1] = '\0';
 
-                // Copia sicura della directory di codice sorgente di vdens nel chroot (idem, se il testing è abilitato)
-                strncpy(args[i].thread_chroot_vdens_dir, thread_chroot_vdens_dir, sizeof(args[i].thread_chroot_vdens_dir) - 1);
-                args[i].thread_chroot_vdens_dir[sizeof(args[i].thread_chroot_vdens_dir) - 1] = '\0';
+        // Copia sicura del punto di montaggio del workspace nel chroot
+        strncpy(args->thread_chroot_workspace_dir, thread_chroot_workspace_dir, sizeof(args->thread_chroot_workspace_dir) - 1);
+        args->thread_chroot_workspace_dir[sizeof(args->thread_chroot_workspace_dir) - 1] = '\0';
 
-                // Copia sicura del thread_target_dir (ossia dove, nel chroot, il thread dovrà inserire il binario)
-                strncpy(args[i].thread_chroot_target_dir, thread_chroot_target_dir, sizeof(args[i].thread_chroot_target_dir) - 1);
-                args[i].thread_chroot_target_dir[sizeof(args[i].thread_chroot_target_dir) - 1] = '\0';
+        // Assegnamento dello scheduler condiviso
+        args->scheduler = &scheduler;
 
-                // Copia sicura del thread_chroot_log_file (il log file "personale" del thread)
-                strncpy(args[i].thread_chroot_log_file, thread_chroot_log_file, sizeof(args[i].thread_chroot_log_file) - 1);
-                args[i].thread_chroot_log_file[sizeof(args[i].thread_chroot_log_file) - 1] = '\0';
+        // Assegnamento del multiplexer dei log (i record del thread finiscono nel log principale)
+        args->log_mux = &log_mux;
 
-                // Copia sicura del thread_log_file (ossia il log file su cui scriverà il thread quando non è nel chroot)
-                snprintf(args[i].thread_log_file, sizeof(args[i].thread_log_file), "%s/%s-thread.log", thread_log_dir, archs_list[i]);
+        pipelines[i].job.index = i;
+        pipelines[i].job.args = args;
 
-                // Assegnamento del mutex condiviso
-                args[i].chroot_setup_mutex = &chroot_setup_mutex;
+        // Lo scarto del layer della build raccolta gira nel task runner, con i record etichettati con l'architettura
+        pipelines[i].discard.name = args->arch;
+        pipelines[i].discard.tag = "discard";
+        pipelines[i].discard.run = run_layer_discard;
+        pipelines[i].discard.data = &pipelines[i];
+    }
 
-                if (pthread_create(&threads[i], NULL, build_worker, &args[i]) != 0) {
-                    fprintf(log_fp, "Error: Error creating thread for architecture %s.\n", args[i].arch);
-                    return 1;
-                } else {
-                    fprintf(log_fp, "Thread created successfully for architecture %s.\n", args[i].arch);
-                }
-            }
-            fprintf(log_fp, "=======================================================================\n");
+    // 4.5. Prepare the metrics of the daemon
+    if (metrics_init(&metrics, metrics_file, archs_list, num_archs, log_fp) != 0) {
+        fprintf(log_fp, "Error: Failed to prepare the metrics. Exiting daemon...\n");
+        free(pipelines);
+        control_destroy(&control);
+        task_runner_destroy(&tasks);
+        worker_pool_destroy(&pool);
+        log_mux_destroy(&log_mux);
+        scheduler_destroy(&scheduler);
+        event_loop_destroy(&loop);
+        fclose(log_fp);
+        return 1;
+    }
 
-            // 7.3. Attendo che tutti i thread finiscano
-            for (int i = 0; i < num_archs; i++) {
-                void *thread_return_value;
+    // Note: each architecture has its own pipeline. A poll that finds new commits exports them into a new generation, which every idle
+    // pipeline starts building right away; a pipeline still busy with an older generation moves straight to the newest one when it is done,
+    // so a slow architecture never builds the commits that were already superseded while it was compiling
+    build_generation_t *latest = NULL;                  // Newest generation of commits found by the polls
+    unsigned long generations = 0;
+    int first_poll = 1;
+    int builds_in_flight = 0;                           // Builds queued to the pool or whose layer is being discarded
+    int draining = 0;                                   // No more polls nor builds: the builds in flight are collected, then the daemon exits
+    int idle_logged = 1;
+    int collected_build = 0;                            // The last iteration collected a build: the pool may have more completed builds queued
+    int prune_pending = 0;                              // Some snapshots may be unused: prune them as soon as no poll is in flight
+    loop.poll_due = 1;                                  // The first poll is done right away, then at every expiration of the poll timer
+
+    // The poll and the pruning of the snapshots are run by the task runner (one of each at a time), the main only submits them and takes their results
+    repo_poll_t repo_poll = {
+        .task = {.name = "daemon", .tag = "poll", .run = repo_poll_run},
+        .target_dir = target_dir,
+        .sshlirp_source_dir = sshlirp_source_dir,
+        .libslirp_source_dir = libslirp_source_dir,
+        .vdens_source_dir = vdens_source_dir,
+        .sshlirp_repo_url = sshlirp_repo_url,
+        .libslirp_repo_url = libslirp_repo_url,
+        .vdens_repo_url = vdens_repo_url,
+        .versioning_file = versioning_file,
+        .snapshots_dir = snapshots_dir,
+        .traces_dir = traces_dir,
+        .rebuild_marker = rebuild_marker,
+        .archs_list = archs_list,
+        .num_archs = num_archs
+    };
+    repo_poll.task.data = &repo_poll;
+    snapshot_prune_t prune = {
+        .task = {.name = "daemon", .tag = "prune", .run = snapshot_prune_run},
+        .snapshots_dir = snapshots_dir,
+        .keep_dirs = calloc((num_archs + 1) * 3, sizeof(*prune.keep_dirs))
+    };
+    prune.task.data = &prune;
+    if (!prune.keep_dirs) {
+        fprintf(log_fp, "Warning: Out of memory while preparing the pruning of the snapshots: the unused snapshots will not be removed.\n");
+    }
 
-                // Attendo il join del thread
-                int successful_join = pthread_join(threads[i], &thread_return_value);
+    // 5. Start the main loop in the daemon: everything is driven by the events of the loop (termination signals, the poll timer,
+    // the completions of the builds), so a stop request or a completed build is handled as soon as it happens
+    while (1) {
+        // 5.1. Write the metrics changed by the last iteration, then wait for the next events. The wait does not block if there is a poll
+        // to start or if more completed builds may be queued
+        int builds_queued, builds_active;
+        worker_pool_depth(&pool, &builds_queued, &builds_active);
+        metrics_set_pool_depth(&metrics, builds_queued, builds_active);
+        metrics_write(&metrics, log_fp);
+        loop_event_t events[EVENT_LOOP_MAX_EVENTS];
+        int poll_startable = loop.poll_due && !draining && !repo_poll.task.in_flight && !prune.task.in_flight;
+        int timeout_ms = (collected_build || poll_startable) ? 0 : -1;
+        int num_events = event_loop_wait(&loop, events, EVENT_LOOP_MAX_EVENTS, timeout_ms, log_fp);
+        if (num_events < 0) {
+            // Without the event loop the daemon cannot wait for anything: it stops polling and collects the builds in flight
+            loop.terminate_requested = 1;
+        }
 
-                if (successful_join != 0) {
-                    fprintf(log_fp, "Error: Error joining thread for %s\n", args[i].arch);
-                } else {
-                    if (thread_return_value != NULL) {
-                        thread_result_t *worker_result = (thread_result_t *)thread_return_value;
-                        if (worker_result->status != 0) {
-                            fprintf(log_fp, "Error: Thread for %s terminated with error: %s\nHere the stats:\n----------------------------------\n%s", args[i].arch, worker_result->error_message ? worker_result->error_message : "No error message.", worker_result->stats ? worker_result->stats : "No stats available.");
-                            fprintf(log_fp, "----------------------------------\n");
-                        } else {
-                            fprintf(log_fp, "Thread for %s terminated successfully. Here the stats:\n----------------------------------\n%s", args[i].arch, worker_result->stats ? worker_result->stats : "No stats available.");
-                            fprintf(log_fp, "----------------------------------\n");
-                        }
-
-                        // Free the memory allocated for the thread result
-                        if (worker_result->error_message) {
-                            free(worker_result->error_message);
-                        }
-                        if (worker_result->stats) {
-                            free(worker_result->stats);
-                        }
-                        free(worker_result);
-                    } else {
-                        fprintf(log_fp, "Thread for %s terminated without a specific return value (or error in return allocation).\n", args[i].arch);
-                    }
-                }
+        // 5.2. Handle the requests of the control socket and of the webhook listener: a push notification makes the poll due now.
+        // Note: the completions of the pool (EVENT_POOL) are collected below, one per iteration, until the completion queue is empty,
+        // the ones of the task runner (EVENT_TASK) all at once in 5.3
+        for (int i = 0; i < num_events; i++) {
+            control_request_t request;
+            if ((events[i].source != EVENT_CONTROL && events[i].source != EVENT_WEBHOOK) || control_accept(&control, &events[i], &request, log_fp) != 0) {
+                continue;
             }
-
-            // 7.4. Merge the thread logs (logs on the host for each thread + logs in the chroot) into the main log and clean the thread logs (both in thread_log_dir and in thread_chroot_log_dir)
-            for (int i = 0; i < num_archs; i++) {
-                char thread_log_path_on_host[MAX_CONFIG_ATTR_LEN];
-                snprintf(thread_log_path_on_host, sizeof(thread_log_path_on_host), "%s", args[i].thread_log_file);
-
-                char thread_log_path_in_chroot[MAX_CONFIG_ATTR_LEN*2];
-                snprintf(thread_log_path_in_chroot, sizeof(thread_log_path_in_chroot), "%s%s", args[i].chroot_path, args[i].thread_chroot_log_file);
-
-                FILE *thread_log_read_on_host = fopen(thread_log_path_on_host, "r");
-                FILE *thread_log_read_in_chroot = fopen(thread_log_path_in_chroot, "r");
-
-                if (thread_log_read_on_host) {
-                    char line[1024];
-
-                    fprintf(log_fp, "===== Start Log from thread %s =====\n", args[i].arch);
-                    fprintf(log_fp, "--- Start Log from thread %s (Host logfile - chroot setup, copy and remove sources logs: %s) ---\n", args[i].arch, thread_log_path_on_host);
-                    while (fgets(line, sizeof(line), thread_log_read_on_host)) {
-                        fprintf(log_fp, "%s", line);
-                    }
-                    fclose(thread_log_read_on_host);
-                    fprintf(log_fp, "--- End Log from thread %s (Host logfile - chroot setup, copy and remove sources logs: %s) ---\n", args[i].arch, thread_log_path_on_host);
-
-                    // Note: if the log file exists on the host, it doesn't necessarily mean it also exists inside the chroot (an error might have occurred)
-                    if (thread_log_read_in_chroot) {
-                        fprintf(log_fp, "--- Start Log from thread %s (Chroot logfile - compile and testing inside chroot logs: %s) ---\n", args[i].arch, thread_log_path_in_chroot);
-                        while (fgets(line, sizeof(line), thread_log_read_in_chroot)) {
-                            fprintf(log_fp, "%s", line);
-                        }
-                        fclose(thread_log_read_in_chroot);
-                        fprintf(log_fp, "--- End Log from thread %s (Chroot logfile - compile and testing inside chroot logs: %s) ---\n", args[i].arch, thread_log_path_in_chroot);
-                    } else {
-                        fprintf(log_fp, "Warning: Could not open thread log for architecture %s in chroot: %s\n", args[i].arch, strerror(errno));
+            if (request.command == CONTROL_TRIGGER) {
+                if (draining || loop.terminate_requested) {
+                    control_reply(&request, 0, "daemon is shutting down");
+                    continue;
+                }
+                log_time(log_fp);
+                fprintf(log_fp, "Poll requested by a push notification (%s).\n", request.source == EVENT_WEBHOOK ? "webhook" : "control socket");
+                loop.poll_due = 1;
+                control_reply(&request, 1, "poll scheduled");
+            } else if (request.command == CONTROL_STATUS) {
+                char *status = malloc(CONTROL_STATUS_LEN);
+                if (!status) {
+                    control_reply(&request, 0, "out of memory");
+                    continue;
+                }
+                describe_status(status, CONTROL_STATUS_LEN, &pool, pipelines, num_archs, latest, builds_in_flight, repo_poll.task.in_flight, draining || loop.terminate_requested);
+                control_reply(&request, 1, status);
+                free(status);
+            } else if (request.command == CONTROL_CANCEL || request.command == CONTROL_SHUTDOWN) {
+                // The cancelled builds are collected by 7.4 as soon as their running stages end, which cleans them up
+                int all = request.command == CONTROL_SHUTDOWN || strcmp(request.target, "all") == 0;
+                int found = all;
+                int cancelled = 0;
+                log_time(log_fp);
+                for (int a = 0; a < num_archs; a++) {
+                    if (all || strcmp(pipelines[a].args.arch, request.target) == 0) {
+                        found = 1;
+                        cancelled += cancel_build(&pool, &pipelines[a], log_fp);
                     }
+                }
 
-                    fprintf(log_fp, "===== End Log from thread %s =====\n", args[i].arch);
+                char reply[CONTROL_REQUEST_LEN];
+                if (!found) {
+                    fprintf(log_fp, "Cancel request for unknown architecture %s ignored.\n", request.target);
+                    snprintf(reply, sizeof(reply), "unknown architecture %s", request.target);
+                    control_reply(&request, 0, reply);
+                } else if (request.command == CONTROL_SHUTDOWN) {
+                    fprintf(log_fp, "Shutdown requested through the control socket: %d builds cancelled, exiting as soon as they are cleaned up...\n", cancelled);
+                    draining = 1;
+                    snprintf(reply, sizeof(reply), "shutting down, %d builds cancelled", cancelled);
+                    control_reply(&request, 1, reply);
+                } else {
+                    fprintf(log_fp, "Cancel requested through the control socket for %s: %d builds cancelled.\n", request.target, cancelled);
+                    snprintf(reply, sizeof(reply), "%d builds cancelled", cancelled);
+                    control_reply(&request, 1, reply);
+                }
+            } else if (request.command == CONTROL_DRAIN) {
+                char reply[CONTROL_REQUEST_LEN];
+                log_time(log_fp);
+                fprintf(log_fp, "Drain requested through the control socket, exiting after the %d builds in progress...\n", builds_in_flight);
+                draining = 1;
+                snprintf(reply, sizeof(reply), "draining, exiting after %d builds in progress", builds_in_flight);
+                control_reply(&request, 1, reply);
+            }
+        }
 
-                    // Clean the thread log files by truncating them
-                    FILE *thread_log_truncate = fopen(thread_log_path_on_host, "w");
-                    if (thread_log_truncate) {
-                        fclose(thread_log_truncate);
-                        fprintf(log_fp, "Thread log %s (Host) cleaned successfully: %s\n", args[i].arch, thread_log_path_on_host);
-                    } else {
-                        fprintf(log_fp, "Error: Error cleaning (truncating) thread log for architecture %s: %s. Error: %s\n", args[i].arch, thread_log_path_on_host, strerror(errno));
-                    }
+        if (loop.terminate_requested && !draining) {
+            fprintf(log_fp, "Termination signal received, exiting after the %d builds in progress...\n", builds_in_flight);
+            draining = 1;
+        }
 
-                    if (access(thread_log_path_in_chroot, F_OK) == 0) {
-                        FILE *thread_chroot_log_truncate = fopen(thread_log_path_in_chroot, "w");
-                        if (thread_chroot_log_truncate) {
-                            fclose(thread_chroot_log_truncate);
-                            fprintf(log_fp, "Thread log %s (Chroot) cleaned successfully: %s\n", args[i].arch, thread_log_path_in_chroot);
-                        } else {
-                            fprintf(log_fp, "Error: Error cleaning (truncating) thread log for architecture %s (Chroot): %s. Error: %s\n", args[i].arch, thread_log_path_in_chroot, strerror(errno));
-                        }
+        // 5.3. Take back the tasks that ended: the result of a poll (a new generation, or an error that stops the daemon), a pruning,
+        // or the discard of a build layer, which ends the build of its pipeline
+        loop_task_t *task;
+        while ((task = task_runner_next_completion(&tasks)) != NULL) {
+            if (task == &repo_poll.task) {
+                if (repo_poll.result == 2) {
+                    generations = repo_poll.generation->id;
+
+                    // The previous generation is only kept alive by the pipelines still building it
+                    if (latest) {
+                        release_generation(latest);
                     }
+                    latest = repo_poll.generation;
+                    repo_poll.generation = NULL;
+                    prune_pending = 1;
+                    log_time(log_fp);
+                    fprintf(log_fp, "Generation %lu ready: sshlirp %s, libslirp %s, release %s.\n", latest->id, latest->commits.sshlirp_commit, latest->commits.libslirp_commit, latest->commits.new_release);
+                } else if (repo_poll.result == 1) {
+                    log_time(log_fp);
+                    fprintf(log_fp, "Error: The poll of the repositories failed. Exiting daemon...\n");
+                    draining = 1;
+                }
+                // else: no new commit found, moving on
+                metrics_record_poll(&metrics, metrics_seconds_since(&repo_poll.started_at), repo_poll.result);
+                first_poll = 0;
 
-                } else {
-                    fprintf(log_fp, "Warning: Could not open for reading the log file (Host) of the thread for architecture %s. Error: %s\n", args[i].arch, strerror(errno));
+                // The pipelines whose build was cancelled build the newest generation again
+                for (int a = 0; a < num_archs; a++) {
+                    pipelines[a].awaiting_poll = 0;
                 }
+                continue;
+            }
+            if (task == &prune.task) {
+                continue;
             }
 
-            // 7.5. Move the compiled binaries to target_dir/initial_check.new_release (or to target_dir/new_commit.new_release)
-            for (int i = 0; i < num_archs; i++) {
-
-                char expected_binary_name[MAX_CONFIG_ATTR_LEN];
-                char source_bin_path[MAX_CONFIG_ATTR_LEN * 3 + 10];
+            // Discard of a build layer: the pipeline is free again. A cancelled build did not handle its generation: the pipeline builds
+            // the newest one after the next poll (or at the next start of the daemon, see REBUILD_MARKER_NAME)
+            arch_pipeline_t *pipeline = task->data;
+            build_generation_t *generation = pipeline->building;
+            if (task->status != 0) {
+                fprintf(log_fp, "Warning: Failed to discard the build layer %s for architecture %s. It will be discarded at the next build.\n", pipeline->args.build_dir, pipeline->args.arch);
+            }
+            if (pipeline->job.cancelled) {
+                pipeline->awaiting_poll = 1;
+            } else {
+                pipeline->built_generation = generation->id;
+            }
+            pipeline->building = NULL;
+            builds_in_flight--;
+            if (release_generation(generation)) {
+                prune_pending = 1;
+            }
+        }
 
-                snprintf(expected_binary_name, sizeof(expected_binary_name), "sshlirp-%s", args[i].arch);
-                snprintf(source_bin_path, sizeof(source_bin_path), "%s%s/bin/%s", args[i].chroot_path, args[i].thread_chroot_target_dir, expected_binary_name);
+        // 6. Poll the repositories when the poll timer has expired, in the task runner (the builds in progress keep running meanwhile, and
+        // the loop keeps handling its events): its result is taken back by 5.3. A poll requested while another one is running starts after it
+        if (loop.poll_due && !draining && !repo_poll.task.in_flight && !prune.task.in_flight) {
+            loop.poll_due = 0;
+            update_daemon_state(DAEMON_STATE_WORKING);
+            if (first_poll) {
+                log_time(log_fp);
+                fprintf(log_fp, "Starting the daemon for the first time...\n");
+            }
+            repo_poll.first_poll = first_poll;
+            repo_poll.generation_id = generations + 1;
+            clock_gettime(CLOCK_MONOTONIC, &repo_poll.started_at);
+            task_runner_submit(&tasks, &repo_poll.task);
+        }
 
-                char final_target_dir[MAX_CONFIG_ATTR_LEN*2];
-                char final_target_path[MAX_CONFIG_ATTR_LEN*3];
+        // 6.1. Prune the snapshots no longer used, unless a poll is exporting new ones (it is done when the poll ends)
+        if (prune_pending && prune.keep_dirs && !repo_poll.task.in_flight && !prune.task.in_flight) {
+            prune_pending = 0;
+            submit_snapshot_prune(&tasks, &prune, latest, pipelines, num_archs);
+        }
 
-                if (new_commit.status == 2) {
-                    snprintf(final_target_dir, sizeof(final_target_dir), "%s/%s", target_dir, new_commit.new_release);
-                } else {
-                    snprintf(final_target_dir, sizeof(final_target_dir), "%s/%s", target_dir, initial_check.new_release);
-                }
+        // 7. Every idle pipeline that has not handled the newest generation yet starts building it (the older ones are skipped)
+        for (int i = 0; !draining && latest && i < num_archs; i++) {
+            arch_pipeline_t *pipeline = &pipelines[i];
+            thread_args_t *args = &pipeline->args;
+            if (pipeline->building || pipeline->awaiting_poll || pipeline->built_generation >= latest->id) {
+                continue;
+            }
 
-                if (access(final_target_dir, F_OK) == -1) {
-                    if (mkdir(final_target_dir, 0755) != 0) {
-                        fprintf(log_fp, "Error: Error creating directory %s for architecture %s. Error: %s. Binaries for this architecture will be placed in the parent directory of the release.\n", final_target_dir, args[i].arch, strerror(errno));
-                        snprintf(final_target_path, sizeof(final_target_path), "%s/%s", target_dir, expected_binary_name);
-                    } else {
-                        fprintf(log_fp, "Directory %s created successfully for the new release (architecture %s).\n", final_target_dir, args[i].arch);
-                        snprintf(final_target_path, sizeof(final_target_path), "%s/%s", final_target_dir, expected_binary_name);
+            // Inizializzo il pull_round (mi sarà utile nel thread per capire se devo setuppare il chroot, il log file locale... o meno)
+            args->pull_round = pipeline->builds_started;
+
+            // Copia sicura del percorso dello snapshot di sshlirp al commit da compilare (mi servirà per sincronizzare i sorgenti del chroot)
+            strncpy(args->sshlirp_snapshot_dir, latest->sshlirp_snapshot_dir, sizeof(args->sshlirp_snapshot_dir) - 1);
+            args->sshlirp_snapshot_dir[sizeof(args->sshlirp_snapshot_dir) - 1] = '\0';
+
+            // Copia sicura del percorso dello snapshot di libslirp (idem)
+            strncpy(args->libslirp_snapshot_dir, latest->libslirp_snapshot_dir, sizeof(args->libslirp_snapshot_dir) - 1);
+            args->libslirp_snapshot_dir[sizeof(args->libslirp_snapshot_dir) - 1] = '\0';
+
+            // Copia sicura del commit di libslirp da compilare (fa parte della chiave della cache dell'installazione di libslirp)
+            strncpy(args->libslirp_commit, latest->commits.libslirp_commit, sizeof(args->libslirp_commit) - 1);
+            args->libslirp_commit[sizeof(args->libslirp_commit) - 1] = '\0';
+
+            // Copia sicura del percorso dello snapshot di vdens, già modificato da modifyVdens.sh (se il testing è abilitato)
+            strncpy(args->vdens_snapshot_dir, latest->vdens_snapshot_dir, sizeof(args->vdens_snapshot_dir) - 1);
+            args->vdens_snapshot_dir[sizeof(args->vdens_snapshot_dir) - 1] = '\0';
+
+            // 7.1. Se gli input della build (sorgenti, commit di libslirp, pacchetti del chroot, script di build) sono gli stessi dell'ultima build
+            // riuscita, il binario precedente viene pubblicato nella nuova release con un hardlink e la build non viene accodata
+            pipeline->build_fingerprint[0] = '\0';
+            if (latest->tree_fingerprint[0] != '\0' && compute_build_fingerprint(args, latest->tree_fingerprint, pipeline->build_fingerprint, log_fp) == 0) {
+                char previous_fingerprint[SHA256_HEX_LEN];
+                char previous_artifact[MAX_CONFIG_ATTR_LEN*3];
+                char reuse_target_path[MAX_CONFIG_ATTR_LEN*3];
+                snprintf(reuse_target_path, sizeof(reuse_target_path), "%s/sshlirp-%s", latest->release_dir, args->arch);
+
+                if (read_build_record(fingerprints_dir, args->arch, previous_fingerprint, previous_artifact, sizeof(previous_artifact), log_fp) == 0 &&
+                    strcmp(previous_fingerprint, pipeline->build_fingerprint) == 0 &&
+                    (mkdir(latest->release_dir, 0755) == 0 || errno == EEXIST) &&
+                    reuse_build_artifact(previous_artifact, reuse_target_path, log_fp) == 0) {
+                    fprintf(log_fp, "Inputs of architecture %s unchanged (fingerprint %.16s): binary %s reused as %s, no build needed.\n", args->arch, pipeline->build_fingerprint, previous_artifact, reuse_target_path);
+                    update_release_manifest(latest->release_dir, args->arch, reuse_target_path, &latest->commits, log_fp);
+                    metrics_record_reuse(&metrics, i, metrics_seconds_since(&latest->found_at));
+                    trace_record_reuse(latest, i, log_fp);
+                    if (strcmp(previous_artifact, reuse_target_path) != 0) {
+                        save_build_record(fingerprints_dir, args->arch, pipeline->build_fingerprint, reuse_target_path, log_fp);
                     }
-                } else {
-                    fprintf(log_fp, "Directory %s already exists for the release (architecture %s).\n", final_target_dir, args[i].arch);
-                    snprintf(final_target_path, sizeof(final_target_path), "%s/%s", final_target_dir, expected_binary_name);
+                    pipeline->built_generation = latest->id;
+                    continue;
                 }
+            }
 
-                if (access(source_bin_path, F_OK) == 0) {
-                    if (access(final_target_path, F_OK) == 0) {
-                        if (remove(final_target_path) != 0) {
-                            fprintf(log_fp, "Error: Error removing old binary %s for architecture %s. Error: %s\n", final_target_path, args[i].arch, strerror(errno));
-                        } else {
-                            fprintf(log_fp, "Old binary for architecture %s removed successfully.\n", args[i].arch);
-                        }
-                    }
+            // 7.2. Queue the build to the worker pool (at most max_parallel_builds of them run at the same time)
+            pipeline->building = latest;
+            latest->refs++;
+            pipeline->builds_started++;
+            builds_in_flight++;
+            idle_logged = 0;
+            update_daemon_state(DAEMON_STATE_WORKING);
+            clock_gettime(CLOCK_MONOTONIC, &pipeline->queued_at);
+            metrics_record_queued(&metrics, i, pipeline->build_fingerprint[0] != '\0');
+            worker_pool_submit(&pool, &pipeline->job);
+            fprintf(log_fp, "Build of release %s (generation %lu) queued for architecture %s.\n", latest->commits.new_release, latest->id, args->arch);
+        }
 
-                    if (rename(source_bin_path, final_target_path) != 0) {
-                        fprintf(log_fp, "Error: Error moving binary %s to %s for architecture %s. Error: %s\n", source_bin_path, final_target_path, args[i].arch, strerror(errno));
-                    } else {
-                        fprintf(log_fp, "Binary for architecture %s moved successfully to %s.\n", args[i].arch, final_target_path);
-                    }
-                } else {
-                    fprintf(log_fp, "Error: Source binary %s not found for architecture %s. Move skipped.\n", source_bin_path, args[i].arch);
-                }
+        // 7.3. Nothing in progress: the daemon sleeps in the event loop until the next poll (or exits, if draining, once the tasks in flight are over)
+        if (builds_in_flight == 0) {
+            collected_build = 0;
+            if (repo_poll.task.in_flight || prune.task.in_flight) {
+                continue;
+            }
+            if (draining) {
+                break;
+            }
+            if (!idle_logged) {
+                fprintf(log_fp, "\n");
+                log_time(log_fp);
+                fprintf(log_fp, "Build completed for all architectures (release %s).\n", latest ? latest->commits.new_release : "none");
+                idle_logged = 1;
             }
 
-            fprintf(log_fp, "\n");
+            update_daemon_state(DAEMON_STATE_SLEEPING);
             log_time(log_fp);
-            fprintf(log_fp, "Build completed for all architectures.\n");
-
-        }/*  else if (round == 0 && initial_check.status == 1 && new_commit.status == 1) {
-            // impossible: initial_check.status == 1 would mean I had an error during check_host_dirs,
-            // so I can't be here.
-            // Note: this scenario might seem to be associated with an "empty" execution (I got here with still the initialization values).
-            // But this is not possible because with round == 0 I execute check_host_dirs, which leaves 
-            // initial_check.status == 1 only if it fails, but in that case it would exit the loop and could never get here.
-
-        } else if (round == 0 && initial_check.status == 0 && new_commit.status == 1) {
-            // On the first run I found everything already cloned and I tried to pull but there was an error.
-            // In this case I have to break (an error in the pull is critical, I can't keep the daemon running)
-            fprintf(log_fp, "Error during check_new_commit on first run: repos already cloned were found but the pull failed. Exiting daemon...\n");
-            break;
+            fprintf(log_fp, "Daemon sleeping until the next poll (every %d seconds)...\n", poll_interval);
+            continue;
+        }
 
-        } else if (round > 0 && initial_check.status == 1 && new_commit.status == 1) {
-            // impossible: initial_check.status == 1 would mean I had an error during check_host_dirs,
-            // so I can't be here. Moreover, round > 0 in this context is paradoxical
+        // 7.4. Handle the builds in the order they finish: each one is collected (result, binary, layer) as soon as the pool signals
+        // its completion, and its pipeline moves on to the newest generation at the next iteration.
+        // Note: the records of the build are already in the main log (or in the batch of the log multiplexer, written before the summary below)
+        build_job_t *job = worker_pool_next_completion(&pool);
+        collected_build = job != NULL;
+        if (!job) {
+            continue;
+        }
+        log_mux_flush(&log_mux);
+
+        arch_pipeline_t *pipeline = &pipelines[job->index];
+        build_generation_t *generation = pipeline->building;
+        thread_args_t *args = &pipeline->args;
+        int build_succeeded = 0;
+        int build_cancelled = job->cancelled;
+        int chroot_ready = job->result != NULL && job->result->chroot_ready;
+        metrics_record_build(&metrics, job->index, job->result, metrics_seconds_since(&pipeline->queued_at));
+        trace_record_build(generation, job->index, &pipeline->queued_at, job->result, log_fp);
+
+        if (job->result != NULL) {
+            thread_result_t *worker_result = job->result;
+            if (worker_result->status != 0) {
+                fprintf(log_fp, "Error: Thread for %s terminated with error: %s\nHere the stats:\n----------------------------------\n", args->arch, worker_result->error_message ? worker_result->error_message : "No error message.");
+            } else {
+                build_succeeded = 1;
+                fprintf(log_fp, "Thread for %s terminated successfully. Here the stats:\n----------------------------------\n", args->arch);
+            }
+            print_build_stats(worker_result, log_fp);
+            fprintf(log_fp, "----------------------------------\n");
 
-        } else if (round > 0 && initial_check.status == 0 && new_commit.status == 1) {
-            // On the first run I had registered that the dirs on the host were already present and the host was already correctly configured (there had been an interruption),
-            // so I went on with the rounds (during which the check_new_commit were also performed correctly).
-            // At this point, however, an error was encountered during the pull of this round and so I have to exit the daemon
-            fprintf(log_fp, "Error during check_new_commit: on startup repos were already cloned, %d rounds were performed correctly but on round %d the pull failed. Exiting daemon...\n", round - 1, round);
-            break;
+            // Free the memory allocated for the thread result
+            if (worker_result->error_message) {
+                free(worker_result->error_message);
+            }
+            free(worker_result);
+        } else {
+            fprintf(log_fp, "Thread for %s terminated without a specific return value (or error in return allocation).\n", args->arch);
+        }
 
-        } else if (round > 0 && initial_check.status == 2 && new_commit.status == 1) {
-            // On the first run I had correctly cloned the repos, then I went on with the rounds (during which the check_new_commit were also performed correctly),
-            // but at this point I encountered an error during check_new_commit; I must therefore exit the daemon
-            fprintf(log_fp, "Error during check_new_commit: on first run the repos were cloned correctly, %d rounds were performed correctly but on round %d the pull failed. Exiting daemon...\n", round - 1, round);
-            break;
+        // 7.4.1. Publish the compiled binary right away in the release directory of the generation it was built from (target_dir/<new_release>)
+        // and record it in the manifest of the release: the binaries of the fast architectures do not wait for the slow ones
+        if (build_cancelled) {
+            fprintf(log_fp, "Build for %s was cancelled: nothing to publish.\n", args->arch);
+        } else {
+            char expected_binary_name[MAX_CONFIG_ATTR_LEN];
+            char source_bin_path[MAX_CONFIG_ATTR_LEN * 3 + 10];
 
-        } else if (round == 0 && initial_check.status == 1 && new_commit.status == 0) {
-            // impossible: initial_check.status == 1 would mean I had an error during check_host_dirs,
-            // so I can't be here. Also because new_commit_status == 0 would mean I executed
-            // check_new_commit despite the check_host_dirs error
+            snprintf(expected_binary_name, sizeof(expected_binary_name), "sshlirp-%s", args->arch);
+            snprintf(source_bin_path, sizeof(source_bin_path), "%s%s/bin/%s", args->build_root_path, args->thread_chroot_target_dir, expected_binary_name);
 
-        } else if (round == 0 && initial_check.status == 0 && new_commit.status == 0) {
-            // On the first run everything was found in its place on the host (the dirs and repos were already present),
-            // check_new_commit was then performed but no new commits were found.
-            // This is one of the cases where I simply have to move on
+            const char *final_target_dir = generation->release_dir;
+            char final_target_path[MAX_CONFIG_ATTR_LEN*3];
 
-        } else if (round > 0 && initial_check.status == 1 && new_commit.status == 0) {
-            // impossible: initial_check.status == 1 would mean I had an error during check_host_dirs,
-            // so I can't be here. Moreover, round > 0 and new_commit_status == 0 in this context are paradoxical
+            if (access(final_target_dir, F_OK) == -1) {
+                if (mkdir(final_target_dir, 0755) != 0) {
+                    fprintf(log_fp, "Error: Error creating directory %s for architecture %s. Error: %s. Binaries for this architecture will be placed in the parent directory of the release.\n", final_target_dir, args->arch, strerror(errno));
+                    snprintf(final_target_path, sizeof(final_target_path), "%s/%s", target_dir, expected_binary_name);
+                } else {
+                    fprintf(log_fp, "Directory %s created successfully for the new release (architecture %s).\n", final_target_dir, args->arch);
+                    snprintf(final_target_path, sizeof(final_target_path), "%s/%s", final_target_dir, expected_binary_name);
+                }
+            } else {
+                fprintf(log_fp, "Directory %s already exists for the release (architecture %s).\n", final_target_dir, args->arch);
+                snprintf(final_target_path, sizeof(final_target_path), "%s/%s", final_target_dir, expected_binary_name);
+            }
 
-        } else if (round > 0 && initial_check.status == 0 && new_commit.status == 0) {
-            // On the first run everything was found in its place on the host (the dirs and repos were already present),
-            // several rounds were then performed and the last check_new_commit found no new commits...
-            // Here too: all normal, I move on
+            if (access(source_bin_path, F_OK) == 0) {
+                // rename replaces an old binary of the same release atomically: there is no moment in which the binary is missing
+                if (access(final_target_path, F_OK) == 0) {
+                    fprintf(log_fp, "Old binary for architecture %s will be replaced.\n", args->arch);
+                }
 
-        } else if (round > 0 && initial_check.status == 2 && new_commit.status == 0) {
-            // On the first run I had correctly cloned the repos, then I went on with the rounds (during which the check_new_commit were also performed correctly),
-            // and at this point I did check_new_commit again but no new commits were found.
-            // In this case too, I just have to move on
+                if (rename(source_bin_path, final_target_path) != 0) {
+                    fprintf(log_fp, "Error: Error moving binary %s to %s for architecture %s. Error: %s\n", source_bin_path, final_target_path, args->arch, strerror(errno));
+                } else {
+                    fprintf(log_fp, "Binary for architecture %s moved successfully to %s.\n", args->arch, final_target_path);
+                    metrics_record_artifact(&metrics, job->index, metrics_seconds_since(&generation->found_at));
 
-        } */
+                    if (update_release_manifest(final_target_dir, args->arch, final_target_path, &generation->commits, log_fp) != 0) {
+                        fprintf(log_fp, "Warning: Binary for architecture %s published, but the release manifest could not be updated.\n", args->arch);
+                    }
 
-        // According to the previous considerations, it is possible to summarize the possible outcomes of the checks in the following cases:
-        else if (new_commit.status == 1) {
-            fprintf(log_fp, "Error: Error during check_new_commit() or check_host_dirs() call. Exiting daemon...\n");
-            break;
-        }
-        else {                                                  // new_commit.status == 0
-            // no new commit found, moving on
+                    // Record the inputs of the successful build: a later build with the same fingerprint will reuse this binary
+                    if (build_succeeded && pipeline->build_fingerprint[0] != '\0') {
+                        save_build_record(fingerprints_dir, args->arch, pipeline->build_fingerprint, final_target_path, log_fp);
+                    }
+                }
+            } else {
+                fprintf(log_fp, "Error: Source binary %s not found for architecture %s. Move skipped.\n", source_bin_path, args->arch);
+            }
         }
-        
-        if (terminate_daemon_flag) {
-            fprintf(log_fp, "Termination signal received before sleep and after operations completed, exiting...\n");
-            break;
+
+        // A build that stopped before the base chroot was ready (failed or cancelled setup) leaves the setup to the next build
+        if (!chroot_ready) {
+            pipeline->builds_started = 0;
         }
 
-        update_daemon_state(DAEMON_STATE_SLEEPING);
-        log_time(log_fp);
-        fprintf(log_fp, "Daemon sleeping for %d seconds...\n", poll_interval);
-        
-        // Sleep cycle and handling of interrupt signals
-        unsigned int time_left = poll_interval;
-        while(time_left > 0) {
-            time_left = sleep(time_left);
-            if (terminate_daemon_flag) {
-                fprintf(log_fp, "Sleep interrupted by termination signal.\n");
-                break; 
-            }
-            if (time_left > 0) {
-                // If I had time left to sleep and I didn't receive a stop signal, then I was disturbed by someone else and so I ignore and sleep again
-                fprintf(log_fp, "Sleep interrupted, %u seconds remaining, continuing to wait...\n", time_left);
+        // 7.4.2. Discard the build layer in the task runner: the binary has been collected, everything else the build wrote goes away with it,
+        // and the next build starts again from the clean base chroot. The pipeline stays busy until the discard ends (see 5.3).
+        // The cancellation is over: the discard (and the next builds) can run scripts again
+        spawn_cancel_reset(&args->cancel);
+        task_runner_submit(&tasks, &pipeline->discard);
+    }
+
+    // The builds of the newest generation that did not end (cancelled by a shutdown, or never started) are run again at the next start
+    for (int i = 0; latest && i < num_archs; i++) {
+        if (pipelines[i].built_generation < latest->id) {
+            FILE *marker_fp = fopen(rebuild_marker, "w");
+            if (!marker_fp) {
+                fprintf(log_fp, "Warning: Failed to create %s (%s): the release %s will not be built again at the next start.\n", rebuild_marker, strerror(errno), latest->commits.new_release);
+                break;
             }
+            fprintf(marker_fp, "%s\n", latest->commits.new_release);
+            fclose(marker_fp);
+            fprintf(log_fp, "The builds of release %s did not end for every architecture: they will be run again at the next start.\n", latest->commits.new_release);
+            break;
         }
+    }
 
-        round++;
+    worker_pool_destroy(&pool);
+    task_runner_destroy(&tasks);
+    log_mux_destroy(&log_mux);
+    control_destroy(&control);
+    metrics_write(&metrics, log_fp);
+    metrics_destroy(&metrics);
+    event_loop_destroy(&loop);
+    if (latest) {
+        release_generation(latest);
+    }
+    for (int i = 0; i < num_archs; i++) {
+        spawn_cancel_destroy(&pipelines[i].args.cancel);
     }
+    free(pipelines);
+    free(prune.keep_dirs);
 
     log_time(log_fp);
     fprintf(log_fp, "sshlirp_ci daemon terminated.\n");
     fclose(log_fp);
 
-    pthread_mutex_destroy(&chroot_setup_mutex);
+    scheduler_destroy(&scheduler);
 
     // Free allocated memory
     for (int i = 0; i < num_archs; i++) {
@@ -601,6 +998,7 @@ int main() {
     free(main_dir);
     free(target_dir);
     free(log_file);
+    free(debian_mirror);
 
     return 0;
 }
\ No newline at end of file
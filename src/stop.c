@@ -2,12 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <errno.h>
 #include "daemon_utils.h"
+#include "control/client.h"
 
 #define MAX_WAIT_SECONDS 600
+#define CHECK_INTERVAL_MS 50
 
 int main() {
     FILE *pid_file_ptr;
@@ -33,76 +36,55 @@ int main() {
         return 1;
     }
 
+    // 3. Ask the daemon to shut down through its control socket: the builds in progress are cancelled (their scripts are killed
+    // together with everything they started) and cleaned up, then the daemon exits. A request sent without a reply in time is still
+    // served by the daemon, so it is only waited for. If the socket cannot be reached, SIGTERM makes the daemon exit after the builds
+    // in progress instead
     printf("Attempting to terminate sshlirp_ci daemon (PID: %d)...\n", daemon_pid);
-    printf("This process may need to wait up to %d seconds for the daemon to enter SLEEPING state.\n", MAX_WAIT_SECONDS);
-
-    FILE *state_file_ptr;
-
-    // 3. Loop to wait for SLEEPING state
-    int attempts = 0;
-    while (attempts < MAX_WAIT_SECONDS) {
-        
-        // Check if the daemon died of natural causes
-        if (kill(daemon_pid, 0) != 0) {
-            fprintf(stderr, "Daemon process %d died on its own.\n", daemon_pid);
-            remove(PID_FILE);
-            remove(STATE_FILE);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char reply[256];
+    int request_status = control_send_request("shutdown", CONTROL_CLIENT_TIMEOUT_MS, reply, sizeof(reply));
+    if (request_status == 0) {
+        printf("Shutdown requested through %s: %s.\n", CONTROL_SOCKET_PATH, reply);
+    } else if (request_status == 1) {
+        fprintf(stderr, "The daemon refused the shutdown: %s\n", reply);
+        return 1;
+    } else if (request_status == -2) {
+        printf("Shutdown requested through %s: the daemon did not answer within %d ms, waiting for it to exit.\n", CONTROL_SOCKET_PATH, CONTROL_CLIENT_TIMEOUT_MS);
+    } else {
+        fprintf(stderr, "Warning: Could not reach the control socket %s (%s). Sending SIGTERM: the daemon will exit after the builds in progress.\n", CONTROL_SOCKET_PATH, strerror(errno));
+        if (kill(daemon_pid, SIGTERM) != 0) {
+            fprintf(stderr, "Error sending SIGTERM to PID %d: %s\n", daemon_pid, strerror(errno));
             return 1;
         }
+    }
 
-        char current_state[50] = {0};
-        state_file_ptr = fopen(STATE_FILE, "r");
-        if (!state_file_ptr && attempts == 0) {
-            fprintf(stderr, "Warning: Could not read state file %s (%s). Possible inconsistency or the daemon is entering termination phase.\n", STATE_FILE, strerror(errno));
-        }
-        
-        if (state_file_ptr) {
-            if (fgets(current_state, sizeof(current_state), state_file_ptr) == NULL) {
-                fprintf(stderr, "Error reading state file %s: %s\n", STATE_FILE, strerror(errno));
-                fclose(state_file_ptr);
-                return 1;
-            }
-            current_state[strcspn(current_state, "\n")] = 0;
+    // 4. Wait for the daemon to exit
+    struct timespec interval = {0, CHECK_INTERVAL_MS * 1000000L};
+    long waited_ms = 0;
+    while (kill(daemon_pid, 0) == 0) {
+        if (waited_ms >= MAX_WAIT_SECONDS * 1000L) {
+            fprintf(stderr, "Timeout: Daemon did not terminate within %d seconds.\n", MAX_WAIT_SECONDS);
+            return 1;
         }
+        nanosleep(&interval, NULL);
+        waited_ms += CHECK_INTERVAL_MS;
+    }
 
-        if (strcmp(current_state, DAEMON_STATE_SLEEPING) == 0) {
-            printf("Daemon is in SLEEPING state. Sending SIGTERM...\n");
-            if (kill(daemon_pid, SIGTERM) == 0) {
-
-                printf("SIGTERM signal sent successfully.\n");
-                // Wait a bit for the daemon to terminate and clean up its files
-                sleep(3);
-                // Check if the files were removed by the daemon
-                if (access(PID_FILE, F_OK) == 0) {
-                    printf("Daemon did not clean up PID file, removing it.\n");
-                    remove(PID_FILE);
-                }
-                if (access(STATE_FILE, F_OK) == 0) {
-                    printf("Daemon did not clean up state file, removing it.\n");
-                    remove(STATE_FILE);
-                }
-                printf("sshlirp_ci daemon terminated.\n");
-                fclose(state_file_ptr);
-                return 0;
-
-            } else {
-
-                fprintf(stderr, "Error sending SIGTERM to PID %d: %s\n", daemon_pid, strerror(errno));
-                fclose(state_file_ptr);
-                return 1;
-            }
-        } else {
-
-            if (attempts == 0) {
-                printf("Daemon is currently in '%s' state. Waiting...\n", strlen(current_state) > 0 ? current_state : "UNKNOWN");
-            }
-
-            sleep(1);
-            attempts++;
-        }
-        fclose(state_file_ptr);
+    // Check if the files were removed by the daemon
+    if (access(PID_FILE, F_OK) == 0) {
+        printf("Daemon did not clean up PID file, removing it.\n");
+        remove(PID_FILE);
+    }
+    if (access(STATE_FILE, F_OK) == 0) {
+        printf("Daemon did not clean up state file, removing it.\n");
+        remove(STATE_FILE);
     }
 
-    fprintf(stderr, "Timeout: Daemon did not enter SLEEPING state within %d seconds.\n", MAX_WAIT_SECONDS);
-    return 1;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("sshlirp_ci daemon terminated in %ld ms.\n", (long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000));
+    return 0;
 }
@@ -9,25 +9,24 @@
 #include "utils/utils.h"
 #include "test.h"
 
-int test_sshlirp_bin(thread_args_t *args, char *sshlirp_bin_path, FILE *host_log_fp) {
+int test_sshlirp_bin(thread_args_t *args, char *sshlirp_bin_path, stage_result_t *accounting, FILE *host_log_fp) {
     // Launch the test script to complete the chroot setup for the test and its execution
-    int script_status = 0;
+    if (!args->sudo_user) {
+        fprintf(host_log_fp, "Warning: [Thread %s] Insufficient permissions to execute script: %s. You cannot run the test script without sudo privileges.\n", args->arch, TEST_SCRIPT_PATH);
+        return 1;
+    }
 
-    script_status = execute_script_for_thread(
-        args->arch,
+    const char* argv[] = {
         TEST_SCRIPT_PATH,
-        sshlirp_bin_path, 
-        args->chroot_path,
-        args->thread_chroot_vdens_dir, 
-        args->thread_log_file, 
-        args->thread_chroot_log_file,
-        NULL,
-        args->sudo_user,
-        host_log_fp
-    );
+        sshlirp_bin_path,
+        args->build_root_path,
+        args->thread_chroot_vdens_dir,
+        NULL
+    };
+    int script_status = execute_script_for_thread(args, argv, accounting, host_log_fp);
 
     if (script_status != 0) {
-        fprintf(host_log_fp, "Error: Error executing test script in %s. Script exit status: %d\n", args->chroot_path, script_status);
+        fprintf(host_log_fp, "Error: Error executing test script in %s. Script exit status: %d\n", args->build_root_path, script_status);
         return 1;
     }
 
@@ -9,168 +9,294 @@
 #include "init/worker_init.h"
 #include "worker.h"
 #include "test.h"
+#include "logmux/logmux.h"
+#include "spawn/spawn.h"
 
-// Funzione sicura per accumulare le stats evitando overflow con strcat su buffer insufficienti
-static int append_stat(thread_result_t *res, const char *text) {
-    if (!text) return 0;
-    if (!res->stats) {
-        res->stats = strdup(text);
-        return res->stats ? 0 : -1;
+// Resources declared to the admission scheduler by each stage (cpu tokens, memory MiB, io tokens, net tokens)
+// Note: the first debootstrap stage declares no CPU nor I/O tokens, so that all the architectures download and unpack at the same time;
+// only the second stage (qemu-emulated for the foreign architectures) is throttled
+static const resource_request_t CHROOT_FIRST_STAGE_COST = {0, 256, 0, 0};
+static const resource_request_t CHROOT_SECOND_STAGE_COST = {2, 768, 1, 0};
+static const resource_request_t PROVISION_COST = {1, 512, 1, 0};
+static const resource_request_t BUILD_LAYER_COST = {0, 0, 1, 0};
+static const resource_request_t WORKER_DIRS_COST = {0, 0, 0, 0};
+static const resource_request_t SOURCES_COPY_COST = {0, 64, 1, 0};
+static const resource_request_t COMPILE_COST = {2, 1024, 0, 0};
+static const resource_request_t TEST_COST = {1, 256, 0, 1};
+
+// Stages of a build (indexes in build_job_t.stages) and their dependencies. The sources copy only writes the synced sources tree of the
+// architecture (a lower layer of the overlay, never mounted before the compilation), so it does not wait for the chroot stages:
+//
+//   chroot first stage -> chroot second stage -> provision -> build layer -> worker directories --+--> compilation -> test
+//   sources copy ---------------------------------------------------------------------------------+
+enum {
+    STAGE_CHROOT_FIRST,
+    STAGE_CHROOT_SECOND,
+    STAGE_PROVISION,
+    STAGE_BUILD_LAYER,
+    STAGE_WORKER_DIRS,
+    STAGE_SOURCES_COPY,
+    STAGE_COMPILE,
+    STAGE_TEST
+};
+
+// Names of the stages in the logs and in the stats of the build
+static const char *const STAGE_NAMES[BUILD_MAX_STAGES] = {
+    [STAGE_CHROOT_FIRST] = "Chroot first stage (download/unpack)",
+    [STAGE_CHROOT_SECOND] = "Chroot second stage",
+    [STAGE_PROVISION] = "Provision",
+    [STAGE_BUILD_LAYER] = "Build layer",
+    [STAGE_WORKER_DIRS] = "Worker directories check/create",
+    [STAGE_SOURCES_COPY] = "Sources copy",
+    [STAGE_COMPILE] = "Compilation",
+    [STAGE_TEST] = "Tests"
+};
+
+// Short names of the stages in the records of the main log and in the labels of the metrics
+static const char *const STAGE_TAGS[BUILD_MAX_STAGES] = {
+    [STAGE_CHROOT_FIRST] = "chroot1",
+    [STAGE_CHROOT_SECOND] = "chroot2",
+    [STAGE_PROVISION] = "provision",
+    [STAGE_BUILD_LAYER] = "layer",
+    [STAGE_WORKER_DIRS] = "dirs",
+    [STAGE_SOURCES_COPY] = "sources",
+    [STAGE_COMPILE] = "compile",
+    [STAGE_TEST] = "test"
+};
+
+// Function that declares a stage of the build, run after the stage it depends on (-1 for none; a dependency skipped in this build is ignored)
+static void add_stage(
+    build_job_t *job,
+    int id,
+    stage_class_t stage_class,
+    const resource_request_t *cost,
+    int (*run)(thread_args_t*, stage_result_t*, FILE*),
+    int dependency
+) {
+    build_stage_t *stage = &job->stages[id];
+    stage->name = STAGE_NAMES[id];
+    stage->tag = STAGE_TAGS[id];
+    stage->stage_class = stage_class;
+    stage->cost = *cost;
+    stage->run = run;
+    stage->state = STAGE_WAITING;
+    stage->job = job;
+    job->stages_left++;
+
+    if (dependency >= 0 && job->stages[dependency].state != STAGE_SKIPPED) {
+        build_stage_t *parent = &job->stages[dependency];
+        parent->dependents[parent->num_dependents++] = id;
+        stage->deps_left++;
     }
-    size_t oldlen = strlen(res->stats);
-    size_t addlen = strlen(text);
-    char *newbuf = realloc(res->stats, oldlen + addlen + 1);
-    if (!newbuf) return -1;
-    res->stats = newbuf;
-    memcpy(res->stats + oldlen, text, addlen + 1);
-    return 0;
 }
 
-#define APPEND_STAT_OR_FAIL(msg_literal) \
-    if (append_stat(result, msg_literal) != 0) { \
-        fprintf(thread_log_fp, "Failed to append stats (%s) for %s.\n", msg_literal, args->arch); \
-        result->error_message = strdup("Out of memory while appending stats"); \
-        free(result->stats); \
-        result->stats = NULL; \
-        fclose(thread_log_fp); \
-        pthread_exit(result); \
-    }
+#ifdef TEST_ENABLED
+// Test stage: runs the tests (vdens + sshlirp) on the binary compiled in the chroot
+static int run_tests(thread_args_t *args, stage_result_t *accounting, FILE *thread_log_fp) {
+    char target_chroot_bin_path[MAX_CONFIG_ATTR_LEN*2];
+    snprintf(target_chroot_bin_path, sizeof(target_chroot_bin_path), "%s/bin/sshlirp-%s", args->thread_chroot_target_dir, args->arch);
+    return test_sshlirp_bin(args, target_chroot_bin_path, accounting, thread_log_fp);
+}
+#endif
+
+// Function that prepares a build for the stage executor of the worker pool, when it is queued: it opens the log stream of the build,
+// allocates its result and declares the dependency graph of its stages. Returns 0 on success, 1 if the build cannot start (job->result,
+// if allocated, says why)
+int build_worker_begin(build_job_t *job) {
+    thread_args_t* args = job->args;
+    memset(job->stages, 0, sizeof(job->stages));
+    job->stages_left = 0;
+    job->stages_running = 0;
+    job->failed = 0;
+    job->completed_tasks = 0;
+    job->total_tasks = 7;
+#ifdef TEST_ENABLED
+    job->total_tasks += 1;
+#endif
+    job->log_fp = NULL;
 
-#define APPEND_PROGRESS_STAT() \
-    char _stat_buf[MAX_CONFIG_ATTR_LEN]; \
-    snprintf(_stat_buf, sizeof(_stat_buf), "Progress: %.2f%%\n", (completed_tasks * 100.0) / total_tasks); \
-    APPEND_STAT_OR_FAIL(_stat_buf); \
-
-#define FAIL_AND_EXIT(log_fmt, err_fmt, ...) \
-    fprintf(thread_log_fp, log_fmt, ##__VA_ARGS__); \
-    char err_buf[MAX_CONFIG_ATTR_LEN*2]; \
-    snprintf(err_buf, sizeof(err_buf), err_fmt, ##__VA_ARGS__); \
-    result->error_message = strdup(err_buf); \
-    APPEND_PROGRESS_STAT(); \
-    fclose(thread_log_fp); \
-    pthread_exit(result); \
-
-void *build_worker(void *arg_ptr) {
-    thread_args_t* args = (thread_args_t*)arg_ptr;
     thread_result_t* result = malloc(sizeof(thread_result_t));
+    job->result = result;
     if (!result) {
-        pthread_exit(NULL); 
+        return 1;
     }
+    memset(result, 0, sizeof(thread_result_t));
     result->status = 1;
-    result->error_message = NULL;
-    result->stats = NULL;
-    int total_tasks = 5;
-#ifdef TEST_ENABLED
-    total_tasks += 1;
-#endif
-    int completed_tasks = 0;
+    result->total_tasks = job->total_tasks;
+    for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+        result->stages[i].name = STAGE_NAMES[i];
+        result->stages[i].tag = STAGE_TAGS[i];
+    }
 
-    // Create the thread's log file on the host if it doesn't exist (note: the directory containing all thread log files
-    // was created by the main init)
-    FILE* thread_log_fp = fopen(args->thread_log_file, "a");
-    if (!thread_log_fp) {
+    // The messages of the build not bound to one of its stages are tagged "build" in the main log (each stage has its own stream, see pool.c)
+    job->log_fp = log_mux_open(args->log_mux, args->arch, "build", NULL);
+    if (!job->log_fp) {
         char err_buf[MAX_CONFIG_ATTR_LEN*2];
-        snprintf(err_buf, sizeof(err_buf), "Failed to open thread log file %s: %s", args->thread_log_file, strerror(errno));
+        snprintf(err_buf, sizeof(err_buf), "Failed to open the log stream of the build for %s: %s", args->arch, strerror(errno));
         result->error_message = strdup(err_buf);
-        char stat_buf[MAX_CONFIG_ATTR_LEN];
-        snprintf(stat_buf, sizeof(stat_buf), "Progress: %.2f%%\n", (completed_tasks * 100.0) / total_tasks);
-        result->stats = strdup(stat_buf);
-        pthread_exit(result);
+        return 1;
     }
 
-    // Set line buffering for the thread's log file, so that prints are written immediately after each newline
-    setvbuf(thread_log_fp, NULL, _IOLBF, 0);
-
-    fprintf(thread_log_fp, "Worker started for arch %s. Pull round: %d.\n", args->arch, args->pull_round);
+    fprintf(job->log_fp, "Worker queued for arch %s. Pull round: %d.\n", args->arch, args->pull_round);
 
     if (args->pull_round == 0) {
-        fprintf(thread_log_fp, "First run (pull_round 0). Checking and eventually setting up chroot for %s.\n", args->arch);
-        
-        // This is the only point in the entire program where it is necessary to lock the mutex. This is not done
-        // for reasons of concurrent access to shared resources (each thread operates on its "personal" files throughout the process), but for reasons of computational
-        // resource consumption. In fact, after several tests, I noticed that the last thread launched terminated the chroot_setup script with status 126 (script found but not executable)
-        // because the other threads launched first consumed all available CPU resources, not allowing the last one to execute the chroot_setup script,
-        // which is indeed the most expensive operation.
-        // The use of this lock therefore guarantees the absence of race conditions, albeit at the expense of total execution time.
-        pthread_mutex_lock(args->chroot_setup_mutex);
-        int setup_status = setup_chroot(args, thread_log_fp);
-        pthread_mutex_unlock(args->chroot_setup_mutex);
-
-        if (setup_status != 0) {
-            FAIL_AND_EXIT("Failed to check/setup chroot for %s.\n", "Chroot check/setup failed for %s.", args->arch);
-        }
-        fprintf(thread_log_fp, "Chroot setup complete for %s.\n", args->arch);
-        result->stats = strdup("Chroot setup: done\n");
-        completed_tasks++;
-
-        // The operation of checking/creating the worker's directories inside the chroot can be done without a lock
-        fprintf(thread_log_fp, "Checking and eventually creating worker directories and log file inside chroot for %s.\n", args->arch);
-        if (check_worker_dirs(args, thread_log_fp) != 0) {
-            FAIL_AND_EXIT("Failed to check/create worker directories for %s.\n", "Worker directories check/create failed for %s.", args->arch);
-        }
-        fprintf(thread_log_fp, "Worker directories and log file checked/created for %s.\n", args->arch);
-        APPEND_STAT_OR_FAIL("Worker directories check/create: done\n");
-        completed_tasks++;
+        fprintf(job->log_fp, "First run (pull_round 0). Checking and eventually setting up chroot for %s.\n", args->arch);
+
+        // The chroot setup is the most expensive operation of the whole program. It used to be serialized with a global mutex because,
+        // when launched all together, the last threads terminated the chroot_setup script with status 126 (script found but not executable):
+        // the other threads had consumed all the available CPU resources. The admission scheduler now solves that starvation, letting
+        // in only as many setups (and compilations, tests...) as the CPU, memory and I/O budget of the host allows.
+        // The setup is split in the two debootstrap stages, scheduled separately: the first one (download and unpack) is network and I/O bound
+        // and runs for all the architectures at once, the second one (package configuration, emulated by qemu) is the CPU-heavy one
+        add_stage(job, STAGE_CHROOT_FIRST, STAGE_CLASS_IO, &CHROOT_FIRST_STAGE_COST, setup_chroot_first_stage, -1);
+        add_stage(job, STAGE_CHROOT_SECOND, STAGE_CLASS_CPU, &CHROOT_SECOND_STAGE_COST, setup_chroot_second_stage, STAGE_CHROOT_FIRST);
     } else {
-        fprintf(thread_log_fp, "Not first run (pull_round %d). Skipping chroot setup and dir check for %s.\n", args->pull_round, args->arch);
-        result->stats = strdup("Chroot setup: skipped\n");
-        completed_tasks = completed_tasks + 2;
+        fprintf(job->log_fp, "Not first run (pull_round %d). Skipping chroot setup for %s.\n", args->pull_round, args->arch);
+        job->completed_tasks += 2;
     }
 
-    fprintf(thread_log_fp, "Copying sources into chroot for %s.\n", args->arch);
+    // Provisioning (toolchain and dependencies) is checked on every build: the script skips the apt work while the manifest recorded
+    // in the chroot still matches the dependency list and the suite
+    add_stage(job, STAGE_PROVISION, STAGE_CLASS_IO, &PROVISION_COST, provision_chroot, STAGE_CHROOT_SECOND);
 
-    // I don't lock this operation with the mutex as I will only be copying the same sshlirp/libslirp source code (read operation)
-    if (copy_sources_to_chroot(args, thread_log_fp) != 0) {
-        FAIL_AND_EXIT("Failed to copy sources for %s.\n", "Sources copy failed for %s.", args->arch);
-    }
-    fprintf(thread_log_fp, "Sources copied for %s.\n", args->arch);
-    APPEND_STAT_OR_FAIL("Sources copy: done\n");
-    completed_tasks++;
-
-    // Compilation (occurs inside the chroot so logs will go to args->thread_chroot_log_file)
-    fprintf(thread_log_fp, "Starting compilation process in chroot for %s...\n", args->arch);
-    if (compile_and_verify_in_chroot(args, thread_log_fp) != 0) {
-        fprintf(thread_log_fp, "...Compilation process failed for %s. Removing sources copy...\n", args->arch);
-        if (remove_sources_copy_from_chroot(args, thread_log_fp) != 0) {
-            FAIL_AND_EXIT("Error: Failed to remove sources copy for %s.\n", "Failed to remove sources copy after compilation failure for %s.", args->arch);
-        }
-        fprintf(thread_log_fp, "Sources copy removed after compilation failure for %s.\n", args->arch);
-        FAIL_AND_EXIT("Compilation failed for %s.\n", "Compilation failed for %s.", args->arch);
-    }
+    // From here on the build works in a throwaway copy-on-write layer over the base chroot (which is only modified by the setup and
+    // provision stages above): creating it only costs a few mkdir (plus the removal of the layer of an interrupted build, hence the I/O token)
+    add_stage(job, STAGE_BUILD_LAYER, STAGE_CLASS_IO, &BUILD_LAYER_COST, create_build_layer, STAGE_PROVISION);
 
-    fprintf(thread_log_fp, "...Compilation successful for %s.\n", args->arch);
-    APPEND_STAT_OR_FAIL("Compilation: done\n");
-    completed_tasks++;
+    // The operation of checking/creating the worker's directories inside the layer needs no tokens
+    add_stage(job, STAGE_WORKER_DIRS, STAGE_CLASS_IO, &WORKER_DIRS_COST, check_worker_dirs, STAGE_BUILD_LAYER);
+
+    // The copy only reads the same sshlirp/libslirp source code, but it is disk-I/O bound, so it takes an I/O token
+    add_stage(job, STAGE_SOURCES_COPY, STAGE_CLASS_IO, &SOURCES_COPY_COST, copy_sources_to_chroot, -1);
+
+    // Compilation (inside the chroot, its output is streamed to the main log like the one of the other stages): it needs both the layer and the sources.
+    // Nothing to clean if it fails: whatever the failed build left behind is in its layer, discarded by the main when it collects the build
+    add_stage(job, STAGE_COMPILE, STAGE_CLASS_CPU, &COMPILE_COST, compile_and_verify_in_chroot, STAGE_WORKER_DIRS);
+    build_stage_t *sources_copy = &job->stages[STAGE_SOURCES_COPY];
+    sources_copy->dependents[sources_copy->num_dependents++] = STAGE_COMPILE;
+    job->stages[STAGE_COMPILE].deps_left++;
 
 #ifdef TEST_ENABLED
-    fprintf(thread_log_fp, "Running tests in chroot for %s...\n", args->arch);
     // Run tests (if enabled) inside the chroot
-    char target_chroot_bin_path[MAX_CONFIG_ATTR_LEN*2];
-    snprintf(target_chroot_bin_path, sizeof(target_chroot_bin_path), "%s/bin/sshlirp-%s", args->thread_chroot_target_dir, args->arch);
-    if (test_sshlirp_bin(args, target_chroot_bin_path, thread_log_fp) != 0) {
-        fprintf(thread_log_fp, "...Tests failed for %s.\n", args->arch);
-        APPEND_STAT_OR_FAIL("Tests: failed\n");
+    add_stage(job, STAGE_TEST, STAGE_CLASS_NET, &TEST_COST, run_tests, STAGE_COMPILE);
+#endif
+
+    return 0;
+}
+
+// Function that records in the result why a cancelled build stopped (unless a stage had already failed before the cancellation)
+static void set_cancel_message(build_job_t *job) {
+    if (!job->result->error_message) {
+        char err_buf[MAX_CONFIG_ATTR_LEN];
+        snprintf(err_buf, sizeof(err_buf), "Build cancelled for %s.", job->args->arch);
+        job->result->error_message = strdup(err_buf);
+    }
+}
+
+// Function called by the stage executor when a stage ends, before the stage is recorded: it logs the outcome of the stage on its stream
+void build_worker_stage_log(build_job_t *job, build_stage_t *stage, int stage_status, FILE *stage_log_fp) {
+    thread_args_t* args = job->args;
+    if (stage_status != 0 && spawn_cancelled(&args->cancel)) {
+        fprintf(stage_log_fp, "Stage %s interrupted for %s: the build was cancelled.\n", stage->name, args->arch);
+    } else if (stage == &job->stages[STAGE_TEST]) {
+        fprintf(stage_log_fp, "...Tests %s for %s.\n", stage_status == 0 ? "passed" : "failed", args->arch);
+    } else {
+        fprintf(stage_log_fp, "Stage %s %s for %s.\n", stage->name, stage_status == 0 ? "done" : "failed", args->arch);
     }
-    else {
-        fprintf(thread_log_fp, "...Tests passed for %s.\n", args->arch);
-        APPEND_STAT_OR_FAIL("Tests: passed\n");
-        completed_tasks++;
+}
+
+// Function called by the stage executor when a stage of the build ends (one at a time for each build, with the lock of the pool held,
+// so it does not log): it stores the accounting of the stage in the result. Returns 1 if the build must stop (the stages not started
+// yet are skipped), 0 otherwise
+int build_worker_stage_done(build_job_t *job, build_stage_t *stage, int stage_status) {
+    thread_args_t* args = job->args;
+    stage_result_t *accounting = &job->result->stages[stage - job->stages];
+    *accounting = stage->accounting;
+    accounting->exit_status = stage_status;
+    accounting->outcome = stage_status == 0 ? STAGE_OUTCOME_DONE : STAGE_OUTCOME_FAILED;
+    if (stage_status == 0) {
+        job->completed_tasks++;
     }
-#endif
 
-    fprintf(thread_log_fp, "Removing sources copy for %s.\n", args->arch);
+    // A stage that fails after a cancellation was interrupted: the build stops there, even in the tests
+    if (stage_status != 0 && spawn_cancelled(&args->cancel)) {
+        set_cancel_message(job);
+        return 1;
+    }
+
+    // A failed test does not fail the build: the binary is published anyway and the stats tell the tests failed
+    if (stage_status != 0 && stage != &job->stages[STAGE_TEST]) {
+        char err_buf[MAX_CONFIG_ATTR_LEN*2];
+        snprintf(err_buf, sizeof(err_buf), "%s failed for %s.", stage->name, args->arch);
+        job->result->error_message = strdup(err_buf);
+        return 1;
+    }
+    return 0;
+}
+
+// Function called by the stage executor when a build is cancelled while some of its stages are still waiting: they are skipped
+void build_worker_cancel(build_job_t *job) {
+    set_cancel_message(job);
+}
+
+// Function called by the stage executor when the build is over (all its stages ended, or one failed and the running ones ended),
+// with the lock of the pool held: it returns the result of the build. Its log stream is closed by build_worker_close
+thread_result_t *build_worker_end(build_job_t *job) {
+    thread_result_t* result = job->result;
+
+    // Note: the layer (with the binary) is kept until the main has collected them, then it is discarded
+    if (!job->failed) {
+        result->status = 0;
+    }
+    result->completed_tasks = job->completed_tasks;
+    result->chroot_ready = job->args->pull_round > 0 || result->stages[STAGE_CHROOT_SECOND].outcome == STAGE_OUTCOME_DONE;
+    return result;
+}
+
+// Function called when the completed build is taken off the completion queue: it logs how the build ended and closes its log stream
+void build_worker_close(build_job_t *job) {
+    if (!job->log_fp) {
+        return;
+    }
+    if (job->result && job->result->status == 0) {
+        fprintf(job->log_fp, "Worker finished successfully for arch %s.\n", job->args->arch);
+    } else if (job->cancelled) {
+        fprintf(job->log_fp, "Build cancelled for %s: the stages not started yet were skipped.\n", job->args->arch);
+    }
+    fclose(job->log_fp);
+    job->log_fp = NULL;
+}
+
+// Function that returns the seconds elapsed between two CLOCK_MONOTONIC times
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
-    // Deleting source copies (chroot level operations, does not require mutex)
-    if (remove_sources_copy_from_chroot(args, thread_log_fp) != 0) {
-        FAIL_AND_EXIT("Error: Failed to remove sources copy for %s.\n", "Failed to remove sources copy for %s.", args->arch);
+// Function that writes the stats of a build to log_fp: one line for each stage, with its duration and the resources used by its scripts
+void print_build_stats(const thread_result_t *result, FILE *log_fp) {
+    for (int i = 0; i < BUILD_MAX_STAGES; i++) {
+        const stage_result_t *stage = &result->stages[i];
+#ifndef TEST_ENABLED
+        if (i == STAGE_TEST) {
+            continue;
+        }
+#endif
+        if (stage->outcome == STAGE_OUTCOME_SKIPPED) {
+            fprintf(log_fp, "%s: skipped\n", stage->name);
+            continue;
+        }
+        const char *outcome = stage->outcome == STAGE_OUTCOME_DONE ? "done" : "failed";
+        if (i == STAGE_TEST) {
+            outcome = stage->outcome == STAGE_OUTCOME_DONE ? "passed" : "failed";
+        }
+        fprintf(log_fp, "%s: %s in %.1f s (cpu user %ld.%01ld s, sys %ld.%01ld s, peak RSS %ld MiB, %.1f MiB written",
+                stage->name, outcome, elapsed_seconds(&stage->start, &stage->end),
+                (long)stage->cpu_user.tv_sec, (long)stage->cpu_user.tv_usec / 100000, (long)stage->cpu_sys.tv_sec, (long)stage->cpu_sys.tv_usec / 100000,
+                stage->max_rss_kb / 1024, (double)stage->bytes_written / (1024.0 * 1024.0));
+        if (stage->term_signal != 0) {
+            fprintf(log_fp, ", killed by signal %d", stage->term_signal);
+        }
+        fprintf(log_fp, ")\n");
     }
-    APPEND_STAT_OR_FAIL("Sources removal: done\n");
-    completed_tasks++;
-
-    fprintf(thread_log_fp, "Worker finished successfully for arch %s.\n", args->arch);
-    
-    result->status = 0;
-    APPEND_PROGRESS_STAT();
-    fclose(thread_log_fp);
-    pthread_exit(result);
-}
\ No newline at end of file
+    fprintf(log_fp, "Progress: %.2f%%\n", result->total_tasks > 0 ? (result->completed_tasks * 100.0) / result->total_tasks : 0.0);
+}